@@ -0,0 +1,81 @@
+//
+//  audio_resampler.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/12.
+//
+
+#include "audio_resampler.hpp"
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/opt.h>
+#include <libswresample/swresample.h>
+}
+
+AudioResampler::AudioResampler(int out_sample_rate,
+                               AVSampleFormat out_sample_fmt,
+                               int64_t out_channel_layout)
+    : out_sample_rate_(out_sample_rate),
+      out_sample_fmt_(out_sample_fmt),
+      out_channel_layout_(out_channel_layout),
+      out_channels_(av_get_channel_layout_nb_channels(out_channel_layout)) {}
+
+AudioResampler::~AudioResampler() { swr_free(&swr_ctx_); }
+
+bool AudioResampler::Init(const AVFrame* frame) {
+  swr_ctx_ = swr_alloc();
+  if (!swr_ctx_) {
+    return false;
+  }
+  int64_t in_channel_layout =
+      frame->channel_layout
+          ? frame->channel_layout
+          : av_get_default_channel_layout(frame->channels);
+  av_opt_set_int(swr_ctx_, "in_channel_layout", in_channel_layout, 0);
+  av_opt_set_int(swr_ctx_, "in_sample_rate", frame->sample_rate, 0);
+  av_opt_set_sample_fmt(swr_ctx_, "in_sample_fmt",
+                        (AVSampleFormat)frame->format, 0);
+  av_opt_set_int(swr_ctx_, "out_channel_layout", out_channel_layout_, 0);
+  av_opt_set_int(swr_ctx_, "out_sample_rate", out_sample_rate_, 0);
+  av_opt_set_sample_fmt(swr_ctx_, "out_sample_fmt", out_sample_fmt_, 0);
+  if (swr_init(swr_ctx_) < 0) {
+    swr_free(&swr_ctx_);
+    return false;
+  }
+  return true;
+}
+
+int AudioResampler::Convert(const AVFrame* frame, const uint8_t** out) {
+  if (frame->sample_rate <= 0) {
+    return -1;
+  }
+  if (!swr_ctx_ && !Init(frame)) {
+    return -1;
+  }
+
+  int out_samples = av_rescale_rnd(
+      swr_get_delay(swr_ctx_, frame->sample_rate) + frame->nb_samples,
+      out_sample_rate_, frame->sample_rate, AV_ROUND_UP);
+  int capacity = av_samples_get_buffer_size(nullptr, out_channels_,
+                                            out_samples, out_sample_fmt_, 1);
+  if (capacity < 0) {
+    return capacity;
+  }
+  if (buffer_.size() < static_cast<size_t>(capacity)) {
+    buffer_.resize(capacity);
+  }
+
+  uint8_t* out_planes[1] = {buffer_.data()};
+  int converted = swr_convert(swr_ctx_, out_planes, out_samples,
+                              (const uint8_t**)frame->extended_data,
+                              frame->nb_samples);
+  if (converted < 0) {
+    return converted;
+  }
+
+  *out = buffer_.data();
+  return converted * out_channels_ *
+         av_get_bytes_per_sample(out_sample_fmt_);
+}
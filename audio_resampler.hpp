@@ -0,0 +1,46 @@
+//
+//  audio_resampler.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/12.
+//
+
+#ifndef audio_resampler_hpp
+#define audio_resampler_hpp
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/samplefmt.h>
+}
+
+#include <cstdint>
+#include <vector>
+
+struct SwrContext;
+
+// 把解码出的音频帧重采样成声卡要求的交织格式
+class AudioResampler {
+ public:
+  AudioResampler(int out_sample_rate, AVSampleFormat out_sample_fmt,
+                 int64_t out_channel_layout);
+  ~AudioResampler();
+
+  AudioResampler(const AudioResampler&) = delete;
+  AudioResampler& operator=(const AudioResampler&) = delete;
+
+  // 转换一帧，*out 指向内部 buffer，下次调用前有效。
+  // 返回输出的字节数，失败返回负数
+  int Convert(const AVFrame* frame, const uint8_t** out);
+
+ private:
+  bool Init(const AVFrame* frame);
+
+  int out_sample_rate_;
+  AVSampleFormat out_sample_fmt_;
+  int64_t out_channel_layout_;
+  int out_channels_;
+  SwrContext* swr_ctx_ = nullptr;
+  std::vector<uint8_t> buffer_;
+};
+
+#endif /* audio_resampler_hpp */
@@ -0,0 +1,259 @@
+//
+//  audio_time_stretcher.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/28.
+//
+
+#include "audio_time_stretcher.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const int kHopsPerSecond = 100;    // 每跳 10ms
+static const int kSearchPerSecond = 200;  // 搜索半径 5ms
+
+AudioTimeStretcher::AudioTimeStretcher(int sample_rate, int channels,
+                                       AVSampleFormat sample_fmt)
+    : sample_rate_(sample_rate),
+      channels_(std::max(channels, 1)),
+      sample_fmt_(sample_fmt),
+      bytes_per_frame_(av_get_bytes_per_sample(sample_fmt) * channels_),
+      hop_(std::max(sample_rate / kHopsPerSecond, 1)),
+      search_(std::max(sample_rate / kSearchPerSecond, 1)),
+      window_(2 * hop_),
+      tail_(hop_ * channels_) {
+  // 周期 Hann 窗，错开半个窗长相加恒为 1
+  for (int i = 0; i < 2 * hop_; ++i) {
+    window_[i] = 0.5f - 0.5f * std::cos(static_cast<float>(M_PI) * i / hop_);
+  }
+}
+
+void AudioTimeStretcher::Reset() {
+  input_.clear();
+  pos_ = 0;
+  last_ = 0;
+  active_ = false;
+}
+
+int AudioTimeStretcher::Process(const uint8_t* data, int size, double pts,
+                                double rate, const uint8_t** out,
+                                double* out_pts) {
+  int frames = size / bytes_per_frame_;
+  if (rate == 1 && !active_ && input_.empty()) {
+    *out = data;
+    *out_pts = pts;
+    return frames * bytes_per_frame_;
+  }
+
+  size_t buffered = input_.size() / channels_;
+  if (buffered == 0) {
+    input_pts_ = pts;
+    pos_ = 0;
+    last_ = 0;
+  } else if (std::isnan(input_pts_) && !std::isnan(pts)) {
+    input_pts_ = pts - static_cast<double>(buffered) / sample_rate_;
+  }
+  input_.resize(input_.size() + static_cast<size_t>(frames) * channels_);
+  ToFloat(data, frames, &input_[buffered * channels_]);
+  int available = static_cast<int>(input_.size() / channels_);
+
+  out_.clear();
+  *out_pts = NAN;
+  if (rate == 1) {
+    // 切回 1x：在名义位置淡入原始信号，之后的输入原样输出
+    int p = static_cast<int>(std::lround(pos_));
+    if (p + hop_ > available) {
+      *out = nullptr;
+      return 0;
+    }
+    const float* src = &input_[static_cast<size_t>(p) * channels_];
+    out_.assign(src, static_cast<const float*>(input_.data()) + input_.size());
+    if (active_) {
+      for (int i = 0; i < hop_; ++i) {
+        for (int c = 0; c < channels_; ++c) {
+          float& sample = out_[i * channels_ + c];
+          sample = tail_[i * channels_ + c] + sample * window_[i];
+        }
+      }
+    }
+    *out_pts = PtsAt(p);
+    input_.clear();
+    active_ = false;
+  } else {
+    while (true) {
+      int p = static_cast<int>(std::lround(pos_));
+      if (p + search_ + 2 * hop_ > available) {
+        break;
+      }
+      int start = p;
+      double hop_pts;
+      size_t base = out_.size();
+      out_.resize(base + static_cast<size_t>(hop_) * channels_);
+      if (!active_) {
+        // 刚开始变速：这一跳原样输出，和之前透传的声音直接接上
+        memcpy(&out_[base], &input_[static_cast<size_t>(p) * channels_],
+               sizeof(float) * hop_ * channels_);
+        hop_pts = PtsAt(p);
+        active_ = true;
+      } else {
+        start = BestOffset(p, last_ + hop_);
+        const float* src = &input_[static_cast<size_t>(start) * channels_];
+        for (int i = 0; i < hop_; ++i) {
+          for (int c = 0; c < channels_; ++c) {
+            out_[base + i * channels_ + c] =
+                tail_[i * channels_ + c] + src[i * channels_ + c] * window_[i];
+          }
+        }
+        // 这一跳听起来是上一段的自然延续
+        hop_pts = PtsAt(last_ + hop_);
+      }
+      const float* second =
+          &input_[static_cast<size_t>(start + hop_) * channels_];
+      for (int i = 0; i < hop_; ++i) {
+        for (int c = 0; c < channels_; ++c) {
+          tail_[i * channels_ + c] =
+              second[i * channels_ + c] * window_[hop_ + i];
+        }
+      }
+      if (base == 0) {
+        *out_pts = hop_pts;
+      }
+      last_ = start;
+      pos_ += hop_ * rate;
+    }
+
+    // 下一跳只会用到上一段的延续和名义位置往前 search_ 之后的数据
+    int drop = std::min(last_ + hop_,
+                        static_cast<int>(std::lround(pos_)) - search_);
+    drop = std::min(drop, available);
+    if (drop > 0) {
+      input_.erase(input_.begin(),
+                   input_.begin() + static_cast<size_t>(drop) * channels_);
+      pos_ -= drop;
+      last_ -= drop;
+      input_pts_ += static_cast<double>(drop) / sample_rate_;
+    }
+  }
+
+  int out_frames = static_cast<int>(out_.size() / channels_);
+  out_bytes_.resize(static_cast<size_t>(out_frames) * bytes_per_frame_);
+  FromFloat(out_.data(), out_frames, out_bytes_.data());
+  *out = out_bytes_.data();
+  return out_frames * bytes_per_frame_;
+}
+
+int AudioTimeStretcher::BestOffset(int pos, int target) {
+  int begin = std::max(pos - search_, 0);
+  int end = pos + search_;  // 含
+  int span = end + hop_ - begin;
+  mono_.resize(span + hop_);
+  for (int i = 0; i < span; ++i) {
+    const float* frame = &input_[static_cast<size_t>(begin + i) * channels_];
+    float sum = 0;
+    for (int c = 0; c < channels_; ++c) {
+      sum += frame[c];
+    }
+    mono_[i] = sum;
+  }
+  float* reference = &mono_[span];
+  for (int i = 0; i < hop_; ++i) {
+    const float* frame = &input_[static_cast<size_t>(target + i) * channels_];
+    float sum = 0;
+    for (int c = 0; c < channels_; ++c) {
+      sum += frame[c];
+    }
+    reference[i] = sum;
+  }
+
+  // 隔一个样本算一次，相关峰比样本间距宽得多，精度够用
+  int best = pos;
+  double best_score = -1e300;
+  for (int candidate = begin; candidate <= end; ++candidate) {
+    const float* x = &mono_[candidate - begin];
+    double corr = 0;
+    double energy = 1e-9;
+    for (int i = 0; i < hop_; i += 2) {
+      corr += x[i] * reference[i];
+      energy += x[i] * x[i];
+    }
+    double score = corr / std::sqrt(energy);
+    if (score > best_score) {
+      best_score = score;
+      best = candidate;
+    }
+  }
+  return best;
+}
+
+double AudioTimeStretcher::PtsAt(double frame) const {
+  return input_pts_ + frame / sample_rate_;
+}
+
+void AudioTimeStretcher::ToFloat(const uint8_t* data, int frames,
+                                 float* dst) const {
+  int count = frames * channels_;
+  switch (sample_fmt_) {
+    case AV_SAMPLE_FMT_U8:
+      for (int i = 0; i < count; ++i) {
+        dst[i] = (data[i] - 128) / 128.0f;
+      }
+      break;
+    case AV_SAMPLE_FMT_S16: {
+      const int16_t* src = reinterpret_cast<const int16_t*>(data);
+      for (int i = 0; i < count; ++i) {
+        dst[i] = src[i] / 32768.0f;
+      }
+      break;
+    }
+    case AV_SAMPLE_FMT_S32: {
+      const int32_t* src = reinterpret_cast<const int32_t*>(data);
+      for (int i = 0; i < count; ++i) {
+        dst[i] = static_cast<float>(src[i] / 2147483648.0);
+      }
+      break;
+    }
+    case AV_SAMPLE_FMT_FLT:
+      memcpy(dst, data, sizeof(float) * count);
+      break;
+    default:
+      std::fill(dst, dst + count, 0.0f);
+      break;
+  }
+}
+
+void AudioTimeStretcher::FromFloat(const float* src, int frames,
+                                   uint8_t* data) const {
+  int count = frames * channels_;
+  switch (sample_fmt_) {
+    case AV_SAMPLE_FMT_U8:
+      for (int i = 0; i < count; ++i) {
+        float v = std::min(std::max(src[i], -1.0f), 1.0f);
+        data[i] = static_cast<uint8_t>(std::lround(v * 127.0f) + 128);
+      }
+      break;
+    case AV_SAMPLE_FMT_S16: {
+      int16_t* dst = reinterpret_cast<int16_t*>(data);
+      for (int i = 0; i < count; ++i) {
+        float v = std::min(std::max(src[i], -1.0f), 1.0f);
+        dst[i] = static_cast<int16_t>(std::lround(v * 32767.0f));
+      }
+      break;
+    }
+    case AV_SAMPLE_FMT_S32: {
+      int32_t* dst = reinterpret_cast<int32_t*>(data);
+      for (int i = 0; i < count; ++i) {
+        double v = std::min(std::max<double>(src[i], -1.0), 1.0);
+        dst[i] = static_cast<int32_t>(std::llround(v * 2147483647.0));
+      }
+      break;
+    }
+    case AV_SAMPLE_FMT_FLT:
+      memcpy(data, src, sizeof(float) * count);
+      break;
+    default:
+      memset(data, 0, static_cast<size_t>(frames) * bytes_per_frame_);
+      break;
+  }
+}
@@ -0,0 +1,65 @@
+//
+//  audio_time_stretcher.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/28.
+//
+
+#ifndef audio_time_stretcher_hpp
+#define audio_time_stretcher_hpp
+
+extern "C" {
+#include <libavutil/samplefmt.h>
+}
+
+#include <cstdint>
+#include <vector>
+
+// WSOLA 变速不变调：输出固定每 10ms 一跳，每跳按倍速在输入上前进，
+// 在名义位置前后 5ms 内找和上一段自然延续最像的一段，用 Hann 窗交叉淡化
+// 接上。每秒输出的跳数固定，相关搜索的开销和倍速无关，2x 时也不会翻倍。
+// 输入输出都是声卡格式的交织 PCM（重采样之后），只在音频输出任务里调用。
+// 1x 时直接透传；从变速切回 1x 时淡入到原始信号，剩下的输入原样吐出
+class AudioTimeStretcher {
+ public:
+  AudioTimeStretcher(int sample_rate, int channels, AVSampleFormat sample_fmt);
+
+  AudioTimeStretcher(const AudioTimeStretcher&) = delete;
+  AudioTimeStretcher& operator=(const AudioTimeStretcher&) = delete;
+
+  // 送入 size 字节，pts 是第一个样本的时间（秒），NAN 表示紧接上一段。
+  // *out 指向输出，下次调用前有效；*out_pts 是输出第一个样本对应的媒体
+  // 时间（NAN 表示未知）。返回输出字节数，攒够一跳之前可能返回 0
+  int Process(const uint8_t* data, int size, double pts, double rate,
+              const uint8_t** out, double* out_pts);
+  // seek 之后丢掉缓存的输入和上一段的尾巴
+  void Reset();
+
+ private:
+  // 在 [pos - search_, pos + search_] 里找和 target 起的一跳最像的起点
+  int BestOffset(int pos, int target);
+  void ToFloat(const uint8_t* data, int frames, float* dst) const;
+  void FromFloat(const float* src, int frames, uint8_t* dst) const;
+  double PtsAt(double frame) const;
+
+  int sample_rate_;
+  int channels_;
+  AVSampleFormat sample_fmt_;
+  int bytes_per_frame_;
+  int hop_;     // 每跳输出的帧数
+  int search_;  // 相关搜索的半径（帧）
+  std::vector<float> window_;  // 长度 2 * hop_ 的 Hann 窗
+
+  std::vector<float> input_;  // 还没用完的输入，交织
+  double input_pts_ = 0;      // input_ 第一帧的时间，NAN 表示未知
+  double pos_ = 0;            // 下一跳在 input_ 里的名义位置
+  int last_ = 0;              // 上一跳实际选中的起点
+  bool active_ = false;       // tail_ 有效，正在变速
+  std::vector<float> tail_;   // 上一段后半截乘过窗，等和下一段叠加
+
+  std::vector<float> mono_;  // 相关搜索用的单声道混音
+  std::vector<float> out_;
+  std::vector<uint8_t> out_bytes_;
+};
+
+#endif /* audio_time_stretcher_hpp */
@@ -0,0 +1,177 @@
+//
+//  bench_media.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/12.
+//
+
+#include "bench_media.hpp"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+#include <spdlog/spdlog.h>
+
+#include <cmath>
+
+AVFramePtr MakeTestPicture(int width, int height, AVPixelFormat format,
+                           int index) {
+  const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+  if (!desc) {
+    return nullptr;
+  }
+  AVFramePtr frame = createAVFramePtr();
+  frame->width = width;
+  frame->height = height;
+  frame->format = format;
+  if (av_frame_get_buffer(frame.get(), 0) < 0) {
+    return nullptr;
+  }
+
+  // 每个平面填不同斜率的渐变，高位深格式写 16bit 样本
+  bool high_depth = desc->comp[0].depth > 8;
+  int max_value = (1 << desc->comp[0].depth) - 1;
+  for (int plane = 0; plane < 4 && frame->data[plane]; ++plane) {
+    bool chroma = plane == 1 || plane == 2;
+    int plane_h =
+        chroma ? AV_CEIL_RSHIFT(height, desc->log2_chroma_h) : height;
+    int row_bytes = av_image_get_linesize(format, width, plane);
+    for (int y = 0; y < plane_h; ++y) {
+      uint8_t* row = frame->data[plane] + y * frame->linesize[plane];
+      if (high_depth) {
+        uint16_t* samples = reinterpret_cast<uint16_t*>(row);
+        for (int x = 0; x < row_bytes / 2; ++x) {
+          samples[x] = (x * (plane + 1) + y + index * 3) & max_value;
+        }
+      } else {
+        for (int x = 0; x < row_bytes; ++x) {
+          row[x] = static_cast<uint8_t>(x * (plane + 1) + y + index * 3);
+        }
+      }
+    }
+  }
+  return frame;
+}
+
+AVFramePtr MakeTestAudio(int sample_rate, int channels, int nb_samples,
+                         AVSampleFormat format, int index) {
+  AVFramePtr frame = createAVFramePtr();
+  frame->sample_rate = sample_rate;
+  frame->channels = channels;
+  frame->channel_layout = av_get_default_channel_layout(channels);
+  frame->nb_samples = nb_samples;
+  frame->format = format;
+  frame->pts = static_cast<int64_t>(index) * nb_samples;
+  if (av_frame_get_buffer(frame.get(), 0) < 0) {
+    return nullptr;
+  }
+
+  // 只生成 float planar，其他格式交给 swr 的输入测试没有意义
+  if (format != AV_SAMPLE_FMT_FLTP) {
+    return frame;
+  }
+  for (int c = 0; c < channels; ++c) {
+    float* samples = reinterpret_cast<float*>(frame->extended_data[c]);
+    for (int i = 0; i < nb_samples; ++i) {
+      int64_t t = frame->pts + i;
+      samples[i] = 0.5f * std::sin(2.0 * M_PI * 440.0 * t / sample_rate);
+    }
+  }
+  return frame;
+}
+
+static bool EncodeAndWrite(AVCodecContext* codec_ctx, AVFormatContext* fmt_ctx,
+                           AVStream* stream, const AVFrame* frame) {
+  if (avcodec_send_frame(codec_ctx, frame) < 0) {
+    return false;
+  }
+  AVPacket* pkt = av_packet_alloc();
+  int ret = 0;
+  while ((ret = avcodec_receive_packet(codec_ctx, pkt)) == 0) {
+    av_packet_rescale_ts(pkt, codec_ctx->time_base, stream->time_base);
+    pkt->stream_index = stream->index;
+    ret = av_interleaved_write_frame(fmt_ctx, pkt);
+    if (ret < 0) {
+      break;
+    }
+  }
+  av_packet_free(&pkt);
+  return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF;
+}
+
+bool WriteTestVideo(const std::string& path, int width, int height,
+                    int frames, int fps) {
+  const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+  if (!codec) {
+    spdlog::error("mpeg4 encoder not available");
+    return false;
+  }
+
+  AVFormatContext* fmt_ctx = NULL;
+  if (avformat_alloc_output_context2(&fmt_ctx, NULL, "mp4", path.c_str()) <
+      0) {
+    spdlog::error("could not create output context for {}", path);
+    return false;
+  }
+
+  AVCodecContext* codec_ctx = avcodec_alloc_context3(codec);
+  codec_ctx->width = width;
+  codec_ctx->height = height;
+  codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  codec_ctx->time_base = AVRational{1, fps};
+  codec_ctx->framerate = AVRational{fps, 1};
+  codec_ctx->gop_size = fps * 2;
+  codec_ctx->max_b_frames = 2;
+  codec_ctx->bit_rate = static_cast<int64_t>(width) * height * fps / 10;
+  if (fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
+    codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+
+  bool ok = false;
+  AVStream* stream = NULL;
+  if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
+    spdlog::error("could not open mpeg4 encoder");
+    goto end;
+  }
+
+  stream = avformat_new_stream(fmt_ctx, NULL);
+  if (!stream ||
+      avcodec_parameters_from_context(stream->codecpar, codec_ctx) < 0) {
+    goto end;
+  }
+  stream->time_base = codec_ctx->time_base;
+
+  if (avio_open(&fmt_ctx->pb, path.c_str(), AVIO_FLAG_WRITE) < 0) {
+    spdlog::error("could not open {}", path);
+    goto end;
+  }
+  if (avformat_write_header(fmt_ctx, NULL) < 0) {
+    goto close;
+  }
+
+  for (int i = 0; i < frames; ++i) {
+    AVFramePtr picture = MakeTestPicture(width, height, AV_PIX_FMT_YUV420P, i);
+    if (!picture) {
+      goto close;
+    }
+    picture->pts = i;
+    if (!EncodeAndWrite(codec_ctx, fmt_ctx, stream, picture.get())) {
+      goto close;
+    }
+  }
+  if (!EncodeAndWrite(codec_ctx, fmt_ctx, stream, NULL)) {
+    goto close;
+  }
+  ok = av_write_trailer(fmt_ctx) == 0;
+
+close:
+  avio_closep(&fmt_ctx->pb);
+end:
+  avcodec_free_context(&codec_ctx);
+  avformat_free_context(fmt_ctx);
+  return ok;
+}
@@ -0,0 +1,35 @@
+//
+//  bench_media.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/12.
+//
+
+#ifndef bench_media_hpp
+#define bench_media_hpp
+
+extern "C" {
+#include <libavutil/pixfmt.h>
+#include <libavutil/samplefmt.h>
+}
+
+#include <string>
+
+#include "frame_pool.hpp"
+
+// benchmark 用的合成素材，全部在本地生成，不依赖外部文件
+
+// 生成一帧带移动渐变的图像，index 不同内容不同，避免编码器/缓存取巧。
+// 支持 8bit 和高位深的 planar/semi-planar YUV
+AVFramePtr MakeTestPicture(int width, int height, AVPixelFormat format,
+                           int index);
+
+// 生成一帧 440Hz 正弦波
+AVFramePtr MakeTestAudio(int sample_rate, int channels, int nb_samples,
+                         AVSampleFormat format, int index);
+
+// 用 libavcodec 自带的 mpeg4 编码器编码 frames 帧写到 path（mp4 封装）
+bool WriteTestVideo(const std::string& path, int width, int height,
+                    int frames, int fps);
+
+#endif /* bench_media_hpp */
@@ -14,7 +14,8 @@ class BlockingQueue {
   void replace(std::queue<T> queue) {
     boost::mutex::scoped_lock lock(mutex_);
     queue_ = std::move(queue);
-    condition_.notify_one();
+    condition_.notify_all();
+    condition_full_.notify_all();
   }
 
   void clear() {
@@ -22,6 +23,22 @@ class BlockingQueue {
     std::queue<T> empty;
     std::swap(queue_, empty);
     condition_.notify_one();
+    condition_full_.notify_all();
+  }
+
+  // 丢掉满足条件的元素，放走等空间的 push
+  template <typename Pred>
+  void remove_if(Pred pred) {
+    boost::mutex::scoped_lock lock(mutex_);
+    std::queue<T> kept;
+    while (!queue_.empty()) {
+      if (!pred(queue_.front())) {
+        kept.push(std::move(queue_.front()));
+      }
+      queue_.pop();
+    }
+    std::swap(queue_, kept);
+    condition_full_.notify_all();
   }
 
   void push(const T& value) {
@@ -0,0 +1,96 @@
+//
+//  decode_quality.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/28.
+//
+
+#include "decode_quality.hpp"
+
+#include <spdlog/fmt/fmt.h>
+
+#include <algorithm>
+
+static const int64_t kWindowUs = 1000000;
+// 两次调整之间至少隔这么久，等新设置在帧并行的流水线里生效
+static const int64_t kMinChangeIntervalUs = 2000000;
+// 一个窗口里丢帧超过这个比例或平均迟到超过这个时间算跟不上
+static const double kDropRatioThreshold = 0.1;
+static const double kLateThreshold = 0.05;
+// 队列低于这个填充率说明解码供不上，不是送显慢
+static const double kStarvedFill = 0.5;
+// 恢复：连续这么多个窗口没丢帧、平均迟到很小、队列有余量
+static const int kCleanWindowsToRecover = 5;
+static const double kCleanLate = 0.01;
+
+static const DecodeQualitySettings kLevels[] = {
+    {"full", AVDISCARD_DEFAULT, AVDISCARD_DEFAULT, AVDISCARD_DEFAULT},
+    {"skip non-ref frames", AVDISCARD_NONREF, AVDISCARD_DEFAULT,
+     AVDISCARD_DEFAULT},
+    {"skip loop filter", AVDISCARD_NONREF, AVDISCARD_ALL, AVDISCARD_NONREF},
+};
+static const int kLevelCount = sizeof(kLevels) / sizeof(kLevels[0]);
+
+const DecodeQualitySettings& DecodeQualityController::Settings(int level) {
+  return kLevels[std::min(std::max(level, 0), kLevelCount - 1)];
+}
+
+int DecodeQualityController::max_level() const { return kLevelCount - 1; }
+
+void DecodeQualityController::Reset(int64_t now_us) {
+  level_ = 0;
+  reason_.clear();
+  last_change_us_ = now_us;
+  clean_windows_ = 0;
+  StartWindow(now_us);
+}
+
+void DecodeQualityController::StartWindow(int64_t now_us) {
+  window_start_us_ = now_us;
+  frames_ = 0;
+  dropped_ = 0;
+  late_sum_ = 0;
+  fill_sum_ = 0;
+}
+
+bool DecodeQualityController::OnFrame(int64_t now_us, double late,
+                                      bool dropped, double queue_fill) {
+  ++frames_;
+  dropped_ += dropped ? 1 : 0;
+  late_sum_ += std::max(late, 0.0);
+  fill_sum_ += queue_fill;
+  if (now_us - window_start_us_ < kWindowUs) {
+    return false;
+  }
+
+  double drop_ratio = static_cast<double>(dropped_) / frames_;
+  double mean_late = late_sum_ / frames_;
+  double mean_fill = fill_sum_ / frames_;
+  bool clean =
+      dropped_ == 0 && mean_late < kCleanLate && mean_fill >= kStarvedFill;
+  StartWindow(now_us);
+
+  bool behind =
+      drop_ratio >= kDropRatioThreshold || mean_late >= kLateThreshold;
+  clean_windows_ = clean ? clean_windows_ + 1 : 0;
+  if (now_us - last_change_us_ < kMinChangeIntervalUs) {
+    return false;
+  }
+
+  if (behind && mean_fill < kStarvedFill && level_ < max_level()) {
+    ++level_;
+    reason_ = fmt::format(
+        "falling behind: {:.0f}% dropped, mean late {:.0f}ms, queue {:.0f}%",
+        drop_ratio * 100, mean_late * 1000, mean_fill * 100);
+  } else if (clean_windows_ >= kCleanWindowsToRecover && level_ > 0) {
+    --level_;
+    reason_ = fmt::format(
+        "load dropped: no drops for {} s, mean late {:.0f}ms, queue {:.0f}%",
+        clean_windows_, mean_late * 1000, mean_fill * 100);
+  } else {
+    return false;
+  }
+  last_change_us_ = now_us;
+  clean_windows_ = 0;
+  return true;
+}
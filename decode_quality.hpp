@@ -0,0 +1,65 @@
+//
+//  decode_quality.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/28.
+//
+
+#ifndef decode_quality_hpp
+#define decode_quality_hpp
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include <cstdint>
+#include <string>
+
+// 一档解码质量对应的 AVCodecContext 设置
+struct DecodeQualitySettings {
+  const char* name;
+  AVDiscard skip_frame;
+  AVDiscard skip_loop_filter;
+  AVDiscard skip_idct;
+};
+
+// 解码跟不上时逐档降低解码质量，负载下来再逐档恢复：
+//   0 完整解码
+//   1 不解非参考帧
+//   2 再跳过环路滤波和非参考帧的 IDCT
+// 这几项解码器打开后随时能改。lowres 只能在打开解码器之前设置，
+// 中途切换要重开解码器，所以不在档位里
+// 每显示或丢掉一帧喂一次，按 1 秒的窗口统计丢帧率、平均迟到和帧队列
+// 的填充率。丢帧或迟到明显、队列又快空了（瓶颈在解码）就降一档；连续
+// 几个窗口都干净且队列有余量就升一档。两次调整之间至少隔一段时间，
+// 免得在两档之间来回抖。不是线程安全的，只在送显任务里用
+class DecodeQualityController {
+ public:
+  static const DecodeQualitySettings& Settings(int level);
+
+  // 新文件开始：回到完整解码
+  void Reset(int64_t now_us);
+  // late 是这一帧比主时钟晚了多少秒，queue_fill 是帧队列占上限的比例。
+  // 档位变了返回 true，新档位和原因从 level()/reason() 取
+  bool OnFrame(int64_t now_us, double late, bool dropped, double queue_fill);
+
+  int level() const { return level_; }
+  int max_level() const;
+  const std::string& reason() const { return reason_; }
+
+ private:
+  void StartWindow(int64_t now_us);
+
+  int level_ = 0;
+  std::string reason_;
+  int64_t last_change_us_ = 0;
+  int clean_windows_ = 0;  // 连续干净的窗口数
+
+  int64_t window_start_us_ = 0;
+  int frames_ = 0;
+  int dropped_ = 0;
+  double late_sum_ = 0;
+  double fill_sum_ = 0;
+};
+
+#endif /* decode_quality_hpp */
@@ -0,0 +1,356 @@
+//
+//  frame_converter.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/12.
+//
+
+#include "frame_converter.hpp"
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+// 每条带至少这么多行，1080p 切 4 条、4K 切 8 条、8K 切 16 条
+static const int kMinBandRows = 256;
+static const int kMaxBands = 16;
+
+FrameConverter::FrameConverter(YuvKernel kernel, TaskScheduler* scheduler)
+    : kernel_(kernel), scheduler_(scheduler) {}
+
+FrameConverter::~FrameConverter() { FreeBands(); }
+
+void FrameConverter::set_max_bands(int bands) {
+  max_bands_ = std::max(bands, 0);
+  width_ = 0;  // 下一帧重新配置
+}
+
+void FrameConverter::SetTargetSize(int width, int height) {
+  if (width <= 0 || height <= 0) {
+    target_size_ = 0;
+    return;
+  }
+  target_size_ = (static_cast<uint64_t>(width) << 32) |
+                 static_cast<uint32_t>(height);
+}
+
+QSize FrameConverter::OutputSize(QSize source) const {
+  uint64_t target = target_size_;
+  if (target == 0) {
+    return source;
+  }
+  QSize box(static_cast<int>(target >> 32),
+            static_cast<int>(target & 0xffffffff));
+  // 和界面上 QSize::scaled 的取整保持一致，绘制时才能 1:1 贴图
+  return source.scaled(box, Qt::KeepAspectRatio);
+}
+
+bool FrameConverter::Reconfigure(const AVFrame* frame,
+                                 const QSize& output_size) {
+  output_size_ = output_size;
+  width_ = frame->width;
+  height_ = frame->height;
+  format_ = frame->format;
+  colorspace_ = frame->colorspace;
+  color_range_ = frame->color_range;
+  path_ = Path::kNone;
+
+  bool full_range = color_range_ == AVCOL_RANGE_JPEG;
+  switch (format_) {
+    case AV_PIX_FMT_YUVJ420P:
+      full_range = true;
+      // fall through
+    case AV_PIX_FMT_YUV420P:
+      path_ = Path::kPlanar;
+      chroma_shift_y_ = 1;
+      break;
+    case AV_PIX_FMT_YUVJ422P:
+      full_range = true;
+      // fall through
+    case AV_PIX_FMT_YUV422P:
+      path_ = Path::kPlanar;
+      chroma_shift_y_ = 0;
+      break;
+    case AV_PIX_FMT_NV12:
+      path_ = Path::kNv12;
+      chroma_shift_y_ = 1;
+      break;
+    case AV_PIX_FMT_YUV420P10LE:
+      path_ = Path::kPlanar10;
+      chroma_shift_y_ = 1;
+      break;
+    default:
+      path_ = Path::kSws;
+      break;
+  }
+  // 需要缩放时交给 swscale，缩放和转换一次完成
+  if (output_size_ != QSize(width_, height_)) {
+    path_ = Path::kSws;
+  }
+
+  if (path_ != Path::kSws) {
+    row_func_ = GetYuvToRgb32Row(kernel_);
+    if (!row_func_) {
+      spdlog::warn("yuv kernel {} unsupported on this cpu, using scalar",
+                   YuvKernelName(kernel_));
+      kernel_ = YuvKernel::kScalar;
+      row_func_ = YuvToRgb32Row_C;
+    }
+    // 没有标注色彩空间时按分辨率猜：标清 BT.601，高清 BT.709
+    bool bt709 = colorspace_ == AVCOL_SPC_BT709 ||
+                 (colorspace_ == AVCOL_SPC_UNSPECIFIED && height_ > 576);
+    params_ = MakeYuvToRgbParams(bt709, full_range);
+  }
+  if (!ConfigureBands(
+          BandCount(std::max(height_, output_size_.height())))) {
+    path_ = Path::kNone;
+    return false;
+  }
+
+  spdlog::debug("converter: {}x{} {} -> {}x{} rgb32 via {}, {} bands", width_,
+                height_,
+                av_get_pix_fmt_name(static_cast<AVPixelFormat>(format_)),
+                output_size_.width(), output_size_.height(),
+                path_ == Path::kSws ? "swscale"
+                                    : YuvKernelName(ResolveYuvKernel(kernel_)),
+                bands_.size());
+  return true;
+}
+
+int FrameConverter::BandCount(int rows) const {
+  if (!scheduler_ || max_bands_ == 1) {
+    return 1;
+  }
+  int count = std::min({rows / kMinBandRows, scheduler_->threads(), kMaxBands});
+  if (max_bands_ > 0) {
+    count = std::min(count, max_bands_);
+  }
+  return std::max(count, 1);
+}
+
+bool FrameConverter::ConfigureBands(int count) {
+  int output_height = output_size_.height();
+  // 条带边界对齐到色度行，每条带的色度平面才能从整行开始
+  int align = 2;
+  if (path_ == Path::kSws) {
+    const AVPixFmtDescriptor* desc =
+        av_pix_fmt_desc_get(static_cast<AVPixelFormat>(format_));
+    if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_PAL |
+                                 AV_PIX_FMT_FLAG_BITSTREAM |
+                                 AV_PIX_FMT_FLAG_HWACCEL))) {
+      count = 1;  // 调色板、按位打包的格式不能按行偏移 data
+    } else {
+      align = std::max(align, 1 << desc->log2_chroma_h);
+    }
+  }
+  count = std::min(count, std::min(height_, output_height) / align);
+  count = std::max(count, 1);
+
+  for (size_t i = count; i < bands_.size(); ++i) {
+    if (bands_[i].sws_ctx) {
+      sws_freeContext(bands_[i].sws_ctx);
+    }
+  }
+  bands_.resize(count);
+
+  int chroma_width = (width_ + 1) / 2;
+  for (int i = 0; i < count; ++i) {
+    Band& band = bands_[i];
+    band.src_begin = static_cast<int>(static_cast<int64_t>(height_) * i /
+                                      count / align * align);
+    band.src_end = i + 1 == count
+                       ? height_
+                       : static_cast<int>(static_cast<int64_t>(height_) *
+                                          (i + 1) / count / align * align);
+    // 输出行按比例取整到最近的一行，相邻条带首尾相接
+    band.dst_begin = static_cast<int>(
+        (static_cast<int64_t>(band.src_begin) * output_height + height_ / 2) /
+        height_);
+    band.dst_end = i + 1 == count
+                       ? output_height
+                       : static_cast<int>((static_cast<int64_t>(band.src_end) *
+                                               output_height +
+                                           height_ / 2) /
+                                          height_);
+
+    if (path_ == Path::kSws) {
+      // 每条带单独缩放，垂直滤波在条带边缘按边缘行延伸，双线性下看不出接缝
+      band.sws_ctx = sws_getCachedContext(
+          band.sws_ctx, width_, band.src_end - band.src_begin,
+          static_cast<AVPixelFormat>(format_), output_size_.width(),
+          band.dst_end - band.dst_begin, AV_PIX_FMT_RGB32, SWS_BILINEAR,
+          nullptr, nullptr, nullptr);
+      if (!band.sws_ctx) {
+        return false;
+      }
+    } else {
+      if (band.sws_ctx) {
+        sws_freeContext(band.sws_ctx);
+        band.sws_ctx = nullptr;
+      }
+      band.scratch.resize(width_ + chroma_width * 2 + 64);
+    }
+  }
+  return true;
+}
+
+void FrameConverter::FreeBands() {
+  for (Band& band : bands_) {
+    if (band.sws_ctx) {
+      sws_freeContext(band.sws_ctx);
+    }
+  }
+  bands_.clear();
+}
+
+void FrameConverter::ConvertBand(const AVFrame* frame, Band* band,
+                                 uint8_t* dst, int dst_stride) {
+  if (path_ != Path::kSws) {
+    ConvertRows(frame, dst, dst_stride, band->src_begin, band->src_end,
+                band->scratch.data());
+    return;
+  }
+
+  const AVPixFmtDescriptor* desc =
+      av_pix_fmt_desc_get(static_cast<AVPixelFormat>(format_));
+  const uint8_t* src[4] = {nullptr, nullptr, nullptr, nullptr};
+  for (int plane = 0; plane < 4; ++plane) {
+    if (!frame->data[plane]) {
+      continue;
+    }
+    // YUV 的 1、2 平面是色度，按垂直采样比例换算起始行
+    bool chroma = (plane == 1 || plane == 2) && desc &&
+                  !(desc->flags & AV_PIX_FMT_FLAG_RGB);
+    int row = chroma ? band->src_begin >> desc->log2_chroma_h
+                     : band->src_begin;
+    src[plane] = frame->data[plane] +
+                 static_cast<int64_t>(row) * frame->linesize[plane];
+  }
+  uint8_t* dest[4] = {dst + static_cast<int64_t>(band->dst_begin) * dst_stride,
+                      nullptr, nullptr, nullptr};
+  int dest_linesize[4] = {dst_stride, 0, 0, 0};
+  sws_scale(band->sws_ctx, src, frame->linesize, 0,
+            band->src_end - band->src_begin, dest, dest_linesize);
+}
+
+void FrameConverter::RunBands(int count,
+                              const std::function<void(int)>& fn) {
+  if (count <= 1 || !scheduler_) {
+    for (int i = 0; i < count; ++i) {
+      fn(i);
+    }
+    return;
+  }
+
+  // 晚到的任务可能在 RunBands 返回之后才开始跑，状态放在 shared_ptr 里，
+  // 它们领不到条带就直接退出，不会再碰 fn
+  struct Job {
+    const std::function<void(int)>* fn;
+    int count;
+    std::atomic<int> next{0};
+    std::atomic<int> done{0};
+    std::mutex mutex;
+    std::condition_variable done_cv;
+  };
+  auto job = std::make_shared<Job>();
+  job->fn = &fn;
+  job->count = count;
+  auto work = [job] {
+    int band;
+    while ((band = job->next.fetch_add(1)) < job->count) {
+      (*job->fn)(band);
+      if (job->done.fetch_add(1) + 1 == job->count) {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->done_cv.notify_all();
+      }
+    }
+  };
+  for (int i = 1; i < count; ++i) {
+    scheduler_->Submit(work, TaskPriority::kDeadline);
+  }
+  // 调用线程也领条带：工作线程都忙时自己全转完，不会干等
+  work();
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->done_cv.wait(lock, [&] { return job->done == job->count; });
+}
+
+void FrameConverter::ConvertRows(const AVFrame* frame, uint8_t* dst,
+                                 int dst_stride, int row_begin, int row_end,
+                                 uint8_t* scratch) {
+  int chroma_width = (width_ + 1) / 2;
+  uint8_t* y_row = scratch;
+  uint8_t* u_row = y_row + width_;
+  uint8_t* v_row = u_row + chroma_width;
+  int last_chroma_row = -1;
+
+  for (int row = row_begin; row < row_end; ++row) {
+    int chroma_row = row >> chroma_shift_y_;
+    const uint8_t* y = frame->data[0] + row * frame->linesize[0];
+    const uint8_t* u = frame->data[1] + chroma_row * frame->linesize[1];
+    const uint8_t* v = frame->data[2] + chroma_row * frame->linesize[2];
+
+    if (path_ == Path::kNv12) {
+      if (chroma_row != last_chroma_row) {
+        SplitUvRow(u, u_row, v_row, chroma_width);
+        last_chroma_row = chroma_row;
+      }
+      u = u_row;
+      v = v_row;
+    } else if (path_ == Path::kPlanar10) {
+      Shift10To8Row(reinterpret_cast<const uint16_t*>(y), y_row, width_);
+      if (chroma_row != last_chroma_row) {
+        Shift10To8Row(reinterpret_cast<const uint16_t*>(u), u_row,
+                      chroma_width);
+        Shift10To8Row(reinterpret_cast<const uint16_t*>(v), v_row,
+                      chroma_width);
+        last_chroma_row = chroma_row;
+      }
+      y = y_row;
+      u = u_row;
+      v = v_row;
+    }
+
+    row_func_(y, u, v, dst + row * dst_stride, width_, params_);
+  }
+}
+
+QImage FrameConverter::Convert(const AVFrame* frame) {
+  if (frame->width <= 0 || frame->height <= 0) {
+    return QImage();
+  }
+  QSize output_size = OutputSize(QSize(frame->width, frame->height));
+  if (output_size.isEmpty()) {
+    return QImage();
+  }
+  if (frame->width != width_ || frame->height != height_ ||
+      frame->format != format_ || frame->colorspace != colorspace_ ||
+      frame->color_range != color_range_ || output_size != output_size_) {
+    if (!Reconfigure(frame, output_size)) {
+      return QImage();
+    }
+  }
+  if (path_ == Path::kNone) {
+    return QImage();
+  }
+
+  QImage image =
+      image_pool_.Acquire(output_size_.width(), output_size_.height());
+  if (image.isNull()) {
+    return image;
+  }
+  // constBits 不会触发 detach；buffer 是刚从池里拿出的，只有这一个引用
+  uint8_t* dst = const_cast<uint8_t*>(image.constBits());
+  int dst_stride = image.bytesPerLine();
+
+  RunBands(static_cast<int>(bands_.size()), [&](int band) {
+    ConvertBand(frame, &bands_[band], dst, dst_stride);
+  });
+  return image;
+}
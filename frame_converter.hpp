@@ -0,0 +1,115 @@
+//
+//  frame_converter.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/12.
+//
+
+#ifndef frame_converter_hpp
+#define frame_converter_hpp
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+#include <QImage>
+#include <QSize>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "image_pool.hpp"
+#include "task_scheduler.hpp"
+#include "yuv_to_rgb.hpp"
+
+struct SwsContext;
+
+// 把解码出的 YUV 帧转换为可直接绘制的 RGB32 QImage。
+// YUV420P/YUVJ420P、YUV422P/YUVJ422P、NV12 和 10bit 4:2:0 走 yuv_to_rgb
+// 里的向量化行转换；其他格式退回 sws_scale。输出图像来自 ImagePool。
+// 帧的尺寸、格式或色彩空间变化时自动重建转换参数。
+// 设置了目标尺寸后，输出按比例适配到目标尺寸内，缩放和颜色转换由
+// sws_scale 一次完成，界面线程绘制时不用再缩放。
+// 给了 scheduler 时，4K、8K 这样的大帧切成水平条带并行转换：每条带有
+// 自己的 SwsContext 和行缓存，写进同一张输出图像的不同行。条带数随
+// 帧高和工作线程数增长，调用线程自己也领条带，只等别人手上正在转的。
+class FrameConverter {
+ public:
+  explicit FrameConverter(YuvKernel kernel = YuvKernel::kAuto,
+                          TaskScheduler* scheduler = nullptr);
+  ~FrameConverter();
+
+  FrameConverter(const FrameConverter&) = delete;
+  FrameConverter& operator=(const FrameConverter&) = delete;
+
+  // 失败返回空 QImage
+  QImage Convert(const AVFrame* frame);
+
+  // 输出适配的显示区域（像素），任一边为 0 表示按原尺寸输出。
+  // 可以在任意线程调用，下一帧生效
+  void SetTargetSize(int width, int height);
+  // 按当前目标尺寸，source 大小的帧会输出成多大
+  QSize OutputSize(QSize source) const;
+
+  // 实际使用的行转换实现
+  YuvKernel kernel() const { return ResolveYuvKernel(kernel_); }
+
+  // 条带数上限，0 表示按帧高和线程数自动决定，1 表示不切。
+  // 在 Convert 的线程调用，下一帧生效
+  void set_max_bands(int bands);
+  // 当前配置实际用的条带数
+  int bands() const { return static_cast<int>(bands_.size()); }
+
+ private:
+  enum class Path { kNone, kPlanar, kNv12, kPlanar10, kSws };
+
+  // 一条水平条带：源帧的 [src_begin, src_end) 行转换成输出的
+  // [dst_begin, dst_end) 行
+  struct Band {
+    int src_begin = 0;
+    int src_end = 0;
+    int dst_begin = 0;
+    int dst_end = 0;
+    SwsContext* sws_ctx = nullptr;
+    // NV12 拆分/10bit 截位用的行缓存
+    std::vector<uint8_t> scratch;
+  };
+
+  bool Reconfigure(const AVFrame* frame, const QSize& output_size);
+  // 按帧高、线程数和 max_bands_ 决定切几条
+  int BandCount(int rows) const;
+  bool ConfigureBands(int count);
+  void FreeBands();
+  void ConvertBand(const AVFrame* frame, Band* band, uint8_t* dst,
+                   int dst_stride);
+  void ConvertRows(const AVFrame* frame, uint8_t* dst, int dst_stride,
+                   int row_begin, int row_end, uint8_t* scratch);
+  // 执行 fn(0) .. fn(count - 1)，count > 1 时分给 scheduler_ 并行跑，
+  // 全部完成后返回
+  void RunBands(int count, const std::function<void(int)>& fn);
+
+  YuvKernel kernel_;
+  YuvToRgb32RowFunc row_func_ = nullptr;
+  YuvToRgbParams params_{};
+
+  // 当前配置对应的帧参数
+  int width_ = 0;
+  int height_ = 0;
+  int format_ = AV_PIX_FMT_NONE;
+  int colorspace_ = AVCOL_SPC_UNSPECIFIED;
+  int color_range_ = AVCOL_RANGE_UNSPECIFIED;
+  QSize output_size_;
+  Path path_ = Path::kNone;
+  int chroma_shift_y_ = 1;
+
+  TaskScheduler* scheduler_;
+  int max_bands_ = 0;
+  std::vector<Band> bands_;
+  ImagePool image_pool_;
+  // 高 32 位宽，低 32 位高
+  std::atomic<uint64_t> target_size_{0};
+};
+
+#endif /* frame_converter_hpp */
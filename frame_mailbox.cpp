@@ -0,0 +1,39 @@
+//
+//  frame_mailbox.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/28.
+//
+
+#include "frame_mailbox.hpp"
+
+#include <utility>
+
+bool FrameMailbox::Publish(QImage image, int64_t published_us) {
+  Slot& slot = slots_[back_];
+  slot.image = std::move(image);
+  slot.published_us = published_us;
+  // release：消费者换到这个槽时能看到上面写的内容；
+  // acquire：换回来的槽消费者已经用完
+  int previous = middle_.exchange(back_ | kFresh, std::memory_order_acq_rel);
+  back_ = previous & kIndexMask;
+  published_.fetch_add(1, std::memory_order_relaxed);
+  if (previous & kFresh) {
+    superseded_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+bool FrameMailbox::Take(QImage* image, int64_t* published_us) {
+  if (!(middle_.load(std::memory_order_relaxed) & kFresh)) {
+    return false;
+  }
+  int previous = middle_.exchange(front_, std::memory_order_acq_rel);
+  front_ = previous & kIndexMask;
+  Slot& slot = slots_[front_];
+  // 移走而不是拷贝：槽里不留引用，被顶掉的帧在生产者覆盖时就回到 ImagePool
+  *image = std::move(slot.image);
+  *published_us = slot.published_us;
+  return true;
+}
@@ -0,0 +1,58 @@
+//
+//  frame_mailbox.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/28.
+//
+
+#ifndef frame_mailbox_hpp
+#define frame_mailbox_hpp
+
+#include <QImage>
+#include <atomic>
+#include <cstdint>
+
+// 送显任务和界面线程之间的三缓冲信箱，只保留最新一帧。
+// 单生产者单消费者：送显任务 Publish，界面线程 Take。两边各占一个槽，
+// 中间槽用一次原子交换易手，不加锁也不拷贝像素。界面线程来不及取时，
+// 新帧直接顶掉中间槽里的旧帧并计数，不会在事件队列里积压。
+class FrameMailbox {
+ public:
+  FrameMailbox() = default;
+
+  FrameMailbox(const FrameMailbox&) = delete;
+  FrameMailbox& operator=(const FrameMailbox&) = delete;
+
+  // 放入最新一帧，published_us 是放入时的 av_gettime_relative()。
+  // 返回 true 表示信箱之前是空的，需要唤醒界面线程；返回 false 时
+  // 上一次的唤醒还没被处理，不用再发
+  bool Publish(QImage image, int64_t published_us);
+  // 取走最新一帧，没有新帧返回 false
+  bool Take(QImage* image, int64_t* published_us);
+
+  // 累计放入的帧数和没被取走就被顶掉的帧数
+  uint64_t published() const {
+    return published_.load(std::memory_order_relaxed);
+  }
+  uint64_t superseded() const {
+    return superseded_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static constexpr int kIndexMask = 0x3;
+  static constexpr int kFresh = 0x4;  // 中间槽里是还没取走的新帧
+
+  struct Slot {
+    QImage image;
+    int64_t published_us = 0;
+  };
+
+  Slot slots_[3];
+  int back_ = 0;   // 只有生产者访问
+  int front_ = 1;  // 只有消费者访问
+  std::atomic<int> middle_{2};
+  std::atomic<uint64_t> published_{0};
+  std::atomic<uint64_t> superseded_{0};
+};
+
+#endif /* frame_mailbox_hpp */
@@ -0,0 +1,114 @@
+//
+//  frame_pool.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/08.
+//
+
+#include "frame_pool.hpp"
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+uint64_t FrameDataSize(const AVFrame* frame) {
+  uint64_t size = 0;
+  for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; ++i) {
+    size += frame->buf[i]->size;
+  }
+  for (int i = 0; i < frame->nb_extended_buf; ++i) {
+    size += frame->extended_buf[i]->size;
+  }
+  return size;
+}
+
+FramePool::FramePool(size_t max_cached) : state_(std::make_shared<State>()) {
+  state_->max_cached = max_cached;
+}
+
+FramePool::~FramePool() {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  for (AVFrame* frame : state_->free_frames) {
+    av_frame_free(&frame);
+  }
+  state_->free_frames.clear();
+  state_->max_cached = 0;  // 还在外面流转的帧回来时直接释放
+}
+
+void FramePool::Recycle(const std::shared_ptr<State>& state, AVFrame* frame) {
+  if (!frame) {
+    return;
+  }
+  av_frame_unref(frame);
+
+  std::lock_guard<std::mutex> lock(state->mutex);
+  if (state->free_frames.size() < state->max_cached) {
+    state->free_frames.push_back(frame);
+    return;
+  }
+  av_frame_free(&frame);
+}
+
+AVFramePtr FramePool::Acquire() {
+  AVFrame* frame = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    if (!state_->free_frames.empty()) {
+      frame = state_->free_frames.back();
+      state_->free_frames.pop_back();
+    }
+  }
+  if (!frame) {
+    frame = av_frame_alloc();
+    if (!frame) {
+      return nullptr;
+    }
+  }
+
+  std::shared_ptr<State> state = state_;
+  return AVFramePtr(frame, [state](AVFrame* f) { Recycle(state, f); });
+}
+
+AVFramePtr FramePool::MoveRef(AVFrame* src, uint64_t* copied_bytes) {
+  AVFramePtr frame = Acquire();
+  if (!frame) {
+    return nullptr;
+  }
+
+  if (src->buf[0]) {
+    av_frame_move_ref(frame.get(), src);
+    return frame;
+  }
+
+  // 非引用计数的帧，av_frame_ref 会分配新 buffer 并拷贝
+  if (av_frame_ref(frame.get(), src) < 0) {
+    return nullptr;
+  }
+  if (copied_bytes) {
+    *copied_bytes += FrameDataSize(frame.get());
+  }
+  av_frame_unref(src);
+  return frame;
+}
+
+void RateMeter::Add(uint64_t count) {
+  pending_.fetch_add(count, std::memory_order_relaxed);
+}
+
+uint64_t RateMeter::PerSecond() {
+  int64_t now_us = av_gettime_relative();
+  int64_t start_us = window_start_us_.load(std::memory_order_relaxed);
+  if (start_us == 0) {
+    window_start_us_.compare_exchange_strong(start_us, now_us);
+    return 0;
+  }
+
+  int64_t elapsed_us = now_us - start_us;
+  if (elapsed_us >= 1000000 &&
+      window_start_us_.compare_exchange_strong(start_us, now_us)) {
+    uint64_t count = pending_.exchange(0, std::memory_order_relaxed);
+    last_per_second_.store(count * 1000000 / elapsed_us,
+                           std::memory_order_relaxed);
+  }
+  return last_per_second_.load(std::memory_order_relaxed);
+}
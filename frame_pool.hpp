@@ -0,0 +1,90 @@
+//
+//  frame_pool.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/08.
+//
+
+#ifndef frame_pool_hpp
+#define frame_pool_hpp
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct AVFrameDeleter {
+  void operator()(AVFrame* frame) const {
+    if (frame) {
+      av_frame_free(&frame);
+    }
+  }
+};
+
+using AVFramePtr = std::shared_ptr<AVFrame>;
+
+inline AVFramePtr createAVFramePtr() {
+    return AVFramePtr(av_frame_alloc(), AVFrameDeleter());
+}
+
+// 帧引用的所有 buffer 的总字节数
+uint64_t FrameDataSize(const AVFrame* frame);
+
+// 复用 AVFrame 外壳。解码器输出的 buffer 本身是引用计数的（来自 libavcodec
+// 内部的 AVBufferPool），这里只负责把 AVFrame 结构体回收，避免每帧 malloc。
+class FramePool {
+ public:
+  explicit FramePool(size_t max_cached = 64);
+  ~FramePool();
+
+  FramePool(const FramePool&) = delete;
+  FramePool& operator=(const FramePool&) = delete;
+
+  // 返回一个空的 AVFrame，释放时自动 av_frame_unref 并放回池中
+  AVFramePtr Acquire();
+
+  // 把 src 中的数据引用转移到池中取出的新帧，src 被重置。
+  // 若 src 不是引用计数的 buffer，会退化为一次拷贝，并计入 copied_bytes
+  AVFramePtr MoveRef(AVFrame* src, uint64_t* copied_bytes);
+
+ private:
+  struct State {
+    std::mutex mutex;
+    std::vector<AVFrame*> free_frames;
+    size_t max_cached;
+  };
+
+  static void Recycle(const std::shared_ptr<State>& state, AVFrame* frame);
+
+  std::shared_ptr<State> state_;
+};
+
+// 按秒结算的计数器，可以多线程 Add
+class RateMeter {
+ public:
+  void Add(uint64_t count);
+  // 每隔一秒结算一次，返回上一个完整秒内的计数
+  uint64_t PerSecond();
+
+ private:
+  std::atomic<uint64_t> pending_{0};
+  std::atomic<uint64_t> last_per_second_{0};
+  std::atomic<int64_t> window_start_us_{0};
+};
+
+// 统计每秒拷贝的帧数据字节数，正常情况下应该一直是 0
+class FrameCopyMeter {
+ public:
+  void Add(uint64_t bytes) { meter_.Add(bytes); }
+  uint64_t BytesPerSecond() { return meter_.PerSecond(); }
+
+ private:
+  RateMeter meter_;
+};
+
+#endif /* frame_pool_hpp */
@@ -0,0 +1,180 @@
+//
+//  gop_cache.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/23.
+//
+
+#include "gop_cache.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+
+static bool PtsLess(const AVFramePtr& frame, int64_t pts) {
+  return frame->pts < pts;
+}
+
+static bool LessPts(int64_t pts, const AVFramePtr& frame) {
+  return pts < frame->pts;
+}
+
+GopCache::GopCache(uint64_t budget_bytes) { stats_.budget = budget_bytes; }
+
+void GopCache::SetBudget(uint64_t budget_bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.budget = budget_bytes;
+  EvictLocked(INT64_MIN);
+}
+
+void GopCache::Insert(int64_t start, int64_t end,
+                      std::vector<AVFramePtr> frames) {
+  if (frames.empty()) {
+    return;
+  }
+  uint64_t bytes = 0;
+  for (const auto& frame : frames) {
+    bytes += FrameDataSize(frame.get());
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto old = gops_.find(start);
+  if (old != gops_.end()) {
+    EraseLocked(old);
+  }
+  lru_.push_front(start);
+  gops_[start] = {end, bytes, std::move(frames), lru_.begin()};
+  stats_.bytes += bytes;
+  stats_.gops = gops_.size();
+  if (bytes > stats_.budget) {
+    spdlog::warn("gop cache: one GOP ({} bytes) exceeds the budget ({} bytes)",
+                 bytes, stats_.budget);
+  }
+  EvictLocked(start);
+}
+
+bool GopCache::Contains(int64_t pts) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return FindLocked(pts) != gops_.end();
+}
+
+void GopCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  gops_.clear();
+  lru_.clear();
+  uint64_t budget = stats_.budget;
+  stats_ = Stats();
+  stats_.budget = budget;
+}
+
+GopCache::Lookup GopCache::FrameAt(int64_t pts, AVFramePtr* frame,
+                                   int64_t* gop_start) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = FindLocked(pts);
+  if (it == gops_.end()) {
+    return Miss(pts, gop_start);
+  }
+  const auto& frames = it->second.frames;
+  auto next = std::upper_bound(frames.begin(), frames.end(), pts, LessPts);
+  if (next == frames.begin()) {
+    return Miss(pts, gop_start);
+  }
+  return Hit(it, *(next - 1), frame, gop_start);
+}
+
+GopCache::Lookup GopCache::FrameBefore(int64_t pts, AVFramePtr* frame,
+                                       int64_t* gop_start) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // 前一帧一定落在包含 pts - 1 的那个 GOP 里
+  auto it = FindLocked(pts - 1);
+  if (it == gops_.end()) {
+    return Miss(pts - 1, gop_start);
+  }
+  const auto& frames = it->second.frames;
+  auto next = std::lower_bound(frames.begin(), frames.end(), pts, PtsLess);
+  if (next == frames.begin()) {
+    return Miss(pts - 1, gop_start);
+  }
+  return Hit(it, *(next - 1), frame, gop_start);
+}
+
+GopCache::Lookup GopCache::FrameAfter(int64_t pts, AVFramePtr* frame,
+                                      int64_t* gop_start) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = FindLocked(pts);
+  if (it == gops_.end()) {
+    return Miss(pts, gop_start);
+  }
+  const auto& frames = it->second.frames;
+  auto next = std::upper_bound(frames.begin(), frames.end(), pts, LessPts);
+  if (next != frames.end()) {
+    return Hit(it, *next, frame, gop_start);
+  }
+
+  // 已经是这个 GOP 的最后一帧，下一帧是下一个 GOP 的关键帧
+  int64_t end = it->second.end;
+  if (end == INT64_MAX) {
+    return Lookup::kEnd;
+  }
+  auto next_gop = FindLocked(end);
+  if (next_gop == gops_.end()) {
+    return Miss(end, gop_start);
+  }
+  return Hit(next_gop, next_gop->second.frames.front(), frame, gop_start);
+}
+
+GopCache::Stats GopCache::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+GopCache::GopMap::iterator GopCache::FindLocked(int64_t pts) {
+  auto it = gops_.upper_bound(pts);
+  if (it == gops_.begin()) {
+    return gops_.end();
+  }
+  --it;
+  return pts < it->second.end ? it : gops_.end();
+}
+
+void GopCache::TouchLocked(GopMap::iterator it) {
+  lru_.splice(lru_.begin(), lru_, it->second.lru);
+}
+
+void GopCache::EraseLocked(GopMap::iterator it) {
+  stats_.bytes -= it->second.bytes;
+  lru_.erase(it->second.lru);
+  gops_.erase(it);
+  stats_.gops = gops_.size();
+}
+
+void GopCache::EvictLocked(int64_t keep) {
+  while (stats_.bytes > stats_.budget && !lru_.empty()) {
+    int64_t victim = lru_.back();
+    if (victim == keep) {
+      // 只剩刚放进来的这个，超预算也先留着
+      if (lru_.size() == 1) {
+        break;
+      }
+      TouchLocked(gops_.find(victim));
+      continue;
+    }
+    EraseLocked(gops_.find(victim));
+    ++stats_.evictions;
+  }
+}
+
+GopCache::Lookup GopCache::Hit(GopMap::iterator it, const AVFramePtr& found,
+                               AVFramePtr* frame, int64_t* gop_start) {
+  TouchLocked(it);
+  ++stats_.hits;
+  *frame = found;
+  *gop_start = it->first;
+  return Lookup::kHit;
+}
+
+GopCache::Lookup GopCache::Miss(int64_t pts, int64_t* gop_start) {
+  ++stats_.misses;
+  *gop_start = pts;
+  return Lookup::kMiss;
+}
@@ -0,0 +1,86 @@
+//
+//  gop_cache.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/23.
+//
+
+#ifndef gop_cache_hpp
+#define gop_cache_hpp
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "frame_pool.hpp"
+
+// 解码后视频帧的缓存，以 GOP 为单位存取和淘汰。时间单位是视频流的 time_base。
+// 每个 GOP 覆盖 [start, end)，start 是关键帧的 pts，end 是下一个关键帧的 pts，
+// 只放完整解出来的 GOP，所以 GOP 内相邻帧之间不会有空洞。
+// 总字节数超过预算时按 LRU 淘汰整个 GOP。线程安全。
+class GopCache {
+ public:
+  enum class Lookup {
+    kHit,
+    kMiss,  // 需要的 GOP 不在缓存里
+    kEnd,   // 已经是第一帧/最后一帧
+  };
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t bytes = 0;
+    uint64_t budget = 0;
+    size_t gops = 0;
+  };
+
+  explicit GopCache(uint64_t budget_bytes);
+
+  GopCache(const GopCache&) = delete;
+  GopCache& operator=(const GopCache&) = delete;
+
+  void SetBudget(uint64_t budget_bytes);
+  // frames 按 pts 升序。已有同一 GOP 时替换
+  void Insert(int64_t start, int64_t end, std::vector<AVFramePtr> frames);
+  bool Contains(int64_t pts);
+  void Clear();
+
+  // 以下查询在 kHit 时通过 frame 返回帧、gop_start 返回它所在 GOP 的起点；
+  // kMiss 时 gop_start 返回需要先解出来的那个 GOP 里的任意一个时间点。
+  // 显示时间不晚于 pts 的最后一帧
+  Lookup FrameAt(int64_t pts, AVFramePtr* frame, int64_t* gop_start);
+  // 显示时间早于 pts 的最后一帧
+  Lookup FrameBefore(int64_t pts, AVFramePtr* frame, int64_t* gop_start);
+  // 显示时间晚于 pts 的第一帧
+  Lookup FrameAfter(int64_t pts, AVFramePtr* frame, int64_t* gop_start);
+
+  Stats stats();
+
+ private:
+  struct Gop {
+    int64_t end;
+    uint64_t bytes;
+    std::vector<AVFramePtr> frames;
+    std::list<int64_t>::iterator lru;
+  };
+  using GopMap = std::map<int64_t, Gop>;
+
+  // 以下都要求已持有 mutex_
+  GopMap::iterator FindLocked(int64_t pts);
+  void TouchLocked(GopMap::iterator it);
+  void EraseLocked(GopMap::iterator it);
+  void EvictLocked(int64_t keep);
+  Lookup Hit(GopMap::iterator it, const AVFramePtr& found, AVFramePtr* frame,
+             int64_t* gop_start);
+  Lookup Miss(int64_t pts, int64_t* gop_start);
+
+  std::mutex mutex_;
+  GopMap gops_;
+  std::list<int64_t> lru_;  // 最近用过的在前
+  Stats stats_;
+};
+
+#endif /* gop_cache_hpp */
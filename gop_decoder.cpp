@@ -0,0 +1,275 @@
+//
+//  gop_decoder.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/23.
+//
+
+#include "gop_decoder.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+// 读到下一个关键帧之后最多再送这么多 packet。开放 GOP 里排在它后面、
+// 显示在它前面的 B 帧都在这个窗口内
+static const int kMaxTrailingPackets = 32;
+// 预解请求最多排这么多，快速连续后退时旧的请求已经没意义了
+static const size_t kMaxPrefetchRequests = 2;
+
+static int64_t PacketTimestamp(const AVPacket* packet) {
+  return packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+}
+
+GopDecoder::GopDecoder(GopCache* cache, KeyframeIndex* keyframe_index)
+    : cache_(cache),
+      keyframe_index_(keyframe_index),
+      frame_(createAVFramePtr()) {}
+
+GopDecoder::~GopDecoder() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  request_cv_.notify_all();
+  done_cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  avcodec_free_context(&codec_ctx_);
+  if (format_ctx_) {
+    avformat_close_input(&format_ctx_);
+  }
+}
+
+bool GopDecoder::Open(const std::string& file_path,
+                      const DecoderOptions& options) {
+  if (OpenMediaInput(file_path, options.file_io, options.read_ahead_bytes,
+                     &format_ctx_, &file_io_) != 0) {
+    spdlog::error("gop: avformat_open_input error");
+    return false;
+  }
+  if (avformat_find_stream_info(format_ctx_, NULL) < 0) {
+    spdlog::error("gop: avformat_find_stream_info error");
+    return false;
+  }
+  stream_index_ =
+      av_find_best_stream(format_ctx_, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+  if (stream_index_ < 0) {
+    spdlog::error("gop: no video found");
+    return false;
+  }
+  for (unsigned int i = 0; i < format_ctx_->nb_streams; ++i) {
+    if ((int)i != stream_index_) {
+      format_ctx_->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+
+  codec_ctx_ =
+      OpenCodecContext("gop", format_ctx_->streams[stream_index_], options);
+  if (!codec_ctx_) {
+    return false;
+  }
+  thread_ = std::thread(&GopDecoder::WorkLoop, this);
+  return true;
+}
+
+void GopDecoder::Prefetch(int64_t pts) {
+  if (cache_->Contains(pts)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& request : requests_) {
+    if (request.pts == pts) {
+      return;
+    }
+  }
+  // 快速连续后退时旧的预解请求已经没意义了，只保留最近几个
+  size_t prefetches = std::count_if(requests_.begin(), requests_.end(),
+                                    [](const Request& r) { return !r.urgent; });
+  for (auto it = requests_.begin();
+       it != requests_.end() && prefetches >= kMaxPrefetchRequests;) {
+    if (it->urgent) {
+      ++it;
+      continue;
+    }
+    unfinished_.erase(it->id);
+    it = requests_.erase(it);
+    --prefetches;
+  }
+  uint64_t id = next_id_++;
+  unfinished_.insert(id);
+  requests_.push_back({pts, id, false});
+  request_cv_.notify_one();
+}
+
+bool GopDecoder::DecodeNow(int64_t pts) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (stop_ || !thread_.joinable()) {
+    return false;
+  }
+  uint64_t id = next_id_++;
+  unfinished_.insert(id);
+  requests_.push_front({pts, id, true});
+  request_cv_.notify_one();
+  done_cv_.wait(lock, [this, id] { return stop_ || !unfinished_.count(id); });
+  if (unfinished_.count(id)) {
+    return false;
+  }
+  return failed_.erase(id) == 0;
+}
+
+void GopDecoder::WorkLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    request_cv_.wait(lock, [this] { return stop_ || !requests_.empty(); });
+    if (stop_) {
+      break;
+    }
+    Request request = requests_.front();
+    requests_.pop_front();
+
+    lock.unlock();
+    // 排队期间可能已经被别的请求顺带解出来了
+    bool ok = cache_->Contains(request.pts) || DecodeGop(request.pts);
+    lock.lock();
+
+    unfinished_.erase(request.id);
+    if (!ok && request.urgent) {
+      failed_.insert(request.id);
+    }
+    done_cv_.notify_all();
+  }
+}
+
+bool GopDecoder::DecodeGop(int64_t pts) {
+  int64_t start_us = av_gettime_relative();
+  bool keyframes_only = keyframes_only_;
+  avcodec_flush_buffers(codec_ctx_);
+  codec_ctx_->skip_frame = keyframes_only ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+  // 落到不晚于 pts 的关键帧上
+  if (avformat_seek_file(format_ctx_, stream_index_, INT64_MIN, pts, pts, 0) <
+      0) {
+    spdlog::warn("gop: seek to {} failed", pts);
+    return false;
+  }
+
+  int64_t start = AV_NOPTS_VALUE;
+  int64_t end = INT64_MAX;
+  int trailing_packets = 0;
+  bool complete = false;
+  std::vector<AVFramePtr> frames;
+  AVPacketPtr packet = createAVPacketPtr();
+  while (!complete) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stop_) {
+        return false;
+      }
+    }
+    if (av_read_frame(format_ctx_, packet.get()) < 0) {
+      // 文件末尾：最后一个 GOP 一直延伸到结尾
+      if (start != AV_NOPTS_VALUE) {
+        SendPacket(nullptr, start, end, &frames);
+      }
+      complete = true;
+      break;
+    }
+    if (packet->stream_index != stream_index_) {
+      av_packet_unref(packet.get());
+      continue;
+    }
+
+    int64_t packet_ts = PacketTimestamp(packet.get());
+    if (packet->flags & AV_PKT_FLAG_KEY) {
+      keyframe_index_->Add(packet_ts);
+      if (start == AV_NOPTS_VALUE) {
+        start = packet_ts;
+      } else if (end == INT64_MAX && packet_ts > start) {
+        end = packet_ts;
+      }
+    }
+    if (start == AV_NOPTS_VALUE) {
+      // 关键帧之前的 packet 解不出来
+      av_packet_unref(packet.get());
+      continue;
+    }
+    if (keyframes_only) {
+      // 只要这个关键帧：送进去马上 drain，不用读到下一个关键帧
+      end = start + 1;
+      SendPacket(packet.get(), start, end, &frames);
+      SendPacket(nullptr, start, end, &frames);
+      av_packet_unref(packet.get());
+      complete = true;
+      break;
+    }
+    if (end != INT64_MAX && ++trailing_packets > kMaxTrailingPackets) {
+      SendPacket(nullptr, start, end, &frames);
+      complete = true;
+      break;
+    }
+    complete = SendPacket(packet.get(), start, end, &frames);
+    av_packet_unref(packet.get());
+  }
+  avcodec_flush_buffers(codec_ctx_);
+
+  if (start == AV_NOPTS_VALUE || frames.empty()) {
+    return false;
+  }
+  std::sort(frames.begin(), frames.end(),
+            [](const AVFramePtr& a, const AVFramePtr& b) {
+              return a->pts < b->pts;
+            });
+  size_t count = frames.size();
+  cache_->Insert(start, end, std::move(frames));
+  ++decoded_gops_;
+
+  AVRational time_base = format_ctx_->streams[stream_index_]->time_base;
+  spdlog::debug("gop: decoded [{:.3f}s, {:.3f}s) {} frames in {:.1f}ms",
+                start * av_q2d(time_base),
+                end == INT64_MAX ? -1.0 : end * av_q2d(time_base), count,
+                (av_gettime_relative() - start_us) / 1000.0);
+  return true;
+}
+
+bool GopDecoder::SendPacket(const AVPacket* packet, int64_t start, int64_t end,
+                            std::vector<AVFramePtr>* frames) {
+  bool past_end = false;
+  bool packet_sent = false;
+  while (!packet_sent) {
+    int ret = avcodec_send_packet(codec_ctx_, packet);
+    if (ret == 0 || ret == AVERROR_EOF) {
+      packet_sent = true;
+    } else if (ret != AVERROR(EAGAIN)) {
+      spdlog::warn("gop: avcodec_send_packet error {}", ret);
+      return past_end;
+    }
+
+    while (true) {
+      ret = avcodec_receive_frame(codec_ctx_, frame_.get());
+      if (ret < 0) {
+        break;
+      }
+      int64_t ts = frame_->pts != AV_NOPTS_VALUE
+                       ? frame_->pts
+                       : frame_->best_effort_timestamp;
+      if (ts != AV_NOPTS_VALUE && ts >= end) {
+        past_end = true;
+      }
+      if (ts == AV_NOPTS_VALUE || ts < start || ts >= end) {
+        av_frame_unref(frame_.get());
+        continue;
+      }
+      AVFramePtr frame = createAVFramePtr();
+      av_frame_move_ref(frame.get(), frame_.get());
+      frame->pts = ts;
+      frames->push_back(std::move(frame));
+    }
+  }
+  return past_end;
+}
@@ -0,0 +1,91 @@
+//
+//  gop_decoder.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/23.
+//
+
+#ifndef gop_decoder_hpp
+#define gop_decoder_hpp
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "gop_cache.hpp"
+#include "keyframe_index.hpp"
+#include "local_file_io.hpp"
+#include "stream_decoder.hpp"
+
+// 按 GOP 随机访问解码，结果放进 GopCache。自己打开一份 AVFormatContext
+// 和解码器，跟正常播放的解封装/解码互不干扰。请求在自己的线程里排队处理：
+// Prefetch 是后台预解，DecodeNow 插到队首并等它解完。
+class GopDecoder {
+ public:
+  GopDecoder(GopCache* cache, KeyframeIndex* keyframe_index);
+  ~GopDecoder();
+
+  GopDecoder(const GopDecoder&) = delete;
+  GopDecoder& operator=(const GopDecoder&) = delete;
+
+  bool Open(const std::string& file_path, const DecoderOptions& options);
+
+  // 后台解出包含 pts 的 GOP（视频流 time_base），已经缓存的直接忽略
+  void Prefetch(int64_t pts);
+  // 解出包含 pts 的 GOP 才返回，失败返回 false
+  bool DecodeNow(int64_t pts);
+
+  uint64_t decoded_gops() const { return decoded_gops_; }
+  // 快速倒放：之后解的 GOP 只解关键帧，缓存里记成只有 [关键帧, 关键帧 + 1)，
+  // 不会被当成完整的 GOP 用于逐帧
+  void SetKeyframesOnly(bool keyframes_only) {
+    keyframes_only_ = keyframes_only;
+  }
+
+ private:
+  struct Request {
+    int64_t pts;
+    uint64_t id;
+    bool urgent;  // DecodeNow 在等它
+  };
+
+  void WorkLoop();
+  bool DecodeGop(int64_t pts);
+  // 送一个 packet（nullptr 为 drain），把解出的帧按 [start, end) 收下。
+  // 收到 end 之后的帧说明这个 GOP 已经全部输出，返回 true
+  bool SendPacket(const AVPacket* packet, int64_t start, int64_t end,
+                  std::vector<AVFramePtr>* frames);
+
+  GopCache* cache_;
+  KeyframeIndex* keyframe_index_;
+  std::unique_ptr<LocalFileIO> file_io_;  // 在 format_ctx_ 关闭之后释放
+  AVFormatContext* format_ctx_ = nullptr;
+  AVCodecContext* codec_ctx_ = nullptr;
+  int stream_index_ = -1;
+  AVFramePtr frame_;
+
+  std::mutex mutex_;
+  std::condition_variable request_cv_;
+  std::condition_variable done_cv_;
+  std::deque<Request> requests_;
+  std::set<uint64_t> unfinished_;  // 还没处理完的请求 id
+  std::set<uint64_t> failed_;      // 处理失败、DecodeNow 还没取走结果的请求 id
+  uint64_t next_id_ = 1;
+  bool stop_ = false;
+  std::thread thread_;
+  std::atomic<uint64_t> decoded_gops_{0};
+  std::atomic<bool> keyframes_only_{false};
+};
+
+#endif /* gop_decoder_hpp */
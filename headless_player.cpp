@@ -0,0 +1,96 @@
+//
+//  headless_player.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/28.
+//
+
+#include "headless_player.hpp"
+
+extern "C" {
+#include <libavutil/time.h>
+}
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+#include <sys/resource.h>
+
+HeadlessPlayer::HeadlessPlayer(const std::string& path,
+                               const DecoderOptions& options)
+    : path_(path), paced_(options.paced) {
+  codec_.Register(this);
+  start_us_ = av_gettime_relative();
+  codec_.StartCodec(path, options);
+}
+
+HeadlessPlayer::~HeadlessPlayer() {
+  codec_.StopCodec();
+  codec_.UnRegister(this);
+}
+
+bool HeadlessPlayer::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return done_; });
+  return !error_;
+}
+
+std::string HeadlessPlayer::Report() {
+  CodecStats stats = codec_.GetStats();
+  int64_t end_us;
+  bool error;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    end_us = done_ ? end_us_ : av_gettime_relative();
+    error = error_;
+  }
+  double seconds = (end_us - start_us_) / 1000000.0;
+  return fmt::format(
+      "{{\"file\": \"{}\", \"paced\": {}, \"error\": {}, \"seconds\": {:.3f}, "
+      "\"decoded_frames\": {}, \"decode_fps\": {:.1f}, \"presented\": {}, "
+      "\"dropped\": {}, \"late\": {}, \"repeated\": {}, \"audio_frames\": {}, "
+      "\"video_queue_peak_bytes\": {}, \"video_queue_peak_frames\": {}, "
+      "\"audio_queue_peak_bytes\": {}, \"audio_queue_peak_frames\": {}, "
+      "\"peak_rss_bytes\": {}, \"stats\": {}}}",
+      path_, paced_, error, seconds, stats.decoded_frames,
+      seconds > 0 ? stats.decoded_frames / seconds : 0.0,
+      stats.sync.presented, stats.sync.dropped, stats.sync.late,
+      stats.sync.repeated, audio_frames_.load(), stats.video_queue_peak_bytes,
+      stats.video_queue_peak_frames, stats.audio_queue_peak_bytes,
+      stats.audio_queue_peak_frames, PeakResidentBytes(),
+      codec_.GetStatsJson());
+}
+
+uint64_t HeadlessPlayer::PeakResidentBytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  return static_cast<uint64_t>(usage.ru_maxrss);  // macOS 上是字节
+#else
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;  // Linux 上是 KB
+#endif
+}
+
+void HeadlessPlayer::OnVideoFrame(AVFramePtr frame) {
+  // null renderer：不转换不显示，送显的计数在 SyncStats 里
+}
+
+void HeadlessPlayer::OnAudioFrame(AVFramePtr frame) { ++audio_frames_; }
+
+void HeadlessPlayer::OnMediaError() {
+  spdlog::error("headless: media error {}", path_);
+  Finish(true);
+}
+
+void HeadlessPlayer::OnEndOfStream() { Finish(false); }
+
+void HeadlessPlayer::Finish(bool error) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (done_) {
+    return;
+  }
+  done_ = true;
+  error_ = error;
+  end_us_ = av_gettime_relative();
+  done_cv_.notify_all();
+}
@@ -0,0 +1,61 @@
+//
+//  headless_player.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/28.
+//
+
+#ifndef headless_player_hpp
+#define headless_player_hpp
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "video_codec.hpp"
+
+// 没有界面也没有声卡的播放会话，给服务器和 CI 跑性能回归用。
+// 视频帧和音频帧收到就扔（null renderer），没有音频时钟，视频按墙上时钟
+// 排期；options.paced = false 时不排期，解多快放多快。
+// 播到结尾或出错后 Wait 返回，Report 给出解码帧率、丢帧/迟到数、队列
+// 高水位和进程内存峰值
+class HeadlessPlayer : public VideoCodecListener {
+ public:
+  HeadlessPlayer(const std::string& path, const DecoderOptions& options);
+  ~HeadlessPlayer();
+
+  HeadlessPlayer(const HeadlessPlayer&) = delete;
+  HeadlessPlayer& operator=(const HeadlessPlayer&) = delete;
+
+  // 等到播完或出错，返回 false 表示出错
+  bool Wait();
+  // 一行 JSON，包含 VideoCodec::GetStatsJson 的完整快照
+  std::string Report();
+
+  // 进程的常驻内存峰值（字节）
+  static uint64_t PeakResidentBytes();
+
+ private:
+  void OnVideoFrame(AVFramePtr frame) override;
+  void OnAudioFrame(AVFramePtr frame) override;
+  void OnMediaError() override;
+  void OnEndOfStream() override;
+  void Finish(bool error);
+
+  std::string path_;
+  bool paced_;
+  int64_t start_us_ = 0;
+  std::atomic<uint64_t> audio_frames_{0};
+
+  std::mutex mutex_;
+  std::condition_variable done_cv_;
+  bool done_ = false;
+  bool error_ = false;
+  int64_t end_us_ = 0;
+
+  // 放在最后、最先析构：停掉之后不会再有回调
+  VideoCodec codec_;
+};
+
+#endif /* headless_player_hpp */
@@ -0,0 +1,89 @@
+//
+//  image_pool.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/15.
+//
+
+#include "image_pool.hpp"
+
+extern "C" {
+#include <libavutil/mem.h>
+}
+
+// 行对齐到 64 字节，SIMD 写入不会跨 cache line 拆分
+static const int kStrideAlign = 64;
+
+struct ImagePool::Lease {
+  std::shared_ptr<State> state;
+  uint8_t* data;
+  size_t size;
+};
+
+ImagePool::ImagePool(size_t max_cached) : state_(std::make_shared<State>()) {
+  state_->max_cached = max_cached;
+}
+
+ImagePool::~ImagePool() {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  for (uint8_t* buffer : state_->free_buffers) {
+    av_free(buffer);
+  }
+  state_->free_buffers.clear();
+  state_->max_cached = 0;  // 还在外面的图像释放时直接 free
+}
+
+void ImagePool::Release(void* info) {
+  Lease* lease = static_cast<Lease*>(info);
+  {
+    State* state = lease->state.get();
+    std::lock_guard<std::mutex> lock(state->mutex);
+    --state->outstanding;
+    if (lease->size == state->buffer_size &&
+        state->free_buffers.size() < state->max_cached) {
+      state->free_buffers.push_back(lease->data);
+      lease->data = nullptr;
+    }
+  }
+  av_free(lease->data);
+  delete lease;
+}
+
+QImage ImagePool::Acquire(int width, int height) {
+  int stride = (width * 4 + kStrideAlign - 1) / kStrideAlign * kStrideAlign;
+  size_t size = static_cast<size_t>(stride) * height;
+
+  uint8_t* data = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    if (size != state_->buffer_size) {
+      for (uint8_t* buffer : state_->free_buffers) {
+        av_free(buffer);
+      }
+      state_->free_buffers.clear();
+      state_->buffer_size = size;
+    }
+    if (!state_->free_buffers.empty()) {
+      data = state_->free_buffers.back();
+      state_->free_buffers.pop_back();
+    }
+    ++state_->outstanding;
+  }
+  if (!data) {
+    data = static_cast<uint8_t*>(av_malloc(size));
+    if (!data) {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      --state_->outstanding;
+      return QImage();
+    }
+  }
+
+  Lease* lease = new Lease{state_, data, size};
+  return QImage(data, width, height, stride, QImage::Format_RGB32, Release,
+                lease);
+}
+
+size_t ImagePool::outstanding() const {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  return state_->outstanding;
+}
@@ -0,0 +1,49 @@
+//
+//  image_pool.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/15.
+//
+
+#ifndef image_pool_hpp
+#define image_pool_hpp
+
+#include <QImage>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// 复用 RGB32 输出 buffer。QImage 只是包装池里的内存，最后一个引用释放时
+// buffer 自动回到池中，不用每帧分配一整帧的内存
+class ImagePool {
+ public:
+  explicit ImagePool(size_t max_cached = 8);
+  ~ImagePool();
+
+  ImagePool(const ImagePool&) = delete;
+  ImagePool& operator=(const ImagePool&) = delete;
+
+  // 返回 width x height 的 RGB32 图像，内容未初始化。
+  // 尺寸变化后旧尺寸的 buffer 不再复用，回收时直接释放
+  QImage Acquire(int width, int height);
+
+  // 池里当前分配出去的 buffer 数，用于观察泄漏
+  size_t outstanding() const;
+
+ private:
+  struct State {
+    mutable std::mutex mutex;
+    std::vector<uint8_t*> free_buffers;
+    size_t buffer_size = 0;
+    size_t max_cached;
+    size_t outstanding = 0;
+  };
+  struct Lease;
+
+  static void Release(void* info);
+
+  std::shared_ptr<State> state_;
+};
+
+#endif /* image_pool_hpp */
@@ -0,0 +1,93 @@
+//
+//  keyframe_index.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/22.
+//
+
+#include "keyframe_index.hpp"
+
+#include <algorithm>
+
+void KeyframeIndex::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  keyframes_.clear();
+}
+
+size_t KeyframeIndex::ImportFromStream(AVStream* stream) {
+  std::vector<int64_t> imported;
+  int count = avformat_index_get_entries_count(stream);
+  for (int i = 0; i < count; ++i) {
+    const AVIndexEntry* entry = avformat_index_get_entry(stream, i);
+    if (entry && (entry->flags & AVINDEX_KEYFRAME) &&
+        entry->timestamp != AV_NOPTS_VALUE) {
+      imported.push_back(entry->timestamp);
+    }
+  }
+  std::sort(imported.begin(), imported.end());
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<int64_t> merged;
+  merged.reserve(keyframes_.size() + imported.size());
+  std::merge(keyframes_.begin(), keyframes_.end(), imported.begin(),
+             imported.end(), std::back_inserter(merged));
+  merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+  keyframes_.swap(merged);
+  return imported.size();
+}
+
+void KeyframeIndex::Add(int64_t pts) {
+  if (pts == AV_NOPTS_VALUE) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  // 顺序播放时新关键帧总在末尾，直接追加
+  if (keyframes_.empty() || pts > keyframes_.back()) {
+    keyframes_.push_back(pts);
+    return;
+  }
+  auto it = std::lower_bound(keyframes_.begin(), keyframes_.end(), pts);
+  if (it == keyframes_.end() || *it != pts) {
+    keyframes_.insert(it, pts);
+  }
+}
+
+bool KeyframeIndex::Floor(int64_t pts, int64_t* keyframe) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = std::upper_bound(keyframes_.begin(), keyframes_.end(), pts);
+  if (it == keyframes_.begin()) {
+    return false;
+  }
+  *keyframe = *(it - 1);
+  return true;
+}
+
+bool KeyframeIndex::Next(int64_t pts, int64_t* keyframe) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = std::upper_bound(keyframes_.begin(), keyframes_.end(), pts);
+  if (it == keyframes_.end()) {
+    return false;
+  }
+  *keyframe = *it;
+  return true;
+}
+
+bool KeyframeIndex::Nearest(int64_t pts, int64_t* keyframe) const {
+  int64_t before = 0, after = 0;
+  bool has_before = Floor(pts, &before);
+  bool has_after = Next(pts, &after);
+  if (!has_before && !has_after) {
+    return false;
+  }
+  if (!has_after || (has_before && pts - before <= after - pts)) {
+    *keyframe = before;
+  } else {
+    *keyframe = after;
+  }
+  return true;
+}
+
+size_t KeyframeIndex::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return keyframes_.size();
+}
@@ -0,0 +1,43 @@
+//
+//  keyframe_index.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/22.
+//
+
+#ifndef keyframe_index_hpp
+#define keyframe_index_hpp
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// 视频流关键帧的时间索引，时间单位是流的 time_base。
+// 打开文件时先从容器自带的索引（mp4 的 stss、mkv 的 Cues 等）导入，
+// 解封装过程中再把读到的关键帧 packet 补进去，没有索引的格式播过的部分
+// 也能精确定位。解封装线程写，seek 请求方读，内部加锁。
+class KeyframeIndex {
+ public:
+  void Clear();
+  // 导入 stream 在容器里的索引项，返回导入的关键帧数
+  size_t ImportFromStream(AVStream* stream);
+  void Add(int64_t pts);
+
+  // 不晚于 pts 的最后一个关键帧，没有返回 false
+  bool Floor(int64_t pts, int64_t* keyframe) const;
+  // 晚于 pts 的第一个关键帧，没有返回 false
+  bool Next(int64_t pts, int64_t* keyframe) const;
+  // 离 pts 最近的关键帧，没有返回 false
+  bool Nearest(int64_t pts, int64_t* keyframe) const;
+  size_t size() const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::vector<int64_t> keyframes_;  // 升序
+};
+
+#endif /* keyframe_index_hpp */
@@ -0,0 +1,351 @@
+//
+//  local_file_io.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/26.
+//
+
+#include "local_file_io.hpp"
+
+#include <fcntl.h>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/mem.h>
+}
+
+// AVIOContext 自己的缓冲，demuxer 的小读取都从这里出
+static const int kIoBufferSize = 256 << 10;
+// 预读线程每次 pread 的大小
+static const size_t kReadChunk = 1 << 20;
+// 预读窗口/环至少这么大
+static const size_t kMinWindow = 4 << 20;
+
+static const char* kFilePrefix = "file:";
+
+// FFmpeg 认的本地路径：没有协议头，或者 file: 开头
+static bool LocalPath(const std::string& path, std::string* local) {
+  if (path.compare(0, strlen(kFilePrefix), kFilePrefix) == 0) {
+    *local = path.substr(strlen(kFilePrefix));
+    return true;
+  }
+  if (path.find("://") != std::string::npos) {
+    return false;
+  }
+  *local = path;
+  return true;
+}
+
+std::unique_ptr<LocalFileIO> LocalFileIO::Open(const std::string& path,
+                                               FileIoMode mode,
+                                               size_t read_ahead_bytes) {
+  std::string local;
+  if (mode == FileIoMode::kFFmpeg || !LocalPath(path, &local)) {
+    return nullptr;
+  }
+
+  std::unique_ptr<LocalFileIO> io(new LocalFileIO);
+  io->fd_ = open(local.c_str(), O_RDONLY | O_CLOEXEC);
+  ++io->syscalls_;
+  if (io->fd_ < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  ++io->syscalls_;
+  if (fstat(io->fd_, &st) != 0 || !S_ISREG(st.st_mode)) {
+    // 设备、管道不能随机访问，还是交给 FFmpeg
+    return nullptr;
+  }
+  io->file_size_ = st.st_size;
+  io->window_ = std::max(read_ahead_bytes, kMinWindow);
+
+  bool ready = false;
+  if (mode == FileIoMode::kAuto || mode == FileIoMode::kMmap) {
+    ready = io->InitMmap();
+  }
+  if (!ready && (mode == FileIoMode::kAuto || mode == FileIoMode::kReadAhead)) {
+    ready = io->InitReadAhead();
+  }
+  if (!ready) {
+    return nullptr;
+  }
+
+  uint8_t* buffer = static_cast<uint8_t*>(av_malloc(kIoBufferSize));
+  io->avio_ = avio_alloc_context(buffer, kIoBufferSize, 0, io.get(),
+                                 &LocalFileIO::ReadPacket, nullptr,
+                                 &LocalFileIO::SeekPacket);
+  if (!io->avio_) {
+    av_free(buffer);
+    return nullptr;
+  }
+  spdlog::info("file io: {} for {} ({:.1f} MB, window {:.1f} MB)",
+               io->mmapped_ ? "mmap" : "read-ahead", local,
+               io->file_size_ / 1048576.0, io->window_ / 1048576.0);
+  return io;
+}
+
+LocalFileIO::~LocalFileIO() {
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    space_cv_.notify_all();
+    data_cv_.notify_all();
+    thread_.join();
+  }
+  if (avio_) {
+    LogStats();
+    av_freep(&avio_->buffer);
+    avio_context_free(&avio_);
+  }
+  if (map_) {
+    munmap(map_, file_size_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool LocalFileIO::InitMmap() {
+  if (file_size_ <= 0) {
+    return false;  // 空文件 mmap 会失败
+  }
+  ++syscalls_;
+  void* map = mmap(nullptr, file_size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (map == MAP_FAILED) {
+    spdlog::info("file io: mmap failed ({}), using read-ahead",
+                 strerror(errno));
+    return false;
+  }
+  map_ = static_cast<uint8_t*>(map);
+  mmapped_ = true;
+  // 内核按顺序读的模式放大预读、及早回收读过的页
+  ++syscalls_;
+  madvise(map_, file_size_, MADV_SEQUENTIAL);
+  return true;
+}
+
+bool LocalFileIO::InitReadAhead() {
+#ifdef POSIX_FADV_SEQUENTIAL
+  ++syscalls_;
+  posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  ring_.resize(window_);
+  thread_ = std::thread(&LocalFileIO::ReadAheadLoop, this);
+  return true;
+}
+
+FileIoStats LocalFileIO::stats() const {
+  FileIoStats stats;
+  stats.mode = mmapped_ ? "mmap" : "read-ahead";
+  stats.syscalls = syscalls_;
+  stats.bytes_read = bytes_read_;
+  stats.read_ahead_bytes = read_ahead_bytes_;
+  stats.discarded_bytes = discarded_bytes_;
+  stats.seeks = seeks_;
+  stats.stalls = stalls_;
+  return stats;
+}
+
+void LocalFileIO::LogStats() const {
+  FileIoStats s = stats();
+  spdlog::info(
+      "file io: {} {} syscalls, {:.1f} MB read, {:.1f} MB read ahead, "
+      "{:.1f} MB discarded by {} seeks, {} stalls",
+      s.mode, s.syscalls, s.bytes_read / 1048576.0,
+      s.read_ahead_bytes / 1048576.0, s.discarded_bytes / 1048576.0, s.seeks,
+      s.stalls);
+}
+
+int LocalFileIO::ReadPacket(void* opaque, uint8_t* buf, int size) {
+  auto* io = static_cast<LocalFileIO*>(opaque);
+  int n = io->mmapped_ ? io->ReadMmap(buf, size) : io->ReadRing(buf, size);
+  if (n > 0) {
+    io->bytes_read_ += n;
+  }
+  return n;
+}
+
+int64_t LocalFileIO::SeekPacket(void* opaque, int64_t offset, int whence) {
+  return static_cast<LocalFileIO*>(opaque)->Seek(offset, whence);
+}
+
+int LocalFileIO::ReadMmap(uint8_t* buf, int size) {
+  if (pos_ >= file_size_) {
+    return AVERROR_EOF;
+  }
+  AdviseAhead();
+  int n = static_cast<int>(std::min<int64_t>(size, file_size_ - pos_));
+  memcpy(buf, map_ + pos_, n);
+  pos_ += n;
+  return n;
+}
+
+void LocalFileIO::AdviseAhead() {
+  // 剩下不到半个窗口时再发一次，每次把窗口补满
+  if (advised_end_ >= file_size_ ||
+      advised_end_ - pos_ > static_cast<int64_t>(window_ / 2)) {
+    return;
+  }
+  static const int64_t page = sysconf(_SC_PAGESIZE);
+  int64_t begin = std::max(advised_end_, pos_) / page * page;
+  int64_t end = std::min<int64_t>(pos_ + window_, file_size_);
+  if (end <= begin) {
+    return;
+  }
+  ++syscalls_;
+  madvise(map_ + begin, end - begin, MADV_WILLNEED);
+  read_ahead_bytes_ += end - std::max(advised_end_, pos_);
+  advised_end_ = end;
+}
+
+int LocalFileIO::ReadRing(uint8_t* buf, int size) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (read_pos_ == fill_pos_ && !eof_) {
+    ++stalls_;
+    data_cv_.wait(lock,
+                  [this] { return stop_ || eof_ || fill_pos_ > read_pos_; });
+  }
+  if (fill_pos_ == read_pos_) {
+    return error_ ? AVERROR(error_) : AVERROR_EOF;
+  }
+  int64_t pos = read_pos_;
+  size_t offset = pos % ring_.size();
+  // 一次只拷连续的一段，剩下的 AVIO 会再来读
+  int n = static_cast<int>(std::min<int64_t>(
+      {static_cast<int64_t>(size), fill_pos_ - pos,
+       static_cast<int64_t>(ring_.size() - offset)}));
+  lock.unlock();
+
+  // 后台线程不会写 [read_pos_, fill_pos_)，读位置也只有这个线程会改
+  memcpy(buf, ring_.data() + offset, n);
+
+  lock.lock();
+  read_pos_ = pos + n;
+  space_cv_.notify_one();
+  return n;
+}
+
+int64_t LocalFileIO::Seek(int64_t offset, int whence) {
+  if (whence & AVSEEK_SIZE) {
+    return file_size_;
+  }
+  whence &= ~AVSEEK_FORCE;
+  int64_t current = mmapped_ ? pos_ : read_pos_;
+  int64_t target;
+  switch (whence) {
+    case SEEK_SET:
+      target = offset;
+      break;
+    case SEEK_CUR:
+      target = current + offset;
+      break;
+    case SEEK_END:
+      target = file_size_ + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (target < 0) {
+    return AVERROR(EINVAL);
+  }
+  ++seeks_;
+
+  if (mmapped_) {
+    if (target < pos_ || target > advised_end_) {
+      // 跳出了已预取的窗口，从新位置重新预取
+      advised_end_ = target;
+    }
+    pos_ = target;
+    return target;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (target >= read_pos_ && target <= fill_pos_) {
+    // 往前跳，落在已经读好的数据里，直接跳过
+    read_pos_ = target;
+  } else {
+    discarded_bytes_ += fill_pos_ - read_pos_;
+    ++generation_;
+    read_pos_ = target;
+    fill_pos_ = target;
+    eof_ = false;
+    error_ = 0;
+  }
+  space_cv_.notify_one();
+  return target;
+}
+
+void LocalFileIO::ReadAheadLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    size_t ring_size = ring_.size();
+    size_t offset = fill_pos_ % ring_size;
+    size_t want = std::min(kReadChunk, ring_size - offset);
+    size_t free_space = ring_size - (fill_pos_ - read_pos_);
+    if (eof_ || free_space < want) {
+      space_cv_.wait(lock);
+      continue;
+    }
+
+    int64_t pos = fill_pos_;
+    uint64_t generation = generation_;
+    lock.unlock();
+    // demuxer 不会读 [fill_pos_, read_pos_ + ring 大小)，这段可以不加锁写
+    ++syscalls_;
+    ssize_t n = pread(fd_, ring_.data() + offset, want, pos);
+    int err = n < 0 ? errno : 0;
+    lock.lock();
+
+    if (generation != generation_) {
+      // 读的时候发生了 seek，这段数据已经作废
+      if (n > 0) {
+        discarded_bytes_ += n;
+      }
+      continue;
+    }
+    if (n < 0) {
+      if (err == EINTR) {
+        continue;
+      }
+      spdlog::warn("file io: pread failed: {}", strerror(err));
+      error_ = err;
+      eof_ = true;
+    } else if (n == 0) {
+      eof_ = true;
+    } else {
+      fill_pos_ += n;
+      read_ahead_bytes_ += n;
+    }
+    data_cv_.notify_one();
+  }
+}
+
+int OpenMediaInput(const std::string& path, FileIoMode mode,
+                   size_t read_ahead_bytes, AVFormatContext** format_ctx,
+                   std::unique_ptr<LocalFileIO>* io) {
+  *io = LocalFileIO::Open(path, mode, read_ahead_bytes);
+  if (*io) {
+    *format_ctx = avformat_alloc_context();
+    if (!*format_ctx) {
+      io->reset();
+      return AVERROR(ENOMEM);
+    }
+    (*format_ctx)->pb = (*io)->context();
+    (*format_ctx)->flags |= AVFMT_FLAG_CUSTOM_IO;
+  }
+  // 失败时 avformat_open_input 会释放 format_ctx，但不碰自定义的 pb
+  int ret = avformat_open_input(format_ctx, path.c_str(), NULL, NULL);
+  if (ret != 0) {
+    io->reset();
+  }
+  return ret;
+}
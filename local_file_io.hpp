@@ -0,0 +1,119 @@
+//
+//  local_file_io.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/26.
+//
+
+#ifndef local_file_io_hpp
+#define local_file_io_hpp
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class FileIoMode {
+  kAuto,       // 能 mmap 就 mmap，否则预读线程
+  kMmap,       // 只用 mmap，不行时退回 FFmpeg 自己的 file 协议
+  kReadAhead,  // 后台线程大块 pread 进环形缓冲
+  kFFmpeg,     // 不用自定义 IO
+};
+
+struct FileIoStats {
+  const char* mode = "ffmpeg";
+  uint64_t syscalls = 0;          // 自己发出的 open/pread/mmap/madvise 等
+  uint64_t bytes_read = 0;        // 交给 demuxer 的字节数
+  uint64_t read_ahead_bytes = 0;  // 提前读进内存（mmap 下为 madvise 预取）的字节数
+  uint64_t discarded_bytes = 0;   // 预读了但被 seek 作废的字节数
+  uint64_t seeks = 0;
+  uint64_t stalls = 0;  // demuxer 读到预读线程前面、只能等的次数
+};
+
+// 本地文件的自定义 AVIOContext。FFmpeg 的 file 协议每次 read() 32KB，
+// 在 NFS 和机械盘上每次 IO 停顿都直接变成解码卡顿。这里优先 mmap，
+// 顺序读提示加上提前 MADV_WILLNEED 一段窗口；mmap 不可用时由后台线程
+// 按大块 pread 填一个环形缓冲，seek 到缓冲外时作废已预读的数据。
+// 所有回调都在同一个解封装线程里调用。
+class LocalFileIO {
+ public:
+  ~LocalFileIO();
+
+  LocalFileIO(const LocalFileIO&) = delete;
+  LocalFileIO& operator=(const LocalFileIO&) = delete;
+
+  // path 是本地普通文件时打开，URL、设备、管道等返回 nullptr，
+  // 交给 FFmpeg 自己的协议处理。read_ahead_bytes 是预读窗口/环的大小
+  static std::unique_ptr<LocalFileIO> Open(const std::string& path,
+                                           FileIoMode mode,
+                                           size_t read_ahead_bytes);
+
+  // 设给 AVFormatContext::pb，调用方负责加 AVFMT_FLAG_CUSTOM_IO
+  AVIOContext* context() { return avio_; }
+  FileIoStats stats() const;
+
+ private:
+  LocalFileIO() = default;
+
+  bool InitMmap();
+  bool InitReadAhead();
+  void LogStats() const;
+
+  static int ReadPacket(void* opaque, uint8_t* buf, int size);
+  static int64_t SeekPacket(void* opaque, int64_t offset, int whence);
+  int ReadMmap(uint8_t* buf, int size);
+  int ReadRing(uint8_t* buf, int size);
+  int64_t Seek(int64_t offset, int whence);
+  // mmap：读位置接近已预取的末尾时再往前 MADV_WILLNEED 一段
+  void AdviseAhead();
+  void ReadAheadLoop();
+
+  int fd_ = -1;
+  int64_t file_size_ = 0;
+  size_t window_ = 0;
+  AVIOContext* avio_ = nullptr;
+  bool mmapped_ = false;
+
+  // mmap 模式，只在解封装线程访问
+  uint8_t* map_ = nullptr;
+  int64_t pos_ = 0;
+  int64_t advised_end_ = 0;
+
+  // 预读模式。[read_pos_, fill_pos_) 是已经读好的数据，
+  // 后台线程只往 [fill_pos_, read_pos_ + ring 大小) 写
+  std::vector<uint8_t> ring_;
+  std::mutex mutex_;
+  std::condition_variable data_cv_;
+  std::condition_variable space_cv_;
+  int64_t read_pos_ = 0;
+  int64_t fill_pos_ = 0;
+  uint64_t generation_ = 0;  // seek 作废预读时加一，在途的 pread 结果丢掉
+  bool eof_ = false;
+  int error_ = 0;
+  bool stop_ = false;
+  std::thread thread_;
+
+  std::atomic<uint64_t> syscalls_{0};
+  std::atomic<uint64_t> bytes_read_{0};
+  std::atomic<uint64_t> read_ahead_bytes_{0};
+  std::atomic<uint64_t> discarded_bytes_{0};
+  std::atomic<uint64_t> seeks_{0};
+  std::atomic<uint64_t> stalls_{0};
+};
+
+// 打开 path 交给 avformat_open_input：本地普通文件按 mode 走 LocalFileIO，
+// 其他情况用 FFmpeg 自己的协议，此时 *io 为空。返回 avformat_open_input
+// 的结果。关闭时先 avformat_close_input，再释放 *io
+int OpenMediaInput(const std::string& path, FileIoMode mode,
+                   size_t read_ahead_bytes, AVFormatContext** format_ctx,
+                   std::unique_ptr<LocalFileIO>* io);
+
+#endif /* local_file_io_hpp */
@@ -5,28 +5,153 @@
 //  Created by jt on 2023/12/13.
 //
 #include <spdlog/sinks/basic_file_sink.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
 #include <QApplication>
 #include <QLabel>
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
+#include "headless_player.hpp"
+#include "task_scheduler.hpp"
+#include "thumbnail_extractor.hpp"
+#include "video_grid_view.hpp"
 #include "video_player_view.hpp"
 
 int main(int argc, const char* argv[]) {
   spdlog::info("hello");
   
-  if (argc == 1) {
-    spdlog::error("use ./VideoPlayer path_to_video_file");
+  // 开头连续的非选项参数都是文件，多个文件时同屏播放
+  std::vector<std::string> paths;
+  int i = 1;
+  for (; i < argc && strncmp(argv[i], "--", 2) != 0; ++i) {
+    paths.push_back(argv[i]);
+  }
+  if (paths.empty()) {
+    spdlog::error(
+        "use ./VideoPlayer path_to_video_file [more files...] [--threads N] "
+        "[--thread-type auto|frame|slice] [--codec-opt key=value] "
+        "[--gop-cache-mb N] [--workers N] "
+        "[--file-io auto|mmap|readahead|ffmpeg] [--read-ahead-mb N] "
+        "[--queue-mb N] [--queue-seconds S] [--startup fast|normal] "
+        "[--thumbnails N --out dir [--thumb-width W]] "
+        "[--headless realtime|fast] [--adaptive-quality on|off]");
     return -1; 
   }
+
+  DecoderOptions options;
+  ThumbnailOptions thumbnail_options;
+  int thumbnails = 0;
+  bool headless = false;
+  for (; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--threads") == 0) {
+      options.thread_count = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--thread-type") == 0) {
+      if (strcmp(argv[i + 1], "frame") == 0) {
+        options.thread_type = DecoderOptions::ThreadType::kFrame;
+      } else if (strcmp(argv[i + 1], "slice") == 0) {
+        options.thread_type = DecoderOptions::ThreadType::kSlice;
+      }
+    } else if (strcmp(argv[i], "--codec-opt") == 0) {
+      const char* eq = strchr(argv[i + 1], '=');
+      if (eq) {
+        options.codec_options[std::string(argv[i + 1], eq)] = eq + 1;
+      }
+    } else if (strcmp(argv[i], "--gop-cache-mb") == 0) {
+      options.gop_cache_bytes =
+          static_cast<uint64_t>(std::max(atoi(argv[i + 1]), 0)) << 20;
+    } else if (strcmp(argv[i], "--file-io") == 0) {
+      if (strcmp(argv[i + 1], "mmap") == 0) {
+        options.file_io = FileIoMode::kMmap;
+      } else if (strcmp(argv[i + 1], "readahead") == 0) {
+        options.file_io = FileIoMode::kReadAhead;
+      } else if (strcmp(argv[i + 1], "ffmpeg") == 0) {
+        options.file_io = FileIoMode::kFFmpeg;
+      }
+    } else if (strcmp(argv[i], "--read-ahead-mb") == 0) {
+      options.read_ahead_bytes =
+          static_cast<size_t>(std::max(atoi(argv[i + 1]), 0)) << 20;
+    } else if (strcmp(argv[i], "--queue-mb") == 0) {
+      // 解码后视频帧队列的字节上限，4K 下一帧约 12MB
+      options.video_queue_bytes =
+          static_cast<uint64_t>(std::max(atoi(argv[i + 1]), 0)) << 20;
+    } else if (strcmp(argv[i], "--queue-seconds") == 0) {
+      options.video_queue_seconds = std::max(atof(argv[i + 1]), 0.0);
+      options.audio_queue_seconds = options.video_queue_seconds;
+    } else if (strcmp(argv[i], "--adaptive-quality") == 0) {
+      options.adaptive_quality = strcmp(argv[i + 1], "off") != 0;
+    } else if (strcmp(argv[i], "--startup") == 0) {
+      // fast：少读少分析，尽快出第一帧
+      options.fast_start = strcmp(argv[i + 1], "fast") == 0;
+    } else if (strcmp(argv[i], "--headless") == 0) {
+      // 不开窗口不开声卡，realtime 按时间戳播，fast 解多快放多快
+      headless = true;
+      options.paced = strcmp(argv[i + 1], "fast") != 0;
+    } else if (strcmp(argv[i], "--thumbnails") == 0) {
+      thumbnails = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--out") == 0) {
+      thumbnail_options.out_dir = argv[i + 1];
+    } else if (strcmp(argv[i], "--thumb-width") == 0) {
+      thumbnail_options.width = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--workers") == 0) {
+      // 所有会话共用的任务线程数，进程里只设一次，默认按 CPU 核数
+      TaskScheduler::Configure(atoi(argv[i + 1]));
+    } else {
+      spdlog::warn("unknown option {}", argv[i]);
+    }
+  }
   
+  if (thumbnails > 0) {
+    // 只抽缩略图，不开窗口
+    thumbnail_options.count = thumbnails;
+    thumbnail_options.file_io = options.file_io;
+    ThumbnailExtractor extractor(thumbnail_options);
+    ThumbnailStats stats = extractor.Run(paths);
+    spdlog::info(
+        "thumbnails: {} files ({} failed), {} thumbnails in {:.2f}s, "
+        "{:.1f} thumbnails/s",
+        stats.files, stats.failed_files, stats.thumbnails, stats.seconds,
+        stats.ThumbnailsPerSecond());
+    return stats.failed_files == stats.files ? -1 : 0;
+  }
+
+  if (headless) {
+    // 每个文件一个会话同时播，播完每个文件往 stdout 打一行 JSON 报告。
+    // 日志改到 stderr，stdout 上只有报告
+    spdlog::set_default_logger(spdlog::stderr_color_mt("headless"));
+    std::vector<std::unique_ptr<HeadlessPlayer>> players;
+    for (const std::string& path : paths) {
+      players.emplace_back(new HeadlessPlayer(path, options));
+    }
+    int failed = 0;
+    for (auto& player : players) {
+      if (!player->Wait()) {
+        ++failed;
+      }
+      printf("%s\n", player->Report().c_str());
+      fflush(stdout);
+    }
+    return failed > 0 ? -1 : 0;
+  }
+
   int q_argc = argc;
   char** q_argv = (char**)argv;
   QApplication app(q_argc, q_argv);
 
-  VideoPlayerView video_player(argv[1]);
+  if (paths.size() > 1) {
+    VideoGridView grid(paths, options);
+    grid.show();
+    return app.exec();
+  }
+
+  VideoPlayerView video_player(paths[0].c_str(), options);
   video_player.show();
 
   return app.exec();
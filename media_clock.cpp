@@ -0,0 +1,71 @@
+//
+//  media_clock.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/19.
+//
+
+#include "media_clock.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+void AudioClock::Configure(double bytes_per_second, double device_latency) {
+  Reset();
+  bytes_per_second_ = bytes_per_second;
+  device_latency_ = device_latency;
+}
+
+void AudioClock::Reset() {
+  written_bytes_ = 0;
+  write_mark_.Store(WriteMark());
+  consume_mark_.Store(ConsumeMark());
+}
+
+void AudioClock::Invalidate() {
+  epoch_.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void AudioClock::OnWrite(double pts, uint64_t size, double rate) {
+  double bytes_per_second = bytes_per_second_;
+  if (bytes_per_second <= 0) {
+    return;
+  }
+  if (std::isnan(pts)) {
+    // 没有时间戳的帧，接着上一段往后排
+    pts = write_mark_.Load().end_pts;
+  }
+  written_bytes_ += size;
+  write_mark_.Store(
+      {written_bytes_, pts + size * rate / bytes_per_second, rate});
+}
+
+void AudioClock::OnConsume(uint64_t begin, uint64_t size) {
+  double bytes_per_second = bytes_per_second_;
+  WriteMark mark = write_mark_.Load();
+  if (size == 0 || bytes_per_second <= 0 || mark.end_bytes < begin + size) {
+    return;
+  }
+  double pts =
+      mark.end_pts - (mark.end_bytes - begin) * mark.rate / bytes_per_second;
+  consume_mark_.Store({pts, pts + size * mark.rate / bytes_per_second,
+                       mark.rate, av_gettime_relative(),
+                       epoch_.load(std::memory_order_acquire), true});
+}
+
+double AudioClock::Now(bool* fresh) const {
+  ConsumeMark mark = consume_mark_.Load();
+  if (!mark.valid || mark.epoch != epoch_.load(std::memory_order_acquire)) {
+    *fresh = false;
+    return 0;
+  }
+  double elapsed = (av_gettime_relative() - mark.time_us) / 1000000.0;
+  *fresh = elapsed < kStaleSeconds;
+  // 交给声卡的数据要等它前面缓冲的那一段放完才真正出声
+  return std::min(mark.pts + elapsed * mark.rate, mark.max_pts) -
+         device_latency_ * mark.rate;
+}
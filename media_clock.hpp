@@ -0,0 +1,126 @@
+//
+//  media_clock.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/19.
+//
+
+#ifndef media_clock_hpp
+#define media_clock_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// 单写者多读者的 seqlock，读写都不加锁，读者在写冲突时重试。
+// 用在音频回调这种不能阻塞的线程和其他线程之间交换小结构体
+template <typename T>
+class SeqLockValue {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "SeqLockValue needs a trivially copyable type");
+
+ public:
+  SeqLockValue() { Store(T()); }
+
+  void Store(const T& value) {
+    uint64_t words[kWords] = {};
+    memcpy(words, &value, sizeof(T));
+    uint32_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < kWords; ++i) {
+      words_[i].store(words[i], std::memory_order_relaxed);
+    }
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  T Load() const {
+    uint64_t words[kWords];
+    uint32_t before, after;
+    do {
+      before = seq_.load(std::memory_order_acquire);
+      for (int i = 0; i < kWords; ++i) {
+        words[i] = words_[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = seq_.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    T value;
+    memcpy(&value, words, sizeof(T));
+    return value;
+  }
+
+ private:
+  static constexpr int kWords = (sizeof(T) + 7) / 8;
+  std::atomic<uint32_t> seq_{0};
+  std::atomic<uint64_t> words_[kWords];
+};
+
+// 音频主时钟。时间由声卡实际取走的字节数推出来，而不是墙上时间：
+// 写入侧（重采样之后）记录每段 PCM 对应的 pts，音频回调记录它开始播放
+// 哪个字节，两者一对就知道声卡正在播哪个时间点。变速播放时每个输出
+// 字节对应 rate 倍的媒体时间。
+class AudioClock {
+ public:
+  // 输出 PCM 的字节率，以及声卡自己缓冲带来的播放延迟（秒）。
+  // 同时重置时钟，之后写入和消费的字节都从 0 开始计
+  void Configure(double bytes_per_second, double device_latency);
+  void Reset();
+  // seek 之后旧的消费记录作废，直到回调消费到新写入的数据前 Now 都不 fresh。
+  // 可以在任意线程调用
+  void Invalidate();
+
+  // 写入侧：刚写入 size 字节 PCM，起始时间为 pts（秒），NAN 表示紧接上一段。
+  // rate 是这段 PCM 的播放倍速
+  void OnWrite(double pts, uint64_t size, double rate = 1);
+  // 音频回调：从第 begin 个字节开始的 size 字节交给了声卡。实时安全
+  void OnConsume(uint64_t begin, uint64_t size);
+
+  // 声卡当前播放到的时间（秒）。fresh 表示回调还在正常推进
+  // （最近 kStaleSeconds 内有过回调且拿到了数据）
+  double Now(bool* fresh) const;
+
+  static constexpr double kStaleSeconds = 0.5;
+
+ private:
+  struct WriteMark {
+    uint64_t end_bytes;  // 累计写入字节数
+    double end_pts;      // 写入位置对应的时间
+    double rate;         // 最近一段的倍速，环里还没播的数据都按它折算
+  };
+  struct ConsumeMark {
+    double pts;          // 这次回调第一个字节的时间
+    double max_pts;      // 这次回调最后一个字节的时间，时钟不超过它
+    double rate;         // 墙上一秒对应的媒体时间
+    int64_t time_us;     // 回调发生的时间
+    uint32_t epoch;      // 记录时的 epoch_，不一致说明已被 Invalidate
+    bool valid;
+  };
+
+  std::atomic<double> bytes_per_second_{0};
+  std::atomic<double> device_latency_{0};
+  std::atomic<uint32_t> epoch_{0};
+  uint64_t written_bytes_ = 0;  // 只在写入线程访问
+  SeqLockValue<WriteMark> write_mark_;
+  SeqLockValue<ConsumeMark> consume_mark_;
+};
+
+// 音画同步统计
+struct SyncStats {
+  bool audio_master = false;  // false 表示没有音频，退回墙上时钟
+  double drift = 0;           // 最近一帧显示时 视频pts - 主时钟，秒
+  double max_drift = 0;       // 绝对值最大的 drift
+  uint64_t presented = 0;
+  uint64_t dropped = 0;   // 太晚直接丢掉的帧
+  uint64_t late = 0;      // 显示了但比到期时间晚了一个容差以上的帧
+  uint64_t repeated = 0;  // 下一帧没按时到，上一帧多停留的次数
+  uint64_t seeks = 0;
+  double last_seek_latency = 0;  // 从 Seek 调用到新位置第一帧显示，秒
+  double max_seek_latency = 0;
+  uint64_t resumes = 0;
+  double last_resume_latency = 0;  // 从恢复播放到下一帧显示，秒
+  double max_resume_latency = 0;
+};
+
+#endif /* media_clock_hpp */
@@ -0,0 +1,84 @@
+//
+//  pcm_ring_buffer.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/17.
+//
+
+#include "pcm_ring_buffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static size_t RoundUpPowerOfTwo(size_t n) {
+  size_t size = 1;
+  while (size < n) {
+    size <<= 1;
+  }
+  return size;
+}
+
+PcmRingBuffer::PcmRingBuffer(size_t capacity)
+    : buffer_(RoundUpPowerOfTwo(std::max<size_t>(capacity, 1))),
+      mask_(buffer_.size() - 1) {}
+
+size_t PcmRingBuffer::Write(const uint8_t* data, size_t size) {
+  if (closed_.load(std::memory_order_acquire)) {
+    return 0;
+  }
+  uint64_t write_pos = write_pos_.load(std::memory_order_relaxed);
+  uint64_t read_pos = read_pos_.load(std::memory_order_acquire);
+  size_t chunk = std::min(size, buffer_.size() - size_t(write_pos - read_pos));
+  if (chunk == 0) {
+    return 0;
+  }
+
+  size_t offset = write_pos & mask_;
+  size_t first = std::min(chunk, buffer_.size() - offset);
+  memcpy(buffer_.data() + offset, data, first);
+  memcpy(buffer_.data(), data + first, chunk - first);
+  write_pos_.store(write_pos + chunk, std::memory_order_release);
+  return chunk;
+}
+
+size_t PcmRingBuffer::Read(uint8_t* dst, size_t size, uint64_t* begin) {
+  uint64_t read_pos = read_pos_.load(std::memory_order_relaxed);
+  uint64_t cleared = clear_until_.load(std::memory_order_acquire);
+  if (cleared > read_pos) {
+    read_pos = cleared;
+    read_pos_.store(read_pos, std::memory_order_release);
+  }
+  if (begin) {
+    *begin = read_pos;
+  }
+  uint64_t write_pos = write_pos_.load(std::memory_order_acquire);
+  size_t chunk = std::min<size_t>(size, write_pos - read_pos);
+  if (chunk == 0) {
+    return 0;
+  }
+
+  size_t offset = read_pos & mask_;
+  size_t first = std::min(chunk, buffer_.size() - offset);
+  memcpy(dst, buffer_.data() + offset, first);
+  memcpy(dst + first, buffer_.data(), chunk - first);
+  read_pos_.store(read_pos + chunk, std::memory_order_release);
+  return chunk;
+}
+
+void PcmRingBuffer::Clear() {
+  uint64_t write_pos = write_pos_.load(std::memory_order_acquire);
+  uint64_t cleared = clear_until_.load(std::memory_order_relaxed);
+  while (cleared < write_pos &&
+         !clear_until_.compare_exchange_weak(cleared, write_pos,
+                                             std::memory_order_acq_rel)) {
+  }
+}
+
+void PcmRingBuffer::Close() { closed_.store(true, std::memory_order_release); }
+
+size_t PcmRingBuffer::ReadAvailable() const {
+  uint64_t read_pos = std::max(read_pos_.load(std::memory_order_acquire),
+                               clear_until_.load(std::memory_order_acquire));
+  uint64_t write_pos = write_pos_.load(std::memory_order_acquire);
+  return write_pos > read_pos ? write_pos - read_pos : 0;
+}
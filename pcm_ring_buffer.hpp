@@ -0,0 +1,56 @@
+//
+//  pcm_ring_buffer.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/17.
+//
+
+#ifndef pcm_ring_buffer_hpp
+#define pcm_ring_buffer_hpp
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 已经重采样成声卡格式的 PCM 字节环。单生产者单消费者：
+// 音频输出任务 Write，SDL 音频回调 Read。两边都不阻塞也不加锁：
+// 环满时 Write 只写进去能放下的部分，剩下的由调用方留着稍后再写。
+class PcmRingBuffer {
+ public:
+  explicit PcmRingBuffer(size_t capacity);
+
+  PcmRingBuffer(const PcmRingBuffer&) = delete;
+  PcmRingBuffer& operator=(const PcmRingBuffer&) = delete;
+
+  // 最多写 size 字节，返回实际写入的字节数，空间不够时不等待；
+  // Close 之后返回 0
+  size_t Write(const uint8_t* data, size_t size);
+  // 最多读 size 字节，返回实际读到的字节数。begin 非空时返回读到的
+  // 第一个字节的累计序号（用来对时钟）
+  size_t Read(uint8_t* dst, size_t size, uint64_t* begin = nullptr);
+
+  // 丢弃调用时刻所有未读数据，可以在任意线程调用：只记下请求，
+  // 由消费者在下一次 Read 时执行，读位置始终只有消费者在写
+  void Clear();
+  void Close();
+
+  size_t capacity() const { return buffer_.size(); }
+  size_t ReadAvailable() const;
+  // 累计被消费的字节数
+  uint64_t total_read() const {
+    return read_pos_.load(std::memory_order_acquire);
+  }
+
+ private:
+  static constexpr size_t kCacheLine = 64;
+
+  std::vector<uint8_t> buffer_;
+  size_t mask_;
+  alignas(kCacheLine) std::atomic<uint64_t> read_pos_{0};
+  alignas(kCacheLine) std::atomic<uint64_t> write_pos_{0};
+  alignas(kCacheLine) std::atomic<bool> closed_{false};
+  std::atomic<uint64_t> clear_until_{0};
+};
+
+#endif /* pcm_ring_buffer_hpp */
@@ -0,0 +1,160 @@
+//
+//  pipeline_stats.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/27.
+//
+
+#include "pipeline_stats.hpp"
+
+#include <spdlog/fmt/fmt.h>
+
+#include <algorithm>
+#include <cmath>
+
+static int HighestBit(uint64_t value) { return 63 - __builtin_clzll(value); }
+
+int LatencyHistogram::BucketIndex(uint64_t value) {
+  if (value < kSubBuckets) {
+    return static_cast<int>(value);
+  }
+  value = std::min<uint64_t>(value, (1ull << kMaxBits) - 1);
+  // value 落在 [2^(kSubBits+e), 2^(kSubBits+e+1))，右移 e 位后取低位当格子号
+  int exponent = HighestBit(value) - kSubBits;
+  int sub = static_cast<int>(value >> exponent) - kSubBuckets;
+  return (exponent + 1) * kSubBuckets + sub;
+}
+
+double LatencyHistogram::BucketValue(int index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  int exponent = index / kSubBuckets - 1;
+  uint64_t lower = static_cast<uint64_t>(kSubBuckets + index % kSubBuckets)
+                   << exponent;
+  return lower + ((1ull << exponent) - 1) / 2.0;
+}
+
+void LatencyHistogram::Record(int64_t value_us) {
+  uint64_t value = value_us > 0 ? static_cast<uint64_t>(value_us) : 0;
+  buckets_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while (value > max &&
+         !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyHistogram::Reset() {
+  for (auto& bucket : buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+LatencyHistogram::Summary LatencyHistogram::Summarize() const {
+  // 先把格子拷出来，按拷贝算的分位数彼此一致
+  uint64_t counts[kBuckets];
+  uint64_t total = 0;
+  for (int i = 0; i < kBuckets; ++i) {
+    counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+
+  Summary summary;
+  summary.count = total;
+  if (total == 0) {
+    return summary;
+  }
+  summary.max_us = max_.load(std::memory_order_relaxed);
+  summary.mean_us =
+      static_cast<double>(sum_.load(std::memory_order_relaxed)) /
+      std::max<uint64_t>(count_.load(std::memory_order_relaxed), 1);
+
+  const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+  double* outputs[] = {&summary.p50_us, &summary.p90_us, &summary.p99_us,
+                       &summary.p999_us};
+  uint64_t seen = 0;
+  int q = 0;
+  for (int i = 0; i < kBuckets && q < 4; ++i) {
+    seen += counts[i];
+    while (q < 4 &&
+           seen >= static_cast<uint64_t>(std::ceil(quantiles[q] * total))) {
+      *outputs[q] = std::min(BucketValue(i), summary.max_us);
+      ++q;
+    }
+  }
+  return summary;
+}
+
+const char* PipelineStageName(PipelineStage stage) {
+  switch (stage) {
+    case PipelineStage::kPacketRead:
+      return "packet_read";
+    case PipelineStage::kVideoDecode:
+      return "video_decode";
+    case PipelineStage::kAudioDecode:
+      return "audio_decode";
+    case PipelineStage::kVideoQueueWait:
+      return "video_queue_wait";
+    case PipelineStage::kAudioQueueWait:
+      return "audio_queue_wait";
+    case PipelineStage::kConvert:
+      return "convert";
+    case PipelineStage::kDeliver:
+      return "deliver";
+    case PipelineStage::kPaint:
+      return "paint";
+    case PipelineStage::kAudioCallback:
+      return "audio_callback";
+    case PipelineStage::kCount:
+      break;
+  }
+  return "unknown";
+}
+
+void PipelineStats::Reset() {
+  for (auto& histogram : histograms_) {
+    histogram.Reset();
+  }
+}
+
+PipelineStats::Snapshot PipelineStats::GetSnapshot() const {
+  Snapshot snapshot;
+  for (int i = 0; i < kStages; ++i) {
+    snapshot.stages[i] = histograms_[i].Summarize();
+  }
+  return snapshot;
+}
+
+std::string PipelineStats::FormatSummary(const Snapshot& snapshot) {
+  std::string line;
+  for (int i = 0; i < kStages; ++i) {
+    const LatencyHistogram::Summary& s = snapshot.stages[i];
+    if (s.count == 0) {
+      continue;
+    }
+    line += fmt::format("{}{} {:.2f}/{:.2f}/{:.2f}", line.empty() ? "" : ", ",
+                        PipelineStageName(static_cast<PipelineStage>(i)),
+                        s.p50_us / 1000, s.p99_us / 1000, s.max_us / 1000);
+  }
+  return line;
+}
+
+std::string PipelineStats::ToJson(const Snapshot& snapshot) {
+  std::string json = "{";
+  for (int i = 0; i < kStages; ++i) {
+    const LatencyHistogram::Summary& s = snapshot.stages[i];
+    json += fmt::format(
+        "{}\"{}\": {{\"count\": {}, \"mean_us\": {:.1f}, \"p50_us\": {:.1f}, "
+        "\"p90_us\": {:.1f}, \"p99_us\": {:.1f}, \"p999_us\": {:.1f}, "
+        "\"max_us\": {:.1f}}}",
+        i == 0 ? "" : ", ", PipelineStageName(static_cast<PipelineStage>(i)),
+        s.count, s.mean_us, s.p50_us, s.p90_us, s.p99_us, s.p999_us,
+        s.max_us);
+  }
+  return json + "}";
+}
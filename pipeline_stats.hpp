@@ -0,0 +1,100 @@
+//
+//  pipeline_stats.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/27.
+//
+
+#ifndef pipeline_stats_hpp
+#define pipeline_stats_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// HDR 风格的延迟直方图：每个 2 的幂区间再等分 32 格，相对误差约 3%，
+// 覆盖 0 到约 12 天（微秒）。Record 只有几次 relaxed 原子操作，
+// 不加锁不分配，可以在音频回调里调用
+class LatencyHistogram {
+ public:
+  struct Summary {
+    uint64_t count = 0;
+    double mean_us = 0;
+    double p50_us = 0;
+    double p90_us = 0;
+    double p99_us = 0;
+    double p999_us = 0;
+    double max_us = 0;
+  };
+
+  LatencyHistogram() { Reset(); }
+
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  void Record(int64_t value_us);
+  // 和 Record 并发时结果可能缺几条，不会出错
+  void Reset();
+  Summary Summarize() const;
+
+ private:
+  static constexpr int kSubBits = 5;
+  static constexpr int kSubBuckets = 1 << kSubBits;
+  static constexpr int kMaxBits = 40;
+  static constexpr int kBuckets = (kMaxBits - kSubBits + 1) * kSubBuckets;
+
+  static int BucketIndex(uint64_t value);
+  // 格子里所有值的中点，用来代表这一格
+  static double BucketValue(int index);
+
+  std::atomic<uint64_t> buckets_[kBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+};
+
+// 一帧从读 packet 到上屏（声音到声卡）经过的各个阶段
+enum class PipelineStage {
+  kPacketRead,      // av_read_frame
+  kVideoDecode,     // 一个视频 packet 的 send/receive
+  kAudioDecode,     // 一个音频 packet 的 send/receive
+  kVideoQueueWait,  // 视频帧在 fq_ 里排队的时间
+  kAudioQueueWait,  // 音频帧在 afq_ 里排队的时间
+  kConvert,         // YUV -> RGB 转换和缩放
+  kDeliver,         // 转换完放进信箱到界面线程取走
+  kPaint,           // paintEvent
+  kAudioCallback,   // SDL 音频回调
+  kCount,
+};
+
+const char* PipelineStageName(PipelineStage stage);
+
+// 一个会话所有阶段的直方图
+class PipelineStats {
+ public:
+  static constexpr int kStages = static_cast<int>(PipelineStage::kCount);
+
+  void Record(PipelineStage stage, int64_t value_us) {
+    histograms_[static_cast<int>(stage)].Record(value_us);
+  }
+  // 交给只记一个阶段的模块（比如 StreamDecoder）
+  LatencyHistogram* histogram(PipelineStage stage) {
+    return &histograms_[static_cast<int>(stage)];
+  }
+  void Reset();
+
+  struct Snapshot {
+    LatencyHistogram::Summary stages[kStages];
+  };
+  Snapshot GetSnapshot() const;
+
+  // 一行日志：每个有数据的阶段的 p50/p99/max（毫秒）
+  static std::string FormatSummary(const Snapshot& snapshot);
+  // {"packet_read": {"count": .., "mean_us": .., ...}, ...}
+  static std::string ToJson(const Snapshot& snapshot);
+
+ private:
+  LatencyHistogram histograms_[kStages];
+};
+
+#endif /* pipeline_stats_hpp */
@@ -0,0 +1,141 @@
+//
+//  resource_budget.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/24.
+//
+
+#include "resource_budget.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <thread>
+
+static int DefaultCpuThreads() {
+  int cores = static_cast<int>(std::thread::hardware_concurrency());
+  return cores > 0 ? cores : 1;
+}
+
+ResourceBudget::ResourceBudget(int cpu_threads, uint64_t memory_bytes,
+                               uint64_t queue_bytes)
+    : cpu_threads_(cpu_threads > 0 ? cpu_threads : DefaultCpuThreads()),
+      memory_bytes_(memory_bytes),
+      queue_bytes_(queue_bytes) {}
+
+ResourceBudget& ResourceBudget::Shared() {
+  static ResourceBudget budget(0, kDefaultMemoryBytes);
+  return budget;
+}
+
+int ResourceBudget::Join(MemoryShareCallback on_memory_share) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int session = next_session_++;
+  sessions_[session] = std::move(on_memory_share);
+  session_count_ = sessions_.size();
+  RebalanceLocked();
+  return session;
+}
+
+void ResourceBudget::Leave(int session) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (sessions_.erase(session) > 0) {
+    session_count_ = sessions_.size();
+    RebalanceLocked();
+  }
+}
+
+int ResourceBudget::ThreadShare() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int sessions = std::max<int>(sessions_.size(), 1);
+  return std::max(cpu_threads_ / sessions, 1);
+}
+
+uint64_t ResourceBudget::MemoryShare() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return memory_bytes_ / std::max<size_t>(sessions_.size(), 1);
+}
+
+bool ResourceBudget::QueueOverBudget(uint64_t own_bytes) const {
+  if (queued_bytes_ <= queue_bytes_) {
+    return false;
+  }
+  // 只让占得多的会话让路，队列短的会话不被别人拖住
+  return own_bytes > queue_bytes_ / std::max(session_count_.load(), 1);
+}
+
+void ResourceBudget::RebalanceLocked() {
+  if (sessions_.empty()) {
+    return;
+  }
+  uint64_t share = memory_bytes_ / sessions_.size();
+  spdlog::info("resource budget: {} sessions, {} threads and {:.1f} MB each",
+               sessions_.size(),
+               std::max<int>(cpu_threads_ / sessions_.size(), 1),
+               share / 1048576.0);
+  for (const auto& session : sessions_) {
+    if (session.second) {
+      session.second(share);
+    }
+  }
+}
+
+FrameQueueBudget::Charge& FrameQueueBudget::Charge::operator=(
+    Charge&& other) noexcept {
+  if (this != &other) {
+    Release();
+    owner_ = other.owner_;
+    bytes_ = other.bytes_;
+    duration_us_ = other.duration_us_;
+    other.owner_ = nullptr;
+  }
+  return *this;
+}
+
+void FrameQueueBudget::Charge::Release() {
+  if (!owner_) {
+    return;
+  }
+  owner_->bytes_ -= bytes_;
+  owner_->duration_us_ -= duration_us_;
+  --owner_->frames_;
+  owner_->budget_->ChargeQueue(-static_cast<int64_t>(bytes_));
+  owner_ = nullptr;
+}
+
+void FrameQueueBudget::SetLimits(uint64_t max_bytes, double max_seconds) {
+  max_bytes_ = max_bytes;
+  max_duration_us_ = static_cast<int64_t>(max_seconds * 1000000);
+}
+
+void FrameQueueBudget::ResetPeaks() {
+  peak_bytes_ = bytes_.load();
+  peak_frames_ = frames_.load();
+}
+
+bool FrameQueueBudget::HasRoom() const {
+  if (frames_ == 0) {
+    return true;
+  }
+  return bytes_ < max_bytes_ && duration_us_ < max_duration_us_ &&
+         !budget_->QueueOverBudget(bytes_);
+}
+
+FrameQueueBudget::Charge FrameQueueBudget::Acquire(uint64_t bytes,
+                                                   int64_t duration_us) {
+  uint64_t total_bytes = bytes_ += bytes;
+  duration_us_ += duration_us;
+  uint64_t total_frames = ++frames_;
+  if (total_bytes > peak_bytes_) {
+    peak_bytes_ = total_bytes;
+  }
+  if (total_frames > peak_frames_) {
+    peak_frames_ = total_frames;
+  }
+  budget_->ChargeQueue(static_cast<int64_t>(bytes));
+  Charge charge;
+  charge.owner_ = this;
+  charge.bytes_ = bytes;
+  charge.duration_us_ = duration_us;
+  return charge;
+}
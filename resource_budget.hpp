@@ -0,0 +1,125 @@
+//
+//  resource_budget.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/24.
+//
+
+#ifndef resource_budget_hpp
+#define resource_budget_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <utility>
+
+// 多个播放会话共享的 CPU 和内存预算，在加入的会话之间平分。
+// CPU 按解码线程数算，会话打开解码器时取当时的份额；
+// 内存（GOP 缓存等）份额随会话加入/离开动态调整，通过回调通知每个会话。
+// 另外统计所有会话帧队列里的解码帧总量，超过 queue_bytes 时
+// 占得多的会话暂停解码和解封装
+class ResourceBudget {
+ public:
+  using MemoryShareCallback = std::function<void(uint64_t bytes)>;
+
+  // cpu_threads <= 0 表示按 CPU 核数
+  ResourceBudget(int cpu_threads, uint64_t memory_bytes,
+                 uint64_t queue_bytes = kDefaultQueueBytes);
+
+  ResourceBudget(const ResourceBudget&) = delete;
+  ResourceBudget& operator=(const ResourceBudget&) = delete;
+
+  // 进程默认的预算，所有没有指定预算的会话共用
+  static ResourceBudget& Shared();
+
+  // 加入后立即以当前份额回调一次，返回会话 id
+  int Join(MemoryShareCallback on_memory_share);
+  void Leave(int session);
+
+  // 每个会话可用的解码线程数，至少为 1
+  int ThreadShare();
+  uint64_t MemoryShare();
+  int cpu_threads() const { return cpu_threads_; }
+  uint64_t memory_bytes() const { return memory_bytes_; }
+
+  // 帧队列记账，bytes 为负表示归还。由 FrameQueueBudget 调用
+  void ChargeQueue(int64_t bytes) { queued_bytes_ += bytes; }
+  uint64_t queued_bytes() const { return queued_bytes_; }
+  uint64_t queue_bytes() const { return queue_bytes_; }
+  // 所有会话的帧队列总量超过 queue_bytes，并且 own_bytes 超过平均份额
+  bool QueueOverBudget(uint64_t own_bytes) const;
+
+  static constexpr uint64_t kDefaultMemoryBytes = 1ull << 30;
+  static constexpr uint64_t kDefaultQueueBytes = 512ull << 20;
+
+ private:
+  void RebalanceLocked();
+
+  const int cpu_threads_;
+  const uint64_t memory_bytes_;
+  const uint64_t queue_bytes_;
+  std::mutex mutex_;
+  int next_session_ = 1;
+  std::map<int, MemoryShareCallback> sessions_;
+  // 热路径上读，不拿锁
+  std::atomic<int> session_count_{0};
+  std::atomic<uint64_t> queued_bytes_{0};
+};
+
+// 一个帧队列按字节和媒体时长的上限，先到哪个算哪个。每帧入队时取一张
+// Charge 跟着帧走，帧出队、被 clear 丢掉或队列 reopen 时 Charge 析构，
+// 额度自动归还，同时记到进程级的 ResourceBudget 上
+class FrameQueueBudget {
+ public:
+  class Charge {
+   public:
+    Charge() = default;
+    Charge(Charge&& other) noexcept { *this = std::move(other); }
+    Charge& operator=(Charge&& other) noexcept;
+    ~Charge() { Release(); }
+
+    Charge(const Charge&) = delete;
+    Charge& operator=(const Charge&) = delete;
+
+   private:
+    friend class FrameQueueBudget;
+    void Release();
+
+    FrameQueueBudget* owner_ = nullptr;
+    uint64_t bytes_ = 0;
+    int64_t duration_us_ = 0;
+  };
+
+  explicit FrameQueueBudget(ResourceBudget* budget) : budget_(budget) {}
+
+  FrameQueueBudget(const FrameQueueBudget&) = delete;
+  FrameQueueBudget& operator=(const FrameQueueBudget&) = delete;
+
+  void SetLimits(uint64_t max_bytes, double max_seconds);
+  // 还能不能再放一帧。队列空时总能放，单帧超过上限（8K）也不会卡死
+  bool HasRoom() const;
+  Charge Acquire(uint64_t bytes, int64_t duration_us);
+
+  uint64_t bytes() const { return bytes_; }
+  double seconds() const { return duration_us_ / 1000000.0; }
+  uint64_t frames() const { return frames_; }
+  // 高水位：ResetPeaks 以来队列最多时的字节数和帧数
+  uint64_t peak_bytes() const { return peak_bytes_; }
+  uint64_t peak_frames() const { return peak_frames_; }
+  void ResetPeaks();
+
+ private:
+  ResourceBudget* budget_;
+  std::atomic<uint64_t> max_bytes_{0};
+  std::atomic<int64_t> max_duration_us_{0};
+  std::atomic<uint64_t> bytes_{0};
+  std::atomic<int64_t> duration_us_{0};
+  std::atomic<uint64_t> frames_{0};
+  // 只有 Acquire（生产者）更新
+  std::atomic<uint64_t> peak_bytes_{0};
+  std::atomic<uint64_t> peak_frames_{0};
+};
+
+#endif /* resource_budget_hpp */
@@ -0,0 +1,300 @@
+#ifndef SPSC_QUEUE_
+#define SPSC_QUEUE_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// 单生产者单消费者的有界无锁环形队列，接口语义和 BlockingQueue 一致。
+// push/tryPush 只能在一个线程调用，pop/popOrEmpty 只能在另一个线程调用
+// （同一个 TaskStrand 上的任务算同一个线程）；
+// lock/unlock/clear/close 可以在任意线程调用。
+// 快路径只有原子读写，只有队列满/空/被 lock 时才会在条件变量上睡眠，
+// 所以 popOrEmpty 可以放心在实时音频线程里调用，永远不会阻塞。
+template <typename T>
+class SpscQueue {
+ public:
+  explicit SpscQueue(size_t max_length)
+      : max_length_(max_length > 0 ? max_length : 1),
+        slots_(RoundUpPowerOfTwo(max_length_)),
+        mask_(slots_.size() - 1) {}
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  // 队列满或被 lock 时阻塞；close 之后直接丢弃
+  void push(const T& value) {
+    if (closed_.load(std::memory_order_acquire)) {
+      return;
+    }
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (!CanPush(tail)) {
+      if (!WaitForSpace(tail)) {
+        return;
+      }
+    }
+    slots_[tail & mask_] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    WakeConsumer();
+  }
+
+  // 不阻塞的 push：队列满或被 lock 时返回 false，调用方稍后重试；
+  // close 之后直接丢弃并返回 true
+  bool tryPush(const T& value) {
+    if (closed_.load(std::memory_order_acquire)) {
+      return true;
+    }
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (!CanPush(tail)) {
+      return false;
+    }
+    slots_[tail & mask_] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    WakeConsumer();
+    return true;
+  }
+
+  // 只能移动的元素用这个；返回 false 时 value 保持原样
+  bool tryPush(T&& value) {
+    if (closed_.load(std::memory_order_acquire)) {
+      return true;
+    }
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (!CanPush(tail)) {
+      return false;
+    }
+    slots_[tail & mask_] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    WakeConsumer();
+    return true;
+  }
+
+  std::optional<T> popOrEmpty() {
+    if (closed_.load(std::memory_order_acquire)) {
+      return {};
+    }
+    // 被 lock 时也先释放 clear 掉的元素，生产者能看到空间
+    size_t head = DiscardCleared();
+    if (locked_.load(std::memory_order_acquire) ||
+        head == tail_.load(std::memory_order_acquire)) {
+      return {};
+    }
+    return Take(head);
+  }
+
+  // 队列空或被 lock 时阻塞；close 之后返回 T()
+  T pop() {
+    size_t head = DiscardCleared();
+    // 醒来后到这里之间可能又被别的线程 clear 掉，要重新确认还有元素
+    while (!CanPop(head)) {
+      if (!WaitForData()) {
+        return T();
+      }
+      head = DiscardCleared();
+    }
+    return Take(head);
+  }
+
+  // 只能在消费者线程调用：释放被 clear 掉的元素、腾出空间，不取新元素。
+  // 消费者暂时不取（比如暂停）时用，不然 clear 的空间要等到下次 pop
+  void reclaim() { DiscardCleared(); }
+
+  bool empty() const { return size() == 0; }
+
+  size_t size() const {
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t cleared = clear_until_.load(std::memory_order_acquire);
+    if (cleared > head) {
+      head = cleared;
+    }
+    return tail > head ? tail - head : 0;
+  }
+
+  // 丢弃调用时刻队列里已有的元素。实际的析构由消费者线程在下次 pop 时完成，
+  // 这样清空操作也不会和消费者抢同一个槽位
+  void clear() {
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t cleared = clear_until_.load(std::memory_order_relaxed);
+    while (cleared < tail &&
+           !clear_until_.compare_exchange_weak(cleared, tail,
+                                               std::memory_order_acq_rel)) {
+    }
+  }
+
+  void lock() { locked_.store(true, std::memory_order_release); }
+
+  void unlock() {
+    locked_.store(false, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+  // 唤醒并放走所有等待者：之后 push 直接丢弃，pop 返回 T()
+  void close() {
+    closed_.store(true, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+  // 重新打开并丢掉残留元素，调用时不能有生产者或消费者在用这个队列
+  void reopen() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    for (size_t i = head_.load(std::memory_order_relaxed); i < tail; ++i) {
+      slots_[i & mask_] = T();
+    }
+    head_.store(tail, std::memory_order_relaxed);
+    cached_head_ = tail;
+    cached_tail_ = tail;
+    clear_until_.store(tail, std::memory_order_relaxed);
+    locked_.store(false, std::memory_order_relaxed);
+    closed_.store(false, std::memory_order_release);
+  }
+
+ private:
+  static constexpr size_t kCacheLine = 64;
+  static constexpr int kSpinCount = 64;
+
+  static size_t RoundUpPowerOfTwo(size_t n) {
+    size_t size = 1;
+    while (size < n) {
+      size <<= 1;
+    }
+    return size;
+  }
+
+  bool CanPush(size_t tail) {
+    if (locked_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    // 先看缓存的 head，只有看起来满了才去读消费者那条 cache line
+    if (tail - cached_head_ < max_length_) {
+      return true;
+    }
+    cached_head_ = head_.load(std::memory_order_acquire);
+    return tail - cached_head_ < max_length_;
+  }
+
+  bool CanPop(size_t head) {
+    if (locked_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    if (head < cached_tail_) {
+      return true;
+    }
+    cached_tail_ = tail_.load(std::memory_order_acquire);
+    return head < cached_tail_;
+  }
+
+  // 慢路径：先短暂自旋，再睡眠
+  bool WaitForSpace(size_t tail) {
+    for (int i = 0; i < kSpinCount; ++i) {
+      if (closed_.load(std::memory_order_acquire)) {
+        return false;
+      }
+      if (CanPush(tail)) {
+        return true;
+      }
+      std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    producer_waiting_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    not_full_.wait(lock, [this, tail] {
+      return closed_.load(std::memory_order_acquire) || CanPush(tail);
+    });
+    producer_waiting_.store(false, std::memory_order_relaxed);
+    return !closed_.load(std::memory_order_acquire);
+  }
+
+  bool WaitForData() {
+    for (int i = 0; i < kSpinCount; ++i) {
+      if (closed_.load(std::memory_order_acquire)) {
+        return false;
+      }
+      if (CanPop(DiscardCleared())) {
+        return true;
+      }
+      std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    consumer_waiting_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    not_empty_.wait(lock, [this] {
+      return closed_.load(std::memory_order_acquire) ||
+             CanPop(DiscardCleared());
+    });
+    consumer_waiting_.store(false, std::memory_order_relaxed);
+    return !closed_.load(std::memory_order_acquire);
+  }
+
+  void WakeConsumer() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (consumer_waiting_.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(wait_mutex_);
+      not_empty_.notify_one();
+    }
+  }
+
+  void WakeProducer() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (producer_waiting_.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(wait_mutex_);
+      not_full_.notify_one();
+    }
+  }
+
+  // 只在消费者线程调用：释放被 clear 掉的元素，返回新的 head
+  size_t DiscardCleared() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t cleared = clear_until_.load(std::memory_order_acquire);
+    if (head >= cleared) {
+      return head;
+    }
+    for (; head < cleared; ++head) {
+      slots_[head & mask_] = T();
+    }
+    head_.store(head, std::memory_order_release);
+    WakeProducer();
+    return head;
+  }
+
+  T Take(size_t head) {
+    T value = std::move(slots_[head & mask_]);
+    slots_[head & mask_] = T();
+    head_.store(head + 1, std::memory_order_release);
+    WakeProducer();
+    return value;
+  }
+
+  const size_t max_length_;
+  std::vector<T> slots_;
+  const size_t mask_;
+
+  // 消费者写
+  alignas(kCacheLine) std::atomic<size_t> head_{0};
+  size_t cached_tail_ = 0;
+  // 生产者写
+  alignas(kCacheLine) std::atomic<size_t> tail_{0};
+  size_t cached_head_ = 0;
+  // 控制面，低频
+  alignas(kCacheLine) std::atomic<size_t> clear_until_{0};
+  std::atomic<bool> locked_{false};
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> producer_waiting_{false};
+  std::atomic<bool> consumer_waiting_{false};
+  std::mutex wait_mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+};
+
+#endif
@@ -0,0 +1,331 @@
+//
+//  stream_decoder.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/10.
+//
+
+#include "stream_decoder.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <queue>
+#include <thread>
+
+extern "C" {
+#include <libavutil/dict.h>
+#include <libavutil/time.h>
+}
+
+// packet 队列里的控制标记，按指针区分
+static const AVPacketPtr& EofMarker() {
+  static const AVPacketPtr marker = createAVPacketPtr();
+  return marker;
+}
+
+static const AVPacketPtr& FlushMarker() {
+  static const AVPacketPtr marker = createAVPacketPtr();
+  return marker;
+}
+
+// 一个解码任务最多处理这么多 packet 就让出工作线程，别的会话能插进来
+static const int kMaxPacketsPerRun = 8;
+
+// 超过 16 个线程 libavcodec 的大多数解码器已经没有收益，还会告警
+static const int kMaxAutoThreads = 16;
+
+int DecoderOptions::ResolvedThreadCount() const {
+  if (thread_count > 0) {
+    return thread_count;
+  }
+  int cores = static_cast<int>(std::thread::hardware_concurrency());
+  if (cores <= 0) {
+    return 1;
+  }
+  return std::min(cores, kMaxAutoThreads);
+}
+
+StreamDecoder::StreamDecoder(std::string name, FramePool* frame_pool,
+                             FrameCopyMeter* copy_meter, size_t max_packets,
+                             TaskPriority priority, TaskScheduler* scheduler)
+    : name_(std::move(name)),
+      frame_pool_(frame_pool),
+      copy_meter_(copy_meter),
+      frame_(createAVFramePtr()),
+      packets_(max_packets),
+      strand_(scheduler, priority) {}
+
+StreamDecoder::~StreamDecoder() {
+  Abort();
+  Join();
+  avcodec_free_context(&codec_ctx_);
+}
+
+AVCodecContext* OpenCodecContext(const std::string& name,
+                                 const AVStream* stream,
+                                 const DecoderOptions& options) {
+  const AVCodec* codec = avcodec_find_decoder(stream->codecpar->codec_id);
+  if (!codec) {
+    spdlog::error("{}: decoder not found", name);
+    return nullptr;
+  }
+
+  AVCodecContext* codec_ctx = avcodec_alloc_context3(codec);
+  if (!codec_ctx ||
+      avcodec_parameters_to_context(codec_ctx, stream->codecpar) < 0) {
+    spdlog::error("{}: could not init codec context", name);
+    avcodec_free_context(&codec_ctx);
+    return nullptr;
+  }
+  codec_ctx->pkt_timebase = stream->time_base;
+  codec_ctx->thread_count = options.ResolvedThreadCount();
+  switch (options.thread_type) {
+    case DecoderOptions::ThreadType::kFrame:
+      codec_ctx->thread_type = FF_THREAD_FRAME;
+      break;
+    case DecoderOptions::ThreadType::kSlice:
+      codec_ctx->thread_type = FF_THREAD_SLICE;
+      break;
+    case DecoderOptions::ThreadType::kAuto:
+      codec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+      break;
+  }
+
+  AVDictionary* codec_opts = NULL;
+  for (const auto& kv : options.codec_options) {
+    av_dict_set(&codec_opts, kv.first.c_str(), kv.second.c_str(), 0);
+  }
+  int ret = avcodec_open2(codec_ctx, codec, &codec_opts);
+  AVDictionaryEntry* unused = NULL;
+  while ((unused = av_dict_get(codec_opts, "", unused,
+                               AV_DICT_IGNORE_SUFFIX))) {
+    spdlog::warn("{}: unknown decoder option {}", name, unused->key);
+  }
+  av_dict_free(&codec_opts);
+  if (ret < 0) {
+    spdlog::error("{}: could not open codec", name);
+    avcodec_free_context(&codec_ctx);
+    return nullptr;
+  }
+
+  // thread_type 打开后才是解码器实际采用的模式
+  spdlog::info("{}: {} threads={} type={}", name, codec->name,
+               codec_ctx->thread_count,
+               (codec_ctx->active_thread_type & FF_THREAD_FRAME)   ? "frame"
+               : (codec_ctx->active_thread_type & FF_THREAD_SLICE) ? "slice"
+                                                                   : "none");
+  return codec_ctx;
+}
+
+bool StreamDecoder::Open(const AVStream* stream,
+                         const DecoderOptions& options) {
+  codec_ctx_ = OpenCodecContext(name_, stream, options);
+  if (!codec_ctx_) {
+    return false;
+  }
+  time_base_ = stream->time_base;
+  return true;
+}
+
+void StreamDecoder::Start(FrameCallback on_frame) {
+  on_frame_ = std::move(on_frame);
+  abort_ = false;
+  {
+    std::lock_guard<std::mutex> lock(finish_mutex_);
+    finished_ = false;
+  }
+  started_ = true;
+}
+
+void StreamDecoder::PushPacket(AVPacketPtr packet) {
+  if (packet) {
+    packets_.push(std::move(packet));
+    Schedule();
+  }
+}
+
+void StreamDecoder::set_quality(const DecodeQualitySettings& settings) {
+  quality_skip_frame_ = settings.skip_frame;
+  skip_loop_filter_ = settings.skip_loop_filter;
+  skip_idct_ = settings.skip_idct;
+}
+
+void StreamDecoder::PushEof() {
+  packets_.push(EofMarker());
+  Schedule();
+}
+
+void StreamDecoder::Finish() {
+  packets_.push(nullptr);
+  Schedule();
+}
+
+void StreamDecoder::Flush() {
+  // 先标记，解码任务手上正在解的 packet 立刻停止交帧
+  ++flush_requests_;
+  packets_.clear();
+  packets_.push(FlushMarker());
+  Schedule();
+}
+
+void StreamDecoder::DropPackets() {
+  // 标记丢了 serial_ 就追不上 flush_requests_，也停不下来
+  packets_.remove_if([](const AVPacketPtr& packet) {
+    return packet && packet != FlushMarker() && packet != EofMarker();
+  });
+}
+
+void StreamDecoder::Abort() {
+  abort_ = true;
+  std::queue<AVPacketPtr> abort_q;
+  abort_q.push(nullptr);
+  packets_.replace(abort_q);
+  Schedule();
+}
+
+void StreamDecoder::Join() {
+  if (started_) {
+    std::unique_lock<std::mutex> lock(finish_mutex_);
+    finish_cv_.wait(lock, [this] { return finished_; });
+  }
+  strand_.WaitIdle();
+}
+
+void StreamDecoder::Wake() { Schedule(); }
+
+void StreamDecoder::Schedule() {
+  if (started_ && !scheduled_.exchange(true)) {
+    strand_.Post([this] { Run(); });
+  }
+}
+
+void StreamDecoder::Run() {
+  // 先清标记：从这里开始的 Push/Wake 都会再排一次，不会漏
+  scheduled_ = false;
+  {
+    std::lock_guard<std::mutex> lock(finish_mutex_);
+    if (finished_) {
+      return;
+    }
+  }
+
+  for (int handled = 0; !abort_; ++handled) {
+    if (!DeliverFrames()) {
+      return;  // 下游满了，等 Wake
+    }
+    if (eof_pending_) {
+      eof_pending_ = false;
+      if (!FlushPending()) {
+        eof_serial_ = serial_.load();
+      }
+    }
+    if (finishing_) {
+      MarkFinished();
+      return;
+    }
+    if (handled == kMaxPacketsPerRun) {
+      Schedule();
+      return;
+    }
+    std::optional<AVPacketPtr> packet = packets_.popOrEmpty();
+    if (!packet) {
+      return;  // 等 PushPacket
+    }
+
+    if (!*packet) {
+      // Finish：drain 完，帧都交出去之后结束
+      Decode(nullptr);
+      avcodec_flush_buffers(codec_ctx_);
+      finishing_ = true;
+    } else if (*packet == FlushMarker()) {
+      avcodec_flush_buffers(codec_ctx_);
+      ready_frames_.clear();
+      eof_pending_ = false;
+      ++serial_;
+    } else if (*packet == EofMarker()) {
+      Decode(nullptr);  // drain
+      avcodec_flush_buffers(codec_ctx_);
+      eof_pending_ = true;
+    } else {
+      // 只在 strand 上改 codec_ctx_，不和解码抢
+      codec_ctx_->skip_frame = static_cast<AVDiscard>(
+          std::max(skip_frame_.load(), quality_skip_frame_.load()));
+      codec_ctx_->skip_loop_filter =
+          static_cast<AVDiscard>(skip_loop_filter_.load());
+      codec_ctx_->skip_idct = static_cast<AVDiscard>(skip_idct_.load());
+      Decode(packet->get());
+    }
+  }
+
+  ready_frames_.clear();
+  MarkFinished();
+}
+
+bool StreamDecoder::DeliverFrames() {
+  if (FlushPending()) {
+    // 这些帧属于 Flush 之前的位置
+    ready_frames_.clear();
+    return true;
+  }
+  while (!ready_frames_.empty()) {
+    if (!on_frame_(ready_frames_.front())) {
+      return false;
+    }
+    ready_frames_.pop_front();
+  }
+  return true;
+}
+
+void StreamDecoder::MarkFinished() {
+  spdlog::info("{}: decoder finished", name_);
+  std::lock_guard<std::mutex> lock(finish_mutex_);
+  finished_ = true;
+  finish_cv_.notify_all();
+}
+
+void StreamDecoder::Decode(const AVPacket* packet) {
+  uint64_t copied_bytes = 0;
+  int64_t spent_us = 0;
+  bool packet_sent = false;
+  while (!packet_sent && !abort_ && !FlushPending()) {
+    int64_t start_us = av_gettime_relative();
+    int ret = avcodec_send_packet(codec_ctx_, packet);
+    spent_us += av_gettime_relative() - start_us;
+    if (ret == 0 || ret == AVERROR_EOF) {
+      packet_sent = true;
+    } else if (ret != AVERROR(EAGAIN)) {
+      spdlog::warn("{}: avcodec_send_packet error {}", name_, ret);
+      break;
+    }
+
+    // 一个 packet 可能解出多帧；EAGAIN 时也要先把输出取空再重发
+    while (!abort_ && !FlushPending()) {
+      start_us = av_gettime_relative();
+      ret = avcodec_receive_frame(codec_ctx_, frame_.get());
+      spent_us += av_gettime_relative() - start_us;
+      if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+        break;
+      }
+      if (ret < 0) {
+        spdlog::warn("{}: avcodec_receive_frame error {}", name_, ret);
+        break;
+      }
+
+      ++decoded_frames_;
+      AVFramePtr frame = frame_pool_->MoveRef(frame_.get(), &copied_bytes);
+      if (frame) {
+        ready_frames_.push_back(std::move(frame));
+      }
+    }
+  }
+
+  decode_time_us_ += spent_us;
+  if (latency_) {
+    latency_->Record(spent_us);
+  }
+  if (copied_bytes > 0) {
+    copy_meter_->Add(copied_bytes);
+  }
+}
@@ -0,0 +1,197 @@
+//
+//  stream_decoder.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/10.
+//
+
+#ifndef stream_decoder_hpp
+#define stream_decoder_hpp
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "blocking_queue.h"
+#include "decode_quality.hpp"
+#include "frame_pool.hpp"
+#include "local_file_io.hpp"
+#include "pipeline_stats.hpp"
+#include "task_scheduler.hpp"
+
+struct AVPacketDeleter {
+  void operator()(AVPacket* packet) const {
+    if (packet) {
+      av_packet_free(&packet);
+    }
+  }
+};
+
+using AVPacketPtr = std::shared_ptr<AVPacket>;
+
+inline AVPacketPtr createAVPacketPtr() {
+  return AVPacketPtr(av_packet_alloc(), AVPacketDeleter());
+}
+
+// 解码器配置，由 VideoCodec::StartCodec 传入
+struct DecoderOptions {
+  enum class ThreadType {
+    kAuto,   // 交给 libavcodec 选择，帧并行优先
+    kFrame,  // 帧级并行，吞吐高，但会多出 thread_count - 1 帧延迟
+    kSlice,  // slice 级并行，无额外延迟，依赖码流按 slice 编码
+  };
+
+  // 0 表示按 CPU 核数自动选择
+  int thread_count = 0;
+  ThreadType thread_type = ThreadType::kAuto;
+  // 原样透传给 avcodec_open2 的 AVDictionary，例如 {"flags2", "+fast"}
+  std::map<std::string, std::string> codec_options;
+
+  // 后退逐帧、倒放时缓存解码帧的预算（字节），还受会话共享的内存预算限制
+  uint64_t gop_cache_bytes = 256ull << 20;
+  // false 时不解音频，视频按墙上时钟播。多路同屏时只留一路声音
+  bool decode_audio = true;
+
+  // 本地文件怎么读，以及 mmap 预取窗口/预读环的大小
+  FileIoMode file_io = FileIoMode::kAuto;
+  size_t read_ahead_bytes = 32 << 20;
+
+  // 解码后帧队列的上限，按帧实际的 buffer 大小和媒体时长算，先到哪个算哪个。
+  // 所有会话帧队列的总量另外受 ResourceBudget 限制
+  uint64_t video_queue_bytes = 64ull << 20;
+  double video_queue_seconds = 1.0;
+  uint64_t audio_queue_bytes = 4ull << 20;
+  double audio_queue_seconds = 2.0;
+
+  // 快速启动：avformat_find_stream_info 只读很少的数据、分析很短的时长。
+  // 本地 MP4/MOV 的参数都在 moov 里，够用；裸流、TS 之类可能探测不全
+  bool fast_start = false;
+  // false 时不按时间戳排期，解出来就送显、一帧不丢，无界面跑性能时用
+  bool paced = true;
+  // 解码跟不上时自动降低解码质量（跳帧、跳环路滤波），见
+  // DecodeQualityController
+  bool adaptive_quality = true;
+
+  // 把 thread_count = 0 换算成实际线程数
+  int ResolvedThreadCount() const;
+};
+
+// 按 options 创建并打开 stream 的解码器，失败返回 nullptr。name 只用于日志
+AVCodecContext* OpenCodecContext(const std::string& name,
+                                 const AVStream* stream,
+                                 const DecoderOptions& options);
+
+// 单条流的解码器：自己持有一个有界的 packet 队列，解码跑在共享
+// TaskScheduler 的一个 strand 上，不占专门的线程。
+// 解封装线程往里塞 packet，每次塞入都会排一个解码任务，任务里跑完整的
+// send/receive 循环，收到 EOF 时把解码器里剩余的帧全部 drain 出来。
+// 下游收不下时解出的帧先留在这里，任务退出，等下游 Wake 之后再接着投。
+// seek 时 Flush 丢掉排队的 packet 并清空解码器内部状态，不用重建。
+class StreamDecoder {
+ public:
+  // 返回 false 表示下游暂时收不下，这一帧留着，Wake 之后用同一帧再调一次
+  using FrameCallback = std::function<bool(const AVFramePtr&)>;
+
+  StreamDecoder(std::string name, FramePool* frame_pool,
+                FrameCopyMeter* copy_meter, size_t max_packets,
+                TaskPriority priority = TaskPriority::kNormal,
+                TaskScheduler* scheduler = &TaskScheduler::Shared());
+  ~StreamDecoder();
+
+  StreamDecoder(const StreamDecoder&) = delete;
+  StreamDecoder& operator=(const StreamDecoder&) = delete;
+
+  bool Open(const AVStream* stream, const DecoderOptions& options);
+  void Start(FrameCallback on_frame);
+
+  // 队列满时阻塞，起到对解封装线程的背压作用
+  void PushPacket(AVPacketPtr packet);
+  // 通知流结束，drain 完后继续接收 packet（之后可能 seek 回去）
+  void PushEof();
+  // 通知流结束，drain 完并把帧都交出去之后结束
+  void Finish();
+  // 丢弃未解码的 packet 和解码器里缓存的帧，之后 Push 的 packet 从新位置开始。
+  // 和 PushPacket 在同一个线程调用。Flush 生效前解出的帧不再回调
+  void Flush();
+  // 丢掉排队还没解的 packet（Flush/EOF/Finish 标记留着），放走阻塞在
+  // PushPacket 上的解封装线程。任意线程调用，seek 时用
+  void DropPackets();
+  // 丢弃未解码的 packet 和没交出去的帧，尽快结束
+  void Abort();
+  // 等到 Finish/Abort 生效、解码任务都跑完
+  void Join();
+  // 下游腾出了空间，接着投之前没收下的帧、继续解码。任意线程调用
+  void Wake();
+
+  AVRational time_base() const { return time_base_; }
+  // 已经生效的 Flush 次数。在帧回调里读，就是这一帧所属的 seek 批次
+  int serial() const { return serial_; }
+  uint64_t decoded_frames() const { return decoded_frames_; }
+  // 最近一次 PushEof 之前的帧都已经交给下游，之后也没有 Flush
+  bool eof_drained() const { return eof_serial_ == flush_requests_; }
+  // 花在 avcodec_send_packet/avcodec_receive_frame 上的累计时间
+  int64_t decode_time_us() const { return decode_time_us_; }
+  // 解码器跳过哪些帧（AVCodecContext::skip_frame），快放时用。
+  // 任意线程调用，从下一个 packet 起生效
+  void set_skip_frame(AVDiscard discard) { skip_frame_ = discard; }
+  // 负载自适应的解码质量，和 set_skip_frame 取更激进的那个。任意线程调用，
+  // 从下一个 packet 起生效
+  void set_quality(const DecodeQualitySettings& settings);
+  // 每个 packet 的解码耗时记到 histogram 里，Start 之前设置
+  void set_latency_histogram(LatencyHistogram* histogram) {
+    latency_ = histogram;
+  }
+
+ private:
+  // 排一个解码任务，已经排着的话不重复排
+  void Schedule();
+  // 以下只在 strand_ 上运行
+  void Run();
+  void Decode(const AVPacket* packet);
+  // 把 ready_frames_ 交给下游，全部交完返回 true
+  bool DeliverFrames();
+  void MarkFinished();
+  bool FlushPending() const { return serial_ != flush_requests_; }
+
+  std::string name_;
+  FramePool* frame_pool_;
+  FrameCopyMeter* copy_meter_;
+  AVCodecContext* codec_ctx_ = nullptr;
+  AVRational time_base_{0, 1};
+  AVFramePtr frame_;  // avcodec_receive_frame 的接收帧，复用
+  BlockingQueue<AVPacketPtr> packets_;
+  FrameCallback on_frame_;
+  std::deque<AVFramePtr> ready_frames_;  // 解出来还没交出去的帧
+  bool finishing_ = false;
+  bool eof_pending_ = false;  // drain 出来的帧还没交完
+  std::atomic<bool> started_{false};
+  std::atomic<bool> scheduled_{false};
+  std::atomic<bool> abort_{false};
+  std::atomic<int> flush_requests_{0};
+  std::atomic<int> serial_{0};
+  std::atomic<int> eof_serial_{-1};  // 最近一次 drain 完时的 serial_
+  std::atomic<uint64_t> decoded_frames_{0};
+  std::atomic<int64_t> decode_time_us_{0};
+  LatencyHistogram* latency_ = nullptr;
+  std::atomic<int> skip_frame_{AVDISCARD_DEFAULT};
+  std::atomic<int> quality_skip_frame_{AVDISCARD_DEFAULT};
+  std::atomic<int> skip_loop_filter_{AVDISCARD_DEFAULT};
+  std::atomic<int> skip_idct_{AVDISCARD_DEFAULT};
+  std::mutex finish_mutex_;
+  std::condition_variable finish_cv_;
+  bool finished_ = false;
+  TaskStrand strand_;
+};
+
+#endif /* stream_decoder_hpp */
@@ -0,0 +1,319 @@
+//
+//  task_scheduler.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/25.
+//
+
+#include "task_scheduler.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+static const int64_t kNoDeadline = std::numeric_limits<int64_t>::max();
+
+// 当前线程所属的调度器和工作线程序号，外部线程为空
+static thread_local const TaskScheduler* tls_scheduler = nullptr;
+static thread_local size_t tls_worker = 0;
+
+static int64_t NowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static std::atomic<int> configured_threads{0};
+static std::atomic<bool> shared_created{false};
+
+bool TaskScheduler::Configure(int threads) {
+  if (shared_created) {
+    spdlog::warn("task scheduler already running, --workers {} ignored",
+                 threads);
+    return false;
+  }
+  configured_threads = threads;
+  return true;
+}
+
+TaskScheduler& TaskScheduler::Shared() {
+  static TaskScheduler scheduler([] {
+    shared_created = true;
+    return configured_threads.load();
+  }());
+  return scheduler;
+}
+
+TaskScheduler::TaskScheduler(int threads) : next_due_us_(kNoDeadline) {
+  if (threads <= 0) {
+    threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+  }
+  for (int i = 0; i < threads; ++i) {
+    workers_.emplace_back(new Worker);
+  }
+  sampled_us_ = NowUs();
+  // 队列都建好之后再起线程，偷任务时会遍历所有 worker
+  for (int i = 0; i < threads; ++i) {
+    workers_[i]->thread = std::thread(&TaskScheduler::WorkerLoop, this, i);
+  }
+  spdlog::info("task scheduler: {} workers", threads);
+}
+
+TaskScheduler::~TaskScheduler() {
+  std::vector<DelayedTask> dropped;
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    stopping_ = true;
+    dropped.swap(delayed_);
+    next_due_us_ = kNoDeadline;
+    idle_cv_.notify_all();
+  }
+  // 不持锁回调：strand 要借此归还计数，WaitIdle 才不会一直等
+  for (DelayedTask& task : dropped) {
+    if (task.on_drop) {
+      task.on_drop();
+    }
+  }
+  for (auto& worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+void TaskScheduler::Submit(Task task, TaskPriority priority) {
+  size_t index = tls_scheduler == this
+                     ? tls_worker
+                     : next_worker_.fetch_add(1, std::memory_order_relaxed) %
+                           workers_.size();
+  Push(index, std::move(task), priority);
+}
+
+bool TaskScheduler::SubmitAfter(int64_t delay_us, Task task,
+                                TaskPriority priority, Task on_drop) {
+  if (delay_us <= 0) {
+    Submit(std::move(task), priority);
+    return true;
+  }
+  int64_t due_us = NowUs() + delay_us;
+  std::lock_guard<std::mutex> lock(idle_mutex_);
+  if (stopping_) {
+    return false;
+  }
+  delayed_.push_back({due_us, delayed_seq_++, priority, std::move(task),
+                      std::move(on_drop)});
+  std::push_heap(delayed_.begin(), delayed_.end(), LaterFirst());
+  if (due_us < next_due_us_) {
+    next_due_us_ = due_us;
+    // 睡着的线程按旧的最早期限定了闹钟，叫醒一个重新算
+    idle_cv_.notify_one();
+  }
+  return true;
+}
+
+void TaskScheduler::Push(size_t index, Task task, TaskPriority priority) {
+  Worker& worker = *workers_[index];
+  {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.queues[static_cast<int>(priority)].push_back(std::move(task));
+  }
+  ready_.fetch_add(1, std::memory_order_seq_cst);
+  WakeOne();
+}
+
+void TaskScheduler::WakeOne() {
+  // 和 WorkerLoop 里先加 sleeping_ 再看 ready_ 配对，两边至少有一边看得到对方
+  if (sleeping_.load(std::memory_order_seq_cst) > 0) {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    idle_cv_.notify_one();
+  }
+}
+
+bool TaskScheduler::FindTask(size_t index, Task* task) {
+  size_t count = workers_.size();
+  for (int level = 0; level < kPriorityLevels; ++level) {
+    {
+      Worker& own = *workers_[index];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      std::deque<Task>& queue = own.queues[level];
+      if (!queue.empty()) {
+        *task = std::move(queue.back());
+        queue.pop_back();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < count; ++i) {
+      Worker& victim = *workers_[(index + i) % count];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      std::deque<Task>& queue = victim.queues[level];
+      if (!queue.empty()) {
+        *task = std::move(queue.front());
+        queue.pop_front();
+        workers_[index]->steals.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void TaskScheduler::PromoteDueTasks(size_t index) {
+  int64_t now_us = NowUs();
+  if (now_us < next_due_us_.load(std::memory_order_acquire)) {
+    return;
+  }
+  std::vector<DelayedTask> due;
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    while (!delayed_.empty() && delayed_.front().due_us <= now_us) {
+      std::pop_heap(delayed_.begin(), delayed_.end(), LaterFirst());
+      due.push_back(std::move(delayed_.back()));
+      delayed_.pop_back();
+    }
+    next_due_us_ = delayed_.empty() ? kNoDeadline : delayed_.front().due_us;
+  }
+  for (DelayedTask& task : due) {
+    Push(index, std::move(task.task), task.priority);
+  }
+}
+
+void TaskScheduler::WorkerLoop(size_t index) {
+  tls_scheduler = this;
+  tls_worker = index;
+  Worker& worker = *workers_[index];
+
+  while (true) {
+    PromoteDueTasks(index);
+    Task task;
+    if (FindTask(index, &task)) {
+      ready_.fetch_sub(1, std::memory_order_relaxed);
+      int64_t start_us = NowUs();
+      task();
+      task = nullptr;  // 捕获的对象也算在这个任务的时间里
+      worker.busy_us.fetch_add(NowUs() - start_us, std::memory_order_relaxed);
+      worker.tasks.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    if (stopping_ && ready_.load() <= 0) {
+      break;
+    }
+    sleeping_.fetch_add(1, std::memory_order_seq_cst);
+    if (ready_.load(std::memory_order_seq_cst) <= 0) {
+      int64_t due_us = next_due_us_.load(std::memory_order_relaxed);
+      if (due_us == kNoDeadline) {
+        idle_cv_.wait(lock);
+      } else if (due_us > NowUs()) {
+        idle_cv_.wait_until(lock, std::chrono::steady_clock::time_point(
+                                      std::chrono::microseconds(due_us)));
+      }
+    }
+    sleeping_.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+std::vector<TaskScheduler::WorkerStats> TaskScheduler::GetWorkerStats() {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  int64_t now_us = NowUs();
+  int64_t elapsed_us = std::max<int64_t>(now_us - sampled_us_, 1);
+  sampled_us_ = now_us;
+
+  std::vector<WorkerStats> stats;
+  for (auto& worker : workers_) {
+    int64_t busy_us = worker->busy_us.load(std::memory_order_relaxed);
+    WorkerStats item;
+    item.tasks = worker->tasks.load(std::memory_order_relaxed);
+    item.steals = worker->steals.load(std::memory_order_relaxed);
+    item.utilization = std::min(
+        static_cast<double>(busy_us - worker->sampled_busy_us) / elapsed_us,
+        1.0);
+    worker->sampled_busy_us = busy_us;
+    stats.push_back(item);
+  }
+  return stats;
+}
+
+double TaskScheduler::MeanUtilization(const std::vector<WorkerStats>& stats) {
+  if (stats.empty()) {
+    return 0;
+  }
+  double sum = 0;
+  for (const WorkerStats& item : stats) {
+    sum += item.utilization;
+  }
+  return sum / stats.size();
+}
+
+TaskStrand::TaskStrand(TaskScheduler* scheduler, TaskPriority priority)
+    : scheduler_(scheduler), priority_(priority) {}
+
+TaskStrand::~TaskStrand() { WaitIdle(); }
+
+void TaskStrand::Post(Task task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++outstanding_;
+  }
+  Enqueue(std::move(task));
+}
+
+void TaskStrand::PostAfter(int64_t delay_us, Task task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++outstanding_;
+  }
+  // 调度器在停止、延时任务不会再跑时，把计数还回去
+  if (!scheduler_->SubmitAfter(
+          delay_us,
+          [this, task = std::move(task)]() mutable {
+            Enqueue(std::move(task));
+          },
+          priority_, [this] { Release(); })) {
+    Release();
+  }
+}
+
+void TaskStrand::Release() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (--outstanding_ == 0) {
+    idle_cv_.notify_all();
+  }
+}
+
+void TaskStrand::WaitIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_cv_.wait(lock, [this] { return outstanding_ == 0; });
+}
+
+void TaskStrand::Enqueue(Task task) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  tasks_.push_back(std::move(task));
+  if (!running_) {
+    running_ = true;
+    scheduler_->Submit([this] { RunOne(); }, priority_);
+  }
+}
+
+void TaskStrand::RunOne() {
+  // 每次只跑一个再重新排队，同优先级的其他 strand 能插进来
+  Task task;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task = std::move(tasks_.front());
+    tasks_.pop_front();
+  }
+  task();
+  task = nullptr;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (tasks_.empty()) {
+    running_ = false;
+  } else {
+    scheduler_->Submit([this] { RunOne(); }, priority_);
+  }
+  // 持锁通知：WaitIdle 的一方拿到锁时这里已经不再碰任何成员
+  if (--outstanding_ == 0) {
+    idle_cv_.notify_all();
+  }
+}
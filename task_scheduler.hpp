@@ -0,0 +1,159 @@
+//
+//  task_scheduler.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/25.
+//
+
+#ifndef task_scheduler_hpp
+#define task_scheduler_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 数字越小越先跑。工作线程每次取任务都从最高优先级开始找，
+// 先找自己的队列，再去别的线程那里偷，找不到才看下一级
+enum class TaskPriority {
+  kAudio = 0,     // 音频解码、重采样，断了就是爆音
+  kDeadline = 1,  // 快到显示时间的视频帧（转换 + 送显）
+  kNormal = 2,    // 视频解码
+  kBackground = 3,
+};
+
+// 进程内共享的 work-stealing 任务调度器。每个工作线程一组按优先级分开的
+// 双端队列：自己投的任务压在队尾、从队尾取（刚投的数据还在缓存里），
+// 空闲的线程从别人的队首偷。所有会话的解码、YUV 转换、音频重采样都
+// 投到这里，线程数按进程配置一次，不再随会话数增长。
+// 任务里不要做长时间阻塞的事（文件 IO 等留给专门的线程）。
+class TaskScheduler {
+ public:
+  using Task = std::function<void()>;
+
+  struct WorkerStats {
+    uint64_t tasks = 0;      // 累计执行的任务数
+    uint64_t steals = 0;     // 其中从别的线程偷来的
+    double utilization = 0;  // 上次 GetWorkerStats 以来忙碌时间的占比
+  };
+
+  // threads <= 0 表示按 CPU 核数
+  explicit TaskScheduler(int threads);
+  // 跑完已经就绪的任务再退出，还没到时间的延时任务直接丢弃（调用它们的
+  // on_drop）
+  ~TaskScheduler();
+
+  TaskScheduler(const TaskScheduler&) = delete;
+  TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+  // 设置 Shared() 的线程数，只在第一次调用 Shared() 之前有效，
+  // 之后调用返回 false
+  static bool Configure(int threads);
+  static TaskScheduler& Shared();
+
+  void Submit(Task task, TaskPriority priority = TaskPriority::kNormal);
+  // delay_us 微秒之后再变成就绪任务。调度器已经在停止时不收，返回 false；
+  // 收下了但停止时还没到期的，不执行 task，改为调用 on_drop
+  bool SubmitAfter(int64_t delay_us, Task task,
+                   TaskPriority priority = TaskPriority::kNormal,
+                   Task on_drop = nullptr);
+
+  int threads() const { return static_cast<int>(workers_.size()); }
+  // 每个工作线程一项
+  std::vector<WorkerStats> GetWorkerStats();
+  // 所有工作线程的平均利用率，同样以上次 GetWorkerStats 为起点
+  static double MeanUtilization(const std::vector<WorkerStats>& stats);
+
+ private:
+  static constexpr int kPriorityLevels = 4;
+
+  struct alignas(64) Worker {
+    std::mutex mutex;
+    std::deque<Task> queues[kPriorityLevels];
+    std::thread thread;
+    std::atomic<uint64_t> tasks{0};
+    std::atomic<uint64_t> steals{0};
+    std::atomic<int64_t> busy_us{0};
+    // 以下只在 stats_mutex_ 下访问
+    int64_t sampled_busy_us = 0;
+  };
+
+  struct DelayedTask {
+    int64_t due_us;
+    uint64_t seq;  // 同一时刻到期的按投递顺序
+    TaskPriority priority;
+    Task task;
+    Task on_drop;
+  };
+  struct LaterFirst {
+    bool operator()(const DelayedTask& a, const DelayedTask& b) const {
+      return a.due_us != b.due_us ? a.due_us > b.due_us : a.seq > b.seq;
+    }
+  };
+
+  void WorkerLoop(size_t index);
+  void Push(size_t index, Task task, TaskPriority priority);
+  bool FindTask(size_t index, Task* task);
+  // 把到期的延时任务挪进 index 的队列
+  void PromoteDueTasks(size_t index);
+  void WakeOne();
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> next_worker_{0};
+
+  // 就绪但还没被取走的任务数，空闲线程据此决定睡不睡
+  std::atomic<int64_t> ready_{0};
+  std::atomic<int> sleeping_{0};
+  std::mutex idle_mutex_;
+  std::condition_variable idle_cv_;
+  bool stopping_ = false;
+
+  // 延时任务的小顶堆，和睡眠共用 idle_mutex_
+  std::vector<DelayedTask> delayed_;
+  uint64_t delayed_seq_ = 0;
+  std::atomic<int64_t> next_due_us_;
+
+  std::mutex stats_mutex_;
+  int64_t sampled_us_ = 0;
+};
+
+// 串行执行器：投进来的任务按 FIFO 一个接一个跑在 scheduler 上，
+// 同一时刻最多占一个工作线程。一个会话里的每条流水线（某条流的解码、
+// 视频送显、音频输出）各用一个，自己的状态不用加锁
+class TaskStrand {
+ public:
+  using Task = TaskScheduler::Task;
+
+  TaskStrand(TaskScheduler* scheduler, TaskPriority priority);
+  // 等所有投递过的任务（包括还没到时间的延时任务）跑完
+  ~TaskStrand();
+
+  TaskStrand(const TaskStrand&) = delete;
+  TaskStrand& operator=(const TaskStrand&) = delete;
+
+  void Post(Task task);
+  void PostAfter(int64_t delay_us, Task task);
+  // 阻塞到投递过的任务都跑完，不能在本 strand 的任务里调用
+  void WaitIdle();
+
+ private:
+  void Enqueue(Task task);
+  void RunOne();
+  // 一个任务跑完或被丢弃
+  void Release();
+
+  TaskScheduler* scheduler_;
+  TaskPriority priority_;
+  std::mutex mutex_;
+  std::condition_variable idle_cv_;
+  std::deque<Task> tasks_;
+  bool running_ = false;
+  int outstanding_ = 0;  // 排队、正在跑、延时还没到的任务数
+};
+
+#endif /* task_scheduler_hpp */
@@ -0,0 +1,351 @@
+//
+//  thumbnail_extractor.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/28.
+//
+
+#include "thumbnail_extractor.hpp"
+
+#include <png.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "frame_pool.hpp"
+#include "stream_decoder.hpp"
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/time.h>
+#include <libswscale/swscale.h>
+}
+
+// seek 之后最多读这么多个视频 packet 找关键帧，容器没标关键帧时不至于读到底
+static const int kMaxPacketsPerThumbnail = 600;
+
+struct ThumbnailExtractor::FileJob {
+  std::string path;
+  std::string name;  // 输出文件名前缀
+  int stream_index = -1;
+  std::vector<int64_t> targets;  // 各缩略图的时间点，视频流 time_base
+  int width = 0;                 // 输出尺寸
+  int height = 0;
+  std::vector<std::vector<uint8_t>> images;  // RGB24，拼图用，失败的为空
+  std::atomic<int> remaining_segments{0};
+};
+
+// 去掉目录和扩展名
+static std::string OutputName(const std::string& path) {
+  size_t slash = path.find_last_of('/');
+  std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+  size_t dot = name.find_last_of('.');
+  if (dot != std::string::npos && dot > 0) {
+    name.resize(dot);
+  }
+  return name;
+}
+
+static bool WritePng(const std::string& path, const uint8_t* rgb, int width,
+                     int height) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) {
+    spdlog::warn("thumbnails: could not open {}: {}", path, strerror(errno));
+    return false;
+  }
+  png_structp png =
+      png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+  png_infop info = png ? png_create_info_struct(png) : nullptr;
+  if (!info || setjmp(png_jmpbuf(png))) {
+    png_destroy_write_struct(&png, &info);
+    fclose(file);
+    spdlog::warn("thumbnails: could not write {}", path);
+    return false;
+  }
+  png_init_io(png, file);
+  // 缩略图量大，压缩速度比文件大小重要
+  png_set_compression_level(png, 1);
+  png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+               PNG_FILTER_TYPE_DEFAULT);
+  png_write_info(png, info);
+  for (int y = 0; y < height; ++y) {
+    png_write_row(png, const_cast<png_bytep>(rgb + y * width * 3));
+  }
+  png_write_end(png, nullptr);
+  png_destroy_write_struct(&png, &info);
+  return fclose(file) == 0;
+}
+
+// seek 到 target 之前最近的关键帧并解出它。只把关键帧 packet 送进解码器，
+// 带重排延迟的解码器（H.264 有 B 帧时）要多喂几个关键帧或 drain 才吐帧
+static bool DecodeKeyframeAt(AVFormatContext* format_ctx,
+                             AVCodecContext* codec_ctx, int stream_index,
+                             int64_t target, AVPacket* packet,
+                             AVFrame* frame) {
+  if (av_seek_frame(format_ctx, stream_index, target, AVSEEK_FLAG_BACKWARD) <
+      0) {
+    return false;
+  }
+  avcodec_flush_buffers(codec_ctx);
+  for (int read = 0; read < kMaxPacketsPerThumbnail;) {
+    if (av_read_frame(format_ctx, packet) < 0) {
+      avcodec_send_packet(codec_ctx, nullptr);
+      return avcodec_receive_frame(codec_ctx, frame) == 0;
+    }
+    bool video = packet->stream_index == stream_index;
+    bool key = video && (packet->flags & AV_PKT_FLAG_KEY);
+    int ret = key ? avcodec_send_packet(codec_ctx, packet) : AVERROR(EAGAIN);
+    av_packet_unref(packet);
+    if (video) {
+      ++read;
+    }
+    if (key && (ret == 0 || ret == AVERROR(EAGAIN)) &&
+        avcodec_receive_frame(codec_ctx, frame) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+ThumbnailExtractor::ThumbnailExtractor(const ThumbnailOptions& options,
+                                       TaskScheduler* scheduler)
+    : options_(options), scheduler_(scheduler) {
+  options_.count = std::max(options_.count, 1);
+  options_.width = std::max(options_.width, 16);
+}
+
+ThumbnailExtractor::~ThumbnailExtractor() = default;
+
+ThumbnailStats ThumbnailExtractor::Run(const std::vector<std::string>& paths) {
+  std::error_code error;
+  std::filesystem::create_directories(options_.out_dir, error);
+  if (error) {
+    spdlog::error("thumbnails: could not create {}: {}", options_.out_dir,
+                  error.message());
+  }
+
+  int64_t start_us = av_gettime_relative();
+  failed_files_ = 0;
+  thumbnails_ = 0;
+  // 同时处理的文件数有上限，几千个文件的中间结果不会同时留在内存里
+  const int max_in_flight = std::max(scheduler_->threads(), 1) * 2;
+  for (const std::string& path : paths) {
+    auto job = std::make_shared<FileJob>();
+    job->path = path;
+    job->name = OutputName(path);
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_cv_.wait(lock, [&] { return files_in_flight_ < max_in_flight; });
+      ++files_in_flight_;
+    }
+    scheduler_->Submit([this, job] { ProbeFile(job); },
+                       TaskPriority::kBackground);
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return files_in_flight_ == 0; });
+  }
+
+  ThumbnailStats stats;
+  stats.files = paths.size();
+  stats.failed_files = failed_files_;
+  stats.thumbnails = thumbnails_;
+  stats.seconds = (av_gettime_relative() - start_us) / 1000000.0;
+  return stats;
+}
+
+void ThumbnailExtractor::ProbeFile(std::shared_ptr<FileJob> job) {
+  AVFormatContext* format_ctx = nullptr;
+  std::unique_ptr<LocalFileIO> file_io;
+  // 只读头部，预读窗口取最小
+  bool ok = OpenMediaInput(job->path, options_.file_io, 0, &format_ctx,
+                           &file_io) == 0;
+  if (ok && avformat_find_stream_info(format_ctx, NULL) < 0) {
+    ok = false;
+  }
+  if (ok) {
+    job->stream_index =
+        av_find_best_stream(format_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    ok = job->stream_index >= 0;
+  }
+  if (ok) {
+    const AVStream* stream = format_ctx->streams[job->stream_index];
+    int64_t start = stream->start_time != AV_NOPTS_VALUE ? stream->start_time
+                                                         : 0;
+    int64_t duration = stream->duration;
+    if (duration == AV_NOPTS_VALUE || duration <= 0) {
+      duration = format_ctx->duration > 0
+                     ? av_rescale_q(format_ctx->duration, AV_TIME_BASE_Q,
+                                    stream->time_base)
+                     : 0;
+    }
+    // 每个点取所在区间的中间，避开片头片尾的黑场
+    int count = options_.count;
+    for (int i = 0; i < count; ++i) {
+      job->targets.push_back(start + duration * (2 * i + 1) / (2 * count));
+    }
+
+    const AVCodecParameters* par = stream->codecpar;
+    AVRational sar = par->sample_aspect_ratio;
+    if (sar.num <= 0 || sar.den <= 0) {
+      sar = AVRational{1, 1};
+    }
+    ok = par->width > 0 && par->height > 0;
+    if (ok) {
+      // 按显示宽高比算高度，RGB24 的 PNG 不要求偶数
+      job->width = std::min(options_.width, par->width * sar.num / sar.den);
+      job->width = std::max(job->width, 1);
+      job->height = std::max<int>(
+          1, std::lround(static_cast<double>(job->width) * par->height *
+                         sar.den / (static_cast<double>(par->width) * sar.num)));
+    }
+  }
+  if (format_ctx) {
+    avformat_close_input(&format_ctx);
+  }
+  file_io.reset();
+
+  if (!ok) {
+    spdlog::warn("thumbnails: could not probe {}", job->path);
+    ++failed_files_;
+    std::lock_guard<std::mutex> lock(mutex_);
+    --files_in_flight_;
+    done_cv_.notify_all();
+    return;
+  }
+
+  int count = static_cast<int>(job->targets.size());
+  int segments = options_.segments > 0 ? options_.segments
+                                       : scheduler_->threads();
+  segments = std::max(std::min(segments, count), 1);
+  job->images.resize(count);
+  job->remaining_segments = segments;
+  // 每段是连续的一串时间点，段内 seek 都往后走，读取也是顺序的
+  for (int s = 0; s < segments; ++s) {
+    int begin = count * s / segments;
+    int end = count * (s + 1) / segments;
+    scheduler_->Submit([this, job, begin, end] {
+      ExtractSegment(job, begin, end);
+    }, TaskPriority::kBackground);
+  }
+}
+
+void ThumbnailExtractor::ExtractSegment(std::shared_ptr<FileJob> job,
+                                        int begin, int end) {
+  AVFormatContext* format_ctx = nullptr;
+  std::unique_ptr<LocalFileIO> file_io;
+  AVCodecContext* codec_ctx = nullptr;
+  SwsContext* sws_ctx = nullptr;
+
+  if (OpenMediaInput(job->path, options_.file_io, 0, &format_ctx, &file_io) ==
+          0 &&
+      job->stream_index < static_cast<int>(format_ctx->nb_streams)) {
+    for (unsigned int i = 0; i < format_ctx->nb_streams; ++i) {
+      if (static_cast<int>(i) != job->stream_index) {
+        format_ctx->streams[i]->discard = AVDISCARD_ALL;
+      }
+    }
+    // 并行在段之间，每个解码器单线程，免得帧并行带来额外延迟
+    DecoderOptions decoder_options;
+    decoder_options.thread_count = 1;
+    codec_ctx = OpenCodecContext(job->name,
+                                 format_ctx->streams[job->stream_index],
+                                 decoder_options);
+  }
+
+  if (codec_ctx) {
+    codec_ctx->skip_frame = AVDISCARD_NONKEY;
+    AVFramePtr frame = createAVFramePtr();
+    AVPacketPtr packet = createAVPacketPtr();
+    for (int i = begin; i < end; ++i) {
+      if (!DecodeKeyframeAt(format_ctx, codec_ctx, job->stream_index,
+                            job->targets[i], packet.get(), frame.get())) {
+        spdlog::warn("thumbnails: {} #{}: no keyframe", job->name, i + 1);
+        continue;
+      }
+      // 缩放和转 RGB24 一步完成，输出直接就是 PNG 的像素格式
+      sws_ctx = sws_getCachedContext(
+          sws_ctx, frame->width, frame->height,
+          static_cast<AVPixelFormat>(frame->format), job->width, job->height,
+          AV_PIX_FMT_RGB24, SWS_BILINEAR, nullptr, nullptr, nullptr);
+      if (!sws_ctx) {
+        av_frame_unref(frame.get());
+        continue;
+      }
+      std::vector<uint8_t> rgb(static_cast<size_t>(job->width) * job->height *
+                               3);
+      uint8_t* dst[4] = {rgb.data(), nullptr, nullptr, nullptr};
+      int dst_stride[4] = {job->width * 3, 0, 0, 0};
+      sws_scale(sws_ctx, frame->data, frame->linesize, 0, frame->height, dst,
+                dst_stride);
+      av_frame_unref(frame.get());
+
+      std::string path = fmt::format("{}/{}_{:04d}.png", options_.out_dir,
+                                     job->name, i + 1);
+      if (WritePng(path, rgb.data(), job->width, job->height)) {
+        ++thumbnails_;
+        job->images[i] = std::move(rgb);
+      }
+    }
+  } else {
+    spdlog::warn("thumbnails: could not open decoder for {}", job->path);
+  }
+
+  sws_freeContext(sws_ctx);
+  avcodec_free_context(&codec_ctx);
+  if (format_ctx) {
+    avformat_close_input(&format_ctx);
+  }
+  file_io.reset();
+
+  if (--job->remaining_segments == 0) {
+    FinishFile(job);
+  }
+}
+
+void ThumbnailExtractor::FinishFile(const std::shared_ptr<FileJob>& job) {
+  int count = static_cast<int>(job->images.size());
+  int produced = static_cast<int>(
+      std::count_if(job->images.begin(), job->images.end(),
+                    [](const std::vector<uint8_t>& image) {
+                      return !image.empty();
+                    }));
+  if (produced == 0) {
+    ++failed_files_;
+  } else if (options_.contact_sheet) {
+    // 按接近正方形的网格拼图，缺的格子留黑
+    int columns = static_cast<int>(std::ceil(std::sqrt(count)));
+    int rows = (count + columns - 1) / columns;
+    int sheet_width = columns * job->width;
+    int sheet_height = rows * job->height;
+    std::vector<uint8_t> sheet(static_cast<size_t>(sheet_width) *
+                               sheet_height * 3);
+    size_t row_bytes = static_cast<size_t>(job->width) * 3;
+    for (int i = 0; i < count; ++i) {
+      if (job->images[i].empty()) {
+        continue;
+      }
+      int x = (i % columns) * job->width;
+      int y = (i / columns) * job->height;
+      for (int row = 0; row < job->height; ++row) {
+        memcpy(sheet.data() +
+                   (static_cast<size_t>(y + row) * sheet_width + x) * 3,
+               job->images[i].data() + row * row_bytes, row_bytes);
+      }
+    }
+    WritePng(fmt::format("{}/{}_sheet.png", options_.out_dir, job->name),
+             sheet.data(), sheet_width, sheet_height);
+  }
+  spdlog::info("thumbnails: {} {}/{}", job->name, produced, count);
+  job->images.clear();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  --files_in_flight_;
+  done_cv_.notify_all();
+}
@@ -0,0 +1,79 @@
+//
+//  thumbnail_extractor.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/28.
+//
+
+#ifndef thumbnail_extractor_hpp
+#define thumbnail_extractor_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "local_file_io.hpp"
+#include "task_scheduler.hpp"
+
+struct ThumbnailOptions {
+  int count = 16;    // 每个文件的缩略图数，在时长上均匀分布
+  int width = 320;   // 高度按比例
+  int segments = 0;  // 每个文件切成几段并行，0 表示按 scheduler 线程数
+  bool contact_sheet = true;  // 另外把所有缩略图拼成一张
+  std::string out_dir = ".";
+  FileIoMode file_io = FileIoMode::kAuto;
+};
+
+struct ThumbnailStats {
+  uint64_t files = 0;
+  uint64_t failed_files = 0;
+  uint64_t thumbnails = 0;
+  double seconds = 0;
+
+  double ThumbnailsPerSecond() const {
+    return seconds > 0 ? thumbnails / seconds : 0;
+  }
+};
+
+// 不经过播放管线的缩略图提取：按时长均匀取 count 个时间点，每个点 seek 到
+// 之前最近的关键帧，解码器只解关键帧（AVDISCARD_NONKEY），sws_scale 一次
+// 完成缩放和转 RGB24，写成 PNG。每个文件切成几段，每段自己打开一份
+// 解封装和解码器，作为 kBackground 任务跑在 scheduler 上，多个文件之间也并行。
+// 输出 <out_dir>/<文件名>_0001.png ...，以及 <文件名>_sheet.png
+class ThumbnailExtractor {
+ public:
+  explicit ThumbnailExtractor(
+      const ThumbnailOptions& options,
+      TaskScheduler* scheduler = &TaskScheduler::Shared());
+  ~ThumbnailExtractor();
+
+  ThumbnailExtractor(const ThumbnailExtractor&) = delete;
+  ThumbnailExtractor& operator=(const ThumbnailExtractor&) = delete;
+
+  // 处理完所有文件才返回
+  ThumbnailStats Run(const std::vector<std::string>& paths);
+
+ private:
+  struct FileJob;
+
+  // 打开文件算出时间点，再把各段投出去
+  void ProbeFile(std::shared_ptr<FileJob> job);
+  void ExtractSegment(std::shared_ptr<FileJob> job, int begin, int end);
+  // 一个文件的最后一段做完时调用
+  void FinishFile(const std::shared_ptr<FileJob>& job);
+
+  ThumbnailOptions options_;
+  TaskScheduler* scheduler_;
+
+  std::mutex mutex_;
+  std::condition_variable done_cv_;
+  int files_in_flight_ = 0;
+  std::atomic<uint64_t> failed_files_{0};
+  std::atomic<uint64_t> thumbnails_{0};
+};
+
+#endif /* thumbnail_extractor_hpp */
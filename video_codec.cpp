@@ -8,25 +8,133 @@
 #include "video_codec.hpp"
 
 #include <spdlog/spdlog.h>
-#include <sys/time.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <optional>
 
-#include "blocking_queue.h"
+#include "gop_decoder.hpp"
+#include "stream_decoder.hpp"
 
 extern "C" {
 #include <libavformat/avformat.h>
 #include <libavutil/time.h>
 }
 
-static void StaticFrameCallback(AVFramePtr frame) {
-  VideoCodec& codec = VideoCodec::getInstance();
-  codec.OnFrame(std::move(frame));
+// 每条流 packet 队列的上限，音频 packet 小而密，给得多一些
+static const size_t kMaxVideoPackets = 64;
+static const size_t kMaxAudioPackets = 256;
+
+// 视频排期参数，单位秒
+static const double kMaxLateSeconds = 0.08;  // 晚于主时钟超过这么多就丢帧
+// 显示时晚于主时钟超过这么多记一次迟到，大约是 60Hz 下的一次刷新
+static const double kLateToleranceSeconds = 0.017;
+static const double kMaxWaitSeconds = 5.0;   // 超过这么远视为时间戳跳变
+// 提前不到这么多就直接显示，延时任务本身的唤醒误差也在这个量级
+static const double kEarlySeconds = 0.001;
+// 等待中的帧最多隔这么久重看一次主时钟，音频时钟调整时能及时跟上
+static const int64_t kMaxVideoTimerUs = 10000;
+// 音频输出端收不下时隔这么久再试，PCM 环里至少还有 100ms 的数据
+static const int64_t kAudioRetryUs = 10000;
+static const double kDefaultFrameDuration = 1.0 / 25;
+static const uint64_t kSyncLogInterval = 250;  // 每显示这么多帧打一次统计
+static const uint64_t kGopLogInterval = 100;   // 每走这么多帧打一次缓存统计
+static const int64_t kStatsLogIntervalUs = 10000000;  // 各阶段延迟的日志间隔
+// 快放/倒放的倍速上限
+static const double kMaxPlaybackRate = 32;
+// 慢放下限
+static const double kMinPlaybackRate = 0.5;
+// 这个倍速以内声音变速不变调接着放，音频仍是主时钟；再快就静音
+static const double kMaxStretchRate = 2;
+// 快放从这个倍速起不解非参考帧，倒放从这个倍速起只显示关键帧
+static const double kNonRefRate = 4;
+// 快放从这个倍速起只解关键帧
+static const double kKeyframeRate = 8;
+// 快放时送显的最小间隔，帧来得再密也不超过 60fps
+static const int64_t kMinTrickFrameUs = 16667;
+// 快速启动时 avformat_find_stream_info 最多读的字节数和分析的时长
+static const int64_t kFastProbeBytes = 256 << 10;
+static const int64_t kFastAnalyzeUs = 100000;
+// 帧队列总量超预算时解封装线程每次让路的时间
+static const int kThrottleWaitMs = 10;
+// 帧队列的数量上限只是兜底，实际按字节和时长限制
+static const size_t kMaxQueuedVideoFrames = 256;
+static const size_t kMaxQueuedAudioFrames = 1024;
+
+// seek 批次号借 AVFrame::opaque 存放，帧回收时 av_frame_unref 会清掉
+static void SetFrameSerial(AVFrame* frame, int serial) {
+  frame->opaque = reinterpret_cast<void*>(static_cast<intptr_t>(serial));
 }
 
-VideoCodec::VideoCodec() : fq_(100), afq_(100) {}  // 防止屯帧
+static int FrameSerial(const AVFrame* frame) {
+  return static_cast<int>(reinterpret_cast<intptr_t>(frame->opaque));
+}
+
+static int64_t FrameTimestamp(const AVFrame* frame) {
+  return frame->pts != AV_NOPTS_VALUE ? frame->pts
+                                      : frame->best_effort_timestamp;
+}
+
+static double FrameSeconds(const AVFrame* frame, AVRational time_base) {
+  int64_t ts = FrameTimestamp(frame);
+  if (ts == AV_NOPTS_VALUE) {
+    return NAN;
+  }
+  return av_q2d(time_base) * ts;
+}
+
+// 倒放和超过变速范围的快放不出声音，音频包和音频帧都不要
+static bool AudioMuted(double rate) {
+  return rate < 0 || rate > kMaxStretchRate;
+}
+
+// 快放时解码器可以跳过的帧
+static AVDiscard TrickDiscard(double rate) {
+  if (rate >= kKeyframeRate) {
+    return AVDISCARD_NONKEY;
+  }
+  if (rate >= kNonRefRate) {
+    return AVDISCARD_NONREF;
+  }
+  return AVDISCARD_DEFAULT;
+}
+
+// 帧在队列里占的媒体时长（微秒），视频帧没有时长时按默认帧率算
+static int64_t FrameDurationUs(const AVFrame* frame, AVRational time_base) {
+  if (frame->nb_samples > 0 && frame->sample_rate > 0) {
+    return av_rescale(frame->nb_samples, 1000000, frame->sample_rate);
+  }
+  if (frame->pkt_duration > 0 && time_base.den > 0) {
+    return av_rescale_q(frame->pkt_duration, time_base, AV_TIME_BASE_Q);
+  }
+  return static_cast<int64_t>(kDefaultFrameDuration * 1000000);
+}
+
+VideoCodec::VideoCodec(ResourceBudget* budget, TaskScheduler* scheduler)
+    : budget_(budget),
+      video_queue_budget_(budget),
+      audio_queue_budget_(budget),
+      fq_(kMaxQueuedVideoFrames),
+      afq_(kMaxQueuedAudioFrames),
+      gop_cache_(DecoderOptions().gop_cache_bytes),
+      video_strand_(scheduler, TaskPriority::kDeadline),
+      audio_strand_(scheduler, TaskPriority::kAudio) {
+  for (std::atomic<int64_t>& us : startup_us_) {
+    us = -1;
+  }
+}
 
-VideoCodec::~VideoCodec() {}
+VideoCodec::~VideoCodec() { StopCodec(); }
+
+DecoderOptions VideoCodec::BudgetedOptions() {
+  DecoderOptions options = options_;
+  options.thread_count =
+      std::min(options_.ResolvedThreadCount(), budget_->ThreadShare());
+  return options;
+}
 
 void VideoCodec::Register(VideoCodecListener* listener) {
   listener_ = listener;
@@ -39,285 +147,1303 @@ void VideoCodec::UnRegister(VideoCodecListener* listener) {
   listener_ = nullptr;
 }
 
-void VideoCodec::StartCodec(const std::string& file_path) {
+void VideoCodec::StartCodec(const std::string& file_path,
+                            const DecoderOptions& options) {
+  options_ = options;
+  file_path_ = file_path;
   stop_requested_ = false;
-  stream_time_base_ready_ = false;
+  start_us_ = av_gettime_relative();
+  for (std::atomic<int64_t>& us : startup_us_) {
+    us = -1;
+  }
+  keyframe_index_.Clear();
+  {
+    std::lock_guard<std::mutex> lock(seek_mutex_);
+    seek_request_ = SeekRequest();
+    handled_seek_id_ = 0;
+    seek_pending_ = false;
+  }
+  seek_serial_ = 0;
+  seek_floor_ = -HUGE_VAL;
+  position_ = 0;
+  position_pts_ = AV_NOPTS_VALUE;
+  gop_cache_.Clear();
+  budget_session_ = budget_->Join([this](uint64_t share) {
+    gop_cache_.SetBudget(std::min(options_.gop_cache_bytes, share));
+  });
+  {
+    std::lock_guard<std::mutex> lock(step_mutex_);
+    pending_steps_ = 0;
+    reverse_ = false;
+    reverse_rate_ = 1;
+  }
+  playback_rate_ = 1;
+  paused_ = false;
+  stepped_ = false;
+  {
+    std::lock_guard<std::mutex> lock(sync_stats_mutex_);
+    sync_stats_ = SyncStats();
+  }
+  pipeline_stats_.Reset();
+  video_queue_budget_.SetLimits(options.video_queue_bytes,
+                                options.video_queue_seconds);
+  audio_queue_budget_.SetLimits(options.audio_queue_bytes,
+                                options.audio_queue_seconds);
+  video_queue_budget_.ResetPeaks();
+  audio_queue_budget_.ResetPeaks();
+  demux_throttles_ = 0;
+  decoded_frames_ = 0;
+  decode_quality_ = 0;
+  eos_pending_ = false;
+  // 上一次 StopCodec 已经等送显/音频任务都跑完，这里没有并发访问
+  wall_clock_us_ = -1;
+  video_frame_ = nullptr;
+  video_last_pts_ = NAN;
+  video_serial_ = 0;
+  video_rate_ = 1;
+  video_last_present_us_ = 0;
+  video_pause_clock_ = NAN;
+  resume_us_ = -1;
+  stats_log_us_ = av_gettime_relative();
+  audio_frame_ = nullptr;
+  fq_.reopen();
+  afq_.reopen();
   codec_thread_ = std::thread(&VideoCodec::Codec, this, file_path);
-  getting_frame_thread_ = std::thread(&VideoCodec::ProcessFrameFromQueue, this);
-  getting_audio_frame_thread_ =
-      std::thread(&VideoCodec::ProcessAudioFrameFromQueue, this);
+  step_thread_ = std::thread(&VideoCodec::StepLoop, this);
 }
 
 void VideoCodec::StopCodec() {
+  if (!codec_thread_.joinable()) {
+    return;
+  }
   spdlog::info("StopCodec");
   stop_requested_ = true;
+  {
+    // 播完后解封装线程停在 seek_cv_ 上等 seek
+    std::lock_guard<std::mutex> lock(seek_mutex_);
+    seek_cv_.notify_all();
+  }
+
+  // close 之后解码器交的帧直接丢弃；叫醒等着下游腾空间的解码器，
+  // 它们把 packet 队列消化掉，阻塞在 PushPacket 上的解封装线程才能退出
+  fq_.close();
+  afq_.close();
+  WakeDecoder(false);
+  WakeDecoder(true);
+
   if (codec_thread_.joinable()) {
     codec_thread_.join();
   }
-  
-  stream_time_base_ready_ = true; 
-  
-  std::queue<AVFramePtr> empty_q;
-  empty_q.push(nullptr);
-  fq_.replace(empty_q);
-  afq_.replace(empty_q);
 
-  if (getting_frame_thread_.joinable()) {
-    getting_frame_thread_.join();
+  {
+    std::lock_guard<std::mutex> lock(step_mutex_);
+    step_cv_.notify_all();
   }
-
-  if (getting_audio_frame_thread_.joinable()) {
-    getting_audio_frame_thread_.join();
+  if (step_thread_.joinable()) {
+    step_thread_.join();
+  }
+  // 还在排队的延时任务最多 10ms 后到期，看到 stop_requested_ 直接返回
+  video_strand_.WaitIdle();
+  audio_strand_.WaitIdle();
+  video_frame_ = nullptr;
+  audio_frame_ = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(present_mutex_);
+    last_presented_frame_ = nullptr;
   }
+  {
+    // 解封装已经结束，析构时打一次读取统计
+    std::lock_guard<std::mutex> lock(file_io_mutex_);
+    file_io_.reset();
+  }
+  budget_->Leave(budget_session_);
   spdlog::info("StopCodec success");
 }
 
-void VideoCodec::OnFrame(AVFramePtr frame) {
-  fq_.push(frame);
+uint64_t VideoCodec::CopiedBytesPerSecond() {
+  return copy_meter_.BytesPerSecond();
 }
 
-void VideoCodec::OnAudioFrame(AVFramePtr frame) {
-  afq_.push(frame);
+uint64_t VideoCodec::DecodedFramesPerSecond() {
+  return decode_fps_meter_.PerSecond();
+}
+
+FileIoStats VideoCodec::GetFileIoStats() {
+  std::lock_guard<std::mutex> lock(file_io_mutex_);
+  return file_io_ ? file_io_->stats() : FileIoStats();
+}
+
+CodecStats VideoCodec::GetStats() {
+  CodecStats stats;
+  stats.latency = pipeline_stats_.GetSnapshot();
+  stats.sync = GetSyncStats();
+  stats.startup = GetStartupStats();
+  stats.file_io = GetFileIoStats();
+  stats.gop_cache = gop_cache_.stats();
+  stats.decoded_frames = decoded_frames_;
+  stats.decode_quality = decode_quality_;
+  stats.decoded_fps = DecodedFramesPerSecond();
+  stats.copied_bytes_per_second = CopiedBytesPerSecond();
+  stats.video_queue_bytes = video_queue_budget_.bytes();
+  stats.video_queue_seconds = video_queue_budget_.seconds();
+  stats.video_queue_peak_bytes = video_queue_budget_.peak_bytes();
+  stats.video_queue_peak_frames = video_queue_budget_.peak_frames();
+  stats.audio_queue_bytes = audio_queue_budget_.bytes();
+  stats.audio_queue_seconds = audio_queue_budget_.seconds();
+  stats.audio_queue_peak_bytes = audio_queue_budget_.peak_bytes();
+  stats.audio_queue_peak_frames = audio_queue_budget_.peak_frames();
+  stats.all_queues_bytes = budget_->queued_bytes();
+  stats.demux_throttles = demux_throttles_;
+  return stats;
+}
+
+std::string VideoCodec::GetStatsJson() {
+  CodecStats s = GetStats();
+  return fmt::format(
+      "{{\"latency\": {}, "
+      "\"sync\": {{\"audio_master\": {}, \"drift_ms\": {:.2f}, "
+      "\"max_drift_ms\": {:.2f}, \"presented\": {}, \"dropped\": {}, "
+      "\"late\": {}, \"repeated\": {}, \"seeks\": {}, \"last_seek_latency_ms\": {:.2f}, "
+      "\"max_seek_latency_ms\": {:.2f}, \"resumes\": {}, "
+      "\"last_resume_latency_ms\": {:.2f}, "
+      "\"max_resume_latency_ms\": {:.2f}}}, "
+      "\"startup\": {{\"open_ms\": {:.2f}, \"probe_ms\": {:.2f}, "
+      "\"decoders_ms\": {:.2f}, \"first_decode_ms\": {:.2f}, "
+      "\"first_frame_ms\": {:.2f}, \"first_audio_ms\": {:.2f}}}, "
+      "\"file_io\": {{\"mode\": \"{}\", \"syscalls\": {}, "
+      "\"bytes_read\": {}, \"read_ahead_bytes\": {}, "
+      "\"discarded_bytes\": {}, \"seeks\": {}, \"stalls\": {}}}, "
+      "\"gop_cache\": {{\"hits\": {}, \"misses\": {}, \"evictions\": {}, "
+      "\"bytes\": {}, \"budget\": {}, \"gops\": {}}}, "
+      "\"queues\": {{\"video_bytes\": {}, \"video_seconds\": {:.3f}, "
+      "\"video_peak_bytes\": {}, \"video_peak_frames\": {}, "
+      "\"audio_bytes\": {}, \"audio_seconds\": {:.3f}, "
+      "\"audio_peak_bytes\": {}, \"audio_peak_frames\": {}, "
+      "\"all_sessions_bytes\": {}, \"demux_throttles\": {}}}, "
+      "\"decoded_frames\": {}, \"decode_quality\": {}, \"decoded_fps\": {}, "
+      "\"copied_bytes_per_second\": {}}}",
+      PipelineStats::ToJson(s.latency), s.sync.audio_master,
+      s.sync.drift * 1000, s.sync.max_drift * 1000, s.sync.presented,
+      s.sync.dropped, s.sync.late, s.sync.repeated, s.sync.seeks,
+      s.sync.last_seek_latency * 1000, s.sync.max_seek_latency * 1000,
+      s.sync.resumes, s.sync.last_resume_latency * 1000,
+      s.sync.max_resume_latency * 1000,
+      s.startup.open_ms, s.startup.probe_ms, s.startup.decoders_ms,
+      s.startup.first_decode_ms, s.startup.first_frame_ms,
+      s.startup.first_audio_ms,
+      s.file_io.mode, s.file_io.syscalls, s.file_io.bytes_read,
+      s.file_io.read_ahead_bytes, s.file_io.discarded_bytes, s.file_io.seeks,
+      s.file_io.stalls, s.gop_cache.hits, s.gop_cache.misses,
+      s.gop_cache.evictions, s.gop_cache.bytes, s.gop_cache.budget,
+      s.gop_cache.gops, s.video_queue_bytes, s.video_queue_seconds,
+      s.video_queue_peak_bytes, s.video_queue_peak_frames,
+      s.audio_queue_bytes, s.audio_queue_seconds, s.audio_queue_peak_bytes,
+      s.audio_queue_peak_frames, s.all_queues_bytes, s.demux_throttles,
+      s.decoded_frames, s.decode_quality, s.decoded_fps,
+      s.copied_bytes_per_second);
+}
+
+bool VideoCodec::OnFrame(const AVFramePtr& frame) {
+  if (stop_requested_) {
+    return true;
+  }
+  if (!video_queue_budget_.HasRoom()) {
+    return false;
+  }
+  QueuedFrame item{frame, av_gettime_relative(),
+                   video_queue_budget_.Acquire(
+                       FrameDataSize(frame.get()),
+                       FrameDurationUs(frame.get(), stream_time_base_))};
+  if (!fq_.tryPush(std::move(item))) {
+    return false;
+  }
+  KickVideo();
+  return true;
+}
+
+bool VideoCodec::OnAudioFrame(const AVFramePtr& frame) {
+  if (stop_requested_) {
+    return true;
+  }
+  if (!audio_queue_budget_.HasRoom()) {
+    return false;
+  }
+  QueuedFrame item{frame, av_gettime_relative(),
+                   audio_queue_budget_.Acquire(
+                       FrameDataSize(frame.get()),
+                       FrameDurationUs(frame.get(), audio_stream_time_base_))};
+  if (!afq_.tryPush(std::move(item))) {
+    return false;
+  }
+  KickAudio();
+  return true;
+}
+
+void VideoCodec::WakeDecoder(bool audio) {
+  std::lock_guard<std::mutex> lock(decoders_mutex_);
+  StreamDecoder* decoder = audio ? audio_decoder_ : video_decoder_;
+  if (decoder) {
+    decoder->Wake();
+  }
+}
+
+void VideoCodec::Seek(double seconds, SeekMode mode) {
+  {
+    std::lock_guard<std::mutex> lock(seek_mutex_);
+    seek_request_ = {seconds, mode, av_gettime_relative(),
+                     seek_request_.id + 1};
+    seek_pending_ = true;
+    seek_cv_.notify_all();
+  }
+  // 新的 seek 决定恢复播放的位置，之前逐帧挪过的位置作废
+  stepped_ = false;
+  // 解封装线程可能阻塞在 PushPacket 上（暂停时解码器交不出帧，packet
+  // 队列就会满）。旧位置的 packet 反正要丢，先丢掉放它去处理 seek
+  {
+    std::lock_guard<std::mutex> lock(decoders_mutex_);
+    if (video_decoder_) {
+      video_decoder_->DropPackets();
+    }
+    if (audio_decoder_) {
+      audio_decoder_->DropPackets();
+    }
+  }
+  // clear 掉的空间由消费方释放，暂停时送显/音频任务也会去释放，
+  // 等着交帧的解码器才能接着解
+  fq_.clear();
+  afq_.clear();
+  KickVideo();
+  KickAudio();
+}
+
+double VideoCodec::Position() {
+  {
+    std::lock_guard<std::mutex> lock(seek_mutex_);
+    if (seek_pending_) {
+      return seek_request_.seconds;
+    }
+  }
+  return position_;
+}
+
+bool VideoCodec::TakeSeekRequest(SeekRequest* request) {
+  std::lock_guard<std::mutex> lock(seek_mutex_);
+  if (!seek_pending_ || seek_request_.id == handled_seek_id_) {
+    return false;
+  }
+  *request = seek_request_;
+  handled_seek_id_ = request->id;
+  return true;
+}
+
+void VideoCodec::HandleSeek(AVFormatContext* format_ctx,
+                            int video_stream_index, const SeekRequest& request,
+                            StreamDecoder* video_decoder,
+                            StreamDecoder* audio_decoder) {
+  eos_pending_ = false;
+  AVStream* stream = format_ctx->streams[video_stream_index];
+  double seconds_per_tick = av_q2d(stream->time_base);
+  int64_t target = llrint(request.seconds / seconds_per_tick);
+  if (stream->start_time != AV_NOPTS_VALUE) {
+    target = std::max(target, stream->start_time);
+  }
+
+  int64_t seek_ts = target;
+  double floor = -HUGE_VAL;
+  if (request.mode == SeekMode::kAccurate) {
+    floor = target * seconds_per_tick;
+  } else {
+    int64_t keyframe = 0;
+    if (keyframe_index_.Nearest(target, &keyframe)) {
+      // 已知关键帧位置时直接落到最近的那个，前后都可以；
+      // 否则交给 demuxer 找目标之前的关键帧
+      seek_ts = keyframe;
+      floor = keyframe * seconds_per_tick;
+    }
+  }
+
+  seek_start_us_ = request.request_us;
+  seek_floor_ = floor;
+  // 先换批次号，之后解码线程交出来的帧才算新位置的
+  ++seek_serial_;
+  video_decoder->Flush();
+  if (audio_decoder) {
+    audio_decoder->Flush();
+  }
+  fq_.clear();
+  afq_.clear();
+  KickVideo();
+  KickAudio();
+
+  int ret = avformat_seek_file(format_ctx, video_stream_index, INT64_MIN,
+                               seek_ts, seek_ts, 0);
+  if (ret < 0) {
+    spdlog::warn("seek to {:.3f}s failed: {}", request.seconds, ret);
+  }
+
+  if (listener_) {
+    listener_->OnSeek();
+  }
+  audio_clock_.Invalidate();
+  spdlog::info("seek to {:.3f}s ({}), demuxer at {:.3f}s, index {} keyframes",
+               request.seconds,
+               request.mode == SeekMode::kAccurate ? "accurate" : "keyframe",
+               seek_ts * seconds_per_tick, keyframe_index_.size());
+
+  std::lock_guard<std::mutex> lock(seek_mutex_);
+  if (seek_request_.id == request.id) {
+    seek_pending_ = false;
+  }
+}
+
+bool VideoCodec::IsStale(const AVFrame* frame) const {
+  return seek_pending_ || FrameSerial(frame) != seek_serial_;
 }
 
 void VideoCodec::PauseCodec(bool pause) {
+  paused_ = pause;
   if (pause) {
-    fq_.lock();
-    afq_.lock();
+    // 只停消费：队列不锁，解码器照样往里放，满了自然停下。
+    // 记下暂停时的主时钟。声卡停了，墙上时钟还在走，恢复时从这里接着走
+    video_strand_.Post([this] {
+      bool audio_master = false;
+      video_pause_clock_ =
+          wall_clock_us_ >= 0 ? MasterClock(&audio_master) : NAN;
+    });
   } else {
-    fq_.clear();
-    afq_.clear();
-    fq_.unlock();
-    afq_.unlock();
+    resume_us_ = av_gettime_relative();
+    {
+      std::lock_guard<std::mutex> lock(step_mutex_);
+      pending_steps_ = 0;
+      reverse_ = false;
+    }
+    if (playback_rate_ < 0) {
+      playback_rate_ = 1;
+    }
+    if (stepped_.exchange(false) && !seek_pending_) {
+      // 逐帧/倒放挪过位置，正向播放从显示的这一帧接着走。
+      // 还有没处理完的 seek 时以它为准，不能被这里覆盖
+      Seek(position_, SeekMode::kAccurate);
+    }
+    // 队列、解码器里的帧和输出端的 PCM 都留着，不重解
+    video_strand_.Post([this] {
+      if (!std::isnan(video_pause_clock_) && wall_clock_us_ >= 0) {
+        ResetWallClock(video_pause_clock_);
+      }
+      video_pause_clock_ = NAN;
+      PresentDueFrames();
+    });
+    KickAudio();
+    WakeDecoder(false);
+    WakeDecoder(true);
   }
 }
 
-void VideoCodec::Codec(const std::string& file_path) {
-  spdlog::info("start Codec");
+void VideoCodec::RefreshFrame() {
+  if (!paused_ || refresh_pending_.exchange(true)) {
+    return;
+  }
+  video_strand_.Post([this] {
+    refresh_pending_ = false;
+    std::lock_guard<std::mutex> lock(present_mutex_);
+    if (paused_ && !stop_requested_ && last_presented_frame_ && listener_) {
+      listener_->OnVideoFrame(last_presented_frame_);
+    }
+  });
+}
 
-  const char* video_path = file_path.c_str();
-  AVFormatContext* pFormatCtx = NULL;
-  if (avformat_open_input(&pFormatCtx, video_path, NULL, NULL) != 0) {
-    printf("avformat_open_input error\n");
+void VideoCodec::StepFrame(int frames) {
+  if (!paused_) {
+    spdlog::debug("step ignored: not paused");
     return;
   }
+  std::lock_guard<std::mutex> lock(step_mutex_);
+  pending_steps_ += frames;
+  step_cv_.notify_all();
+}
 
-  if (avformat_find_stream_info(pFormatCtx, NULL) < 0) {
-    printf("avformat_find_stream_info error\n");
+void VideoCodec::SetReversePlayback(bool reverse) {
+  if (reverse && !paused_) {
+    PauseCodec(true);
+  }
+  std::lock_guard<std::mutex> lock(step_mutex_);
+  reverse_ = reverse;
+  reverse_rate_ = 1;
+  pending_steps_ = 0;
+  playback_rate_ = reverse ? -1 : 1;
+  step_cv_.notify_all();
+  if (!reverse) {
+    LogGopCacheStats();
+  }
+}
+
+void VideoCodec::SetPlaybackRate(double rate) {
+  if (rate <= -1) {
+    double speed = std::min(-rate, kMaxPlaybackRate);
+    // 倒放走逐帧线程，正向播放暂停
+    SetReversePlayback(true);
+    std::lock_guard<std::mutex> lock(step_mutex_);
+    reverse_rate_ = speed;
+    playback_rate_ = -speed;
+    spdlog::info("playback rate -{}x", speed);
     return;
   }
 
-  int video_stream_index = -1;
-  int audio_stream_index = -1;
-  //  int audio_stream_index = -1;
-  for (int i = 0; i < pFormatCtx->nb_streams; ++i) {
-    if (pFormatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-      video_stream_index = i;
+  double speed = std::min(std::max(rate, kMinPlaybackRate), kMaxPlaybackRate);
+  if (playback_rate_ < 0) {
+    // 从倒放切回正向，逐帧线程先停下
+    SetReversePlayback(false);
+  }
+  double old_rate = playback_rate_.exchange(speed);
+  spdlog::info("playback rate {}x", speed);
+  if (AudioMuted(speed) && !AudioMuted(old_rate) && listener_) {
+    // 快放不出声音，输出端还没播的也不要了
+    afq_.clear();
+    KickAudio();
+    listener_->OnSeek();
+  } else if (!AudioMuted(speed) && old_rate > kMaxStretchRate) {
+    // 回到有声音的速度：从当前位置重新解，声音和被跳过的帧都接上
+    Seek(Position(), SeekMode::kAccurate);
+  }
+  // 变速范围内不清队列也不重解：已经排队的音频帧按新倍速拉伸，
+  // 视频按音频时钟走
+  // 主时钟换走速要在送显任务里做，从当前时刻接着走不跳
+  video_strand_.Post([this, speed] {
+    if (wall_clock_us_ >= 0) {
+      bool audio_master = false;
+      ResetWallClock(MasterClock(&audio_master));
+    }
+    video_rate_ = speed;
+    PresentDueFrames();
+  });
+}
+
+void VideoCodec::StepLoop() {
+  // 第一次用到才打开，不逐帧的话不多占一份解封装和解码器
+  std::unique_ptr<GopDecoder> gop_decoder;
+  bool gop_decoder_failed = false;
+  auto next_reverse_frame = std::chrono::steady_clock::now();
+
+  std::unique_lock<std::mutex> lock(step_mutex_);
+  while (!stop_requested_) {
+    if (pending_steps_ == 0 && !reverse_) {
+      step_cv_.wait(lock, [this] {
+        return stop_requested_ || pending_steps_ != 0 || reverse_;
+      });
+      next_reverse_frame = std::chrono::steady_clock::now();
+      continue;
+    }
+    if (pending_steps_ == 0 &&
+        step_cv_.wait_until(lock, next_reverse_frame, [this] {
+          return stop_requested_ || pending_steps_ != 0 || !reverse_;
+        })) {
+      continue;
+    }
+
+    int direction = -1;
+    if (pending_steps_ != 0) {
+      direction = pending_steps_ > 0 ? 1 : -1;
+      pending_steps_ -= direction;
+    }
+    bool reverse_step = reverse_ && direction < 0;
+    double speed = reverse_step ? reverse_rate_ : 1;
+    // 快速倒放逐帧解整个 GOP 太贵，每次直接退到前一个关键帧
+    bool keyframes_only = reverse_step && speed >= kNonRefRate;
+    lock.unlock();
+
+    if (!gop_decoder && !gop_decoder_failed) {
+      gop_decoder.reset(new GopDecoder(&gop_cache_, &keyframe_index_));
+      if (!gop_decoder->Open(file_path_, BudgetedOptions())) {
+        gop_decoder.reset();
+        gop_decoder_failed = true;
+      }
     }
-    if (pFormatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
-      audio_stream_index = i;
+    double elapsed = -1;
+    if (gop_decoder) {
+      gop_decoder->SetKeyframesOnly(keyframes_only);
+      elapsed = keyframes_only ? RewindKeyframe(gop_decoder.get())
+                               : StepOnce(gop_decoder.get(), direction);
+    }
+
+    lock.lock();
+    if (elapsed < 0) {
+      pending_steps_ = 0;
+      if (reverse_) {
+        reverse_ = false;
+        reverse_rate_ = 1;
+        playback_rate_ = 1;
+        spdlog::info("reverse playback reached the start");
+        LogGopCacheStats();
+      }
+    } else if (reverse_step) {
+      // 按两帧的时间差（倍速下按比例缩短）排下一帧，解码跟不上时不追赶
+      next_reverse_frame =
+          std::max(next_reverse_frame +
+                       std::chrono::microseconds(
+                           static_cast<int64_t>(elapsed * 1000000 / speed)),
+                   std::chrono::steady_clock::now());
     }
   }
-  
-  if (video_stream_index == -1) {
-    spdlog::error("no video found");
-    listener_->OnMediaError();
-    return;
+}
+
+double VideoCodec::StepOnce(GopDecoder* gop_decoder, int direction) {
+  int64_t current = position_pts_;
+  if (current == AV_NOPTS_VALUE) {
+    return -1;
   }
 
-  stream_time_base_ = pFormatCtx->streams[video_stream_index]->time_base;
-  audio_stream_time_base_ = pFormatCtx->streams[audio_stream_index]->time_base;
-  stream_time_base_ready_ = true;
+  AVFramePtr frame;
+  int64_t gop_start = 0;
+  auto lookup = [&] {
+    return direction < 0
+               ? gop_cache_.FrameBefore(current, &frame, &gop_start)
+               : gop_cache_.FrameAfter(current, &frame, &gop_start);
+  };
+  GopCache::Lookup result = lookup();
+  if (result == GopCache::Lookup::kMiss &&
+      gop_decoder->DecodeNow(gop_start)) {
+    result = lookup();
+  }
+  if (result != GopCache::Lookup::kHit) {
+    // 解过一遍还找不到，说明前面/后面已经没有帧
+    return -1;
+  }
+
+  int64_t ts = frame->pts;
+  PresentFrame(std::move(frame));
+  position_pts_ = ts;
+  position_ = ts * av_q2d(stream_time_base_);
+  stepped_ = true;
+
+  // 后退时提前把前一个 GOP 解好，前进时提前解后一个
+  int64_t neighbor = 0;
+  if (direction < 0) {
+    gop_decoder->Prefetch(gop_start - 1);
+  } else if (keyframe_index_.Next(gop_start, &neighbor)) {
+    gop_decoder->Prefetch(neighbor);
+  }
+
+  GopCache::Stats stats = gop_cache_.stats();
+  if ((stats.hits + stats.misses) % kGopLogInterval == 0) {
+    LogGopCacheStats();
+  }
+  return std::fabs(ts - current) * av_q2d(stream_time_base_);
+}
 
-  const AVCodec* codec = avcodec_find_decoder(
-      pFormatCtx->streams[video_stream_index]->codecpar->codec_id);
-  AVCodecContext* pCodecCtx = avcodec_alloc_context3(codec);
-  avcodec_parameters_to_context(
-      pCodecCtx, pFormatCtx->streams[video_stream_index]->codecpar);
+double VideoCodec::RewindKeyframe(GopDecoder* gop_decoder) {
+  int64_t current = position_pts_;
+  int64_t keyframe = 0;
+  if (current == AV_NOPTS_VALUE) {
+    return -1;
+  }
+  if (!keyframe_index_.Floor(current - 1, &keyframe)) {
+    // 索引里没有更早的关键帧，退回逐帧，到头时返回 -1
+    return StepOnce(gop_decoder, -1);
+  }
+
+  // 完整 GOP 和只有关键帧的缓存都能直接取到这一帧
+  AVFramePtr frame;
+  int64_t gop_start = 0;
+  GopCache::Lookup result = gop_cache_.FrameAt(keyframe, &frame, &gop_start);
+  if (result == GopCache::Lookup::kMiss && gop_decoder->DecodeNow(keyframe)) {
+    result = gop_cache_.FrameAt(keyframe, &frame, &gop_start);
+  }
+  if (result != GopCache::Lookup::kHit) {
+    return -1;
+  }
 
-  const AVCodec* audio_codec = avcodec_find_decoder(
-      pFormatCtx->streams[audio_stream_index]->codecpar->codec_id);
-  AVCodecContext* pAudioCodecCtx = avcodec_alloc_context3(audio_codec);
-  avcodec_parameters_to_context(
-      pAudioCodecCtx, pFormatCtx->streams[audio_stream_index]->codecpar);
+  int64_t ts = frame->pts;
+  PresentFrame(std::move(frame));
+  position_pts_ = ts;
+  position_ = ts * av_q2d(stream_time_base_);
+  stepped_ = true;
+
+  int64_t previous = 0;
+  if (keyframe_index_.Floor(ts - 1, &previous)) {
+    gop_decoder->Prefetch(previous);
+  }
+  return std::fabs(current - ts) * av_q2d(stream_time_base_);
+}
 
-  if (avcodec_open2(pCodecCtx, codec, NULL) < 0) {
-    fprintf(stderr, "Could not open codec\n");
-    return; 
+void VideoCodec::PresentFrame(AVFramePtr frame) {
+  std::lock_guard<std::mutex> lock(present_mutex_);
+  last_presented_frame_ = frame;
+  if (listener_) {
+    listener_->OnVideoFrame(std::move(frame));
   }
+}
 
-  if (avcodec_open2(pAudioCodecCtx, audio_codec, NULL) < 0) {
-    fprintf(stderr, "Could not open audio codec\n");
+void VideoCodec::LogGopCacheStats() {
+  GopCache::Stats stats = gop_cache_.stats();
+  uint64_t lookups = stats.hits + stats.misses;
+  if (lookups == 0) {
     return;
   }
+  spdlog::info(
+      "gop cache: hit rate {:.1f}% ({}/{}), {} GOPs, {:.1f}/{:.1f} MB, "
+      "{} evictions",
+      100.0 * stats.hits / lookups, stats.hits, lookups, stats.gops,
+      stats.bytes / 1048576.0, stats.budget / 1048576.0, stats.evictions);
+}
 
-  AVPacket pkt;
-  auto frame = createAVFramePtr();
-  uint64_t idx = 0;
+void VideoCodec::Codec(const std::string& file_path) {
+  spdlog::info("start Codec");
 
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
+  AVFormatContext* pFormatCtx = NULL;
+  std::unique_ptr<LocalFileIO> file_io;
+  if (OpenMediaInput(file_path, options_.file_io, options_.read_ahead_bytes,
+                     &pFormatCtx, &file_io) != 0) {
+    spdlog::error("avformat_open_input error: {}", file_path);
+    listener_->OnMediaError();
+    return;
+  }
+  MarkStartup(StartupStage::kOpen);
+  {
+    // 要比 pFormatCtx 活得久，交给成员，StopCodec 时再释放
+    std::lock_guard<std::mutex> lock(file_io_mutex_);
+    file_io_ = std::move(file_io);
+  }
 
-  while (av_read_frame(pFormatCtx, &pkt) >= 0 && !stop_requested_) {
-    if (pkt.stream_index == audio_stream_index) {
-      if (avcodec_send_packet(pAudioCodecCtx, &pkt) == 0) {
-        int ret = avcodec_receive_frame(pAudioCodecCtx, frame.get());
-        if (ret == 0) {
-          auto frame_to_cb = createAVFramePtr();
+  if (options_.fast_start) {
+    // 默认要读 5MB、分析 5 秒，本地文件的参数早就齐了
+    pFormatCtx->probesize = kFastProbeBytes;
+    pFormatCtx->max_analyze_duration = kFastAnalyzeUs;
+  }
+  if (avformat_find_stream_info(pFormatCtx, NULL) < 0) {
+    spdlog::error("avformat_find_stream_info error: {}", file_path);
+    avformat_close_input(&pFormatCtx);
+    listener_->OnMediaError();
+    return;
+  }
+  MarkStartup(StartupStage::kProbe);
 
-          if (av_frame_copy_props(frame_to_cb.get(), frame.get()) < 0) {
-            continue;
-          }
+  int video_stream_index = av_find_best_stream(pFormatCtx, AVMEDIA_TYPE_VIDEO,
+                                               -1, -1, NULL, 0);
+  int audio_stream_index =
+      options_.decode_audio
+          ? av_find_best_stream(pFormatCtx, AVMEDIA_TYPE_AUDIO, -1,
+                                video_stream_index, NULL, 0)
+          : -1;
 
-          frame_to_cb->format = frame->format;
-          frame_to_cb->channel_layout = frame->channel_layout;
-          frame_to_cb->nb_samples = frame->nb_samples;
-          frame_to_cb->sample_rate = frame->sample_rate;
+  if (video_stream_index < 0) {
+    spdlog::error("no video found");
+    avformat_close_input(&pFormatCtx);
+    listener_->OnMediaError();
+    return;
+  }
 
-          if (av_frame_get_buffer(frame_to_cb.get(), 32) < 0) {
-            continue;
-          }
+  // 不播放的流直接让 demuxer 丢掉
+  for (unsigned int i = 0; i < pFormatCtx->nb_streams; ++i) {
+    if ((int)i != video_stream_index && (int)i != audio_stream_index) {
+      pFormatCtx->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
 
-          if (av_frame_copy(frame_to_cb.get(), frame.get()) < 0) {
-            continue;
-          }
+  if (audio_stream_index >= 0 && listener_) {
+    // 打开声卡要几十毫秒，和下面打开解码器同时进行
+    const AVCodecParameters* audio_params =
+        pFormatCtx->streams[audio_stream_index]->codecpar;
+    if (audio_params->sample_rate > 0 && audio_params->channels > 0 &&
+        audio_params->format >= 0) {
+      listener_->OnAudioStreamInfo(audio_params->sample_rate,
+                                   audio_params->channels,
+                                   audio_params->format);
+    }
+  }
 
-          if (av_frame_copy_props(frame_to_cb.get(), frame.get()) < 0) {
-            continue;
-          }
+  StreamDecoder video_decoder("video", &frame_pool_, &copy_meter_,
+                              kMaxVideoPackets, TaskPriority::kNormal);
+  if (!video_decoder.Open(pFormatCtx->streams[video_stream_index],
+                          BudgetedOptions())) {
+    avformat_close_input(&pFormatCtx);
+    listener_->OnMediaError();
+    return;
+  }
 
-          OnAudioFrame(std::move(frame_to_cb));
-        }
-      }
-    } else if (pkt.stream_index == video_stream_index) {
-      if (avcodec_send_packet(pCodecCtx, &pkt) == 0) {
-        int ret = avcodec_receive_frame(pCodecCtx, frame.get());
+  std::unique_ptr<StreamDecoder> audio_decoder;
+  if (audio_stream_index >= 0) {
+    audio_decoder.reset(new StreamDecoder("audio", &frame_pool_, &copy_meter_,
+                                          kMaxAudioPackets,
+                                          TaskPriority::kAudio));
+    // 音频解码很轻，不需要多线程
+    DecoderOptions audio_options;
+    audio_options.thread_count = 1;
+    if (!audio_decoder->Open(pFormatCtx->streams[audio_stream_index],
+                             audio_options)) {
+      spdlog::warn("audio disabled");
+      audio_decoder.reset();
+      pFormatCtx->streams[audio_stream_index]->discard = AVDISCARD_ALL;
+      audio_stream_index = -1;
+    }
+  }
 
-        if (ret == 0) {
-          int width = frame->width;
-          int height = frame->height;
-          if (width <= 0 || height <= 0) {
-            continue;
-          }
+  MarkStartup(StartupStage::kDecoders);
+  video_strand_.Post([this] { quality_.Reset(av_gettime_relative()); });
 
-          auto frame_to_cb = createAVFramePtr();
+  size_t indexed = keyframe_index_.ImportFromStream(
+      pFormatCtx->streams[video_stream_index]);
+  spdlog::info("keyframe index: {} entries from container", indexed);
 
-          if (av_frame_copy_props(frame_to_cb.get(), frame.get()) < 0) {
-            continue;
-          }
+  // 解码器交帧之前设好，送显/音频任务都由帧触发，不用再轮询等它
+  stream_time_base_ = video_decoder.time_base();
+  if (audio_decoder) {
+    audio_stream_time_base_ = audio_decoder->time_base();
+  }
 
-          frame_to_cb->format =
-              pFormatCtx->streams[video_stream_index]->codecpar->format;
-          frame_to_cb->width = frame->width;
-          frame_to_cb->height = frame->height;
+  video_decoder.set_latency_histogram(
+      pipeline_stats_.histogram(PipelineStage::kVideoDecode));
+  if (audio_decoder) {
+    audio_decoder->set_latency_histogram(
+        pipeline_stats_.histogram(PipelineStage::kAudioDecode));
+  }
 
-          int r = av_frame_get_buffer(frame_to_cb.get(), 32);
+  // 回调在解码任务里执行；返回 false 时同一帧之后会再交一次，判断要可重入
+  video_decoder.Start([this, &video_decoder](const AVFramePtr& frame) {
+    // 精确 seek：目标之前的帧只是为了把解码器带到目标位置
+    if (frame->width > 0 && frame->height > 0 &&
+        !(FrameSeconds(frame.get(), stream_time_base_) < seek_floor_)) {
+      MarkStartup(StartupStage::kFirstDecode);
+      SetFrameSerial(frame.get(), video_decoder.serial());
+      if (!OnFrame(frame)) {
+        return false;
+      }
+    }
+    decode_fps_meter_.Add(1);
+    ++decoded_frames_;
+    return true;
+  });
+  if (audio_decoder) {
+    StreamDecoder* decoder = audio_decoder.get();
+    audio_decoder->Start([this, decoder](const AVFramePtr& frame) {
+      double end = AudioFrameSeconds(frame.get());
+      if (frame->sample_rate > 0) {
+        end += static_cast<double>(frame->nb_samples) / frame->sample_rate;
+      }
+      if (end <= seek_floor_ || AudioMuted(playback_rate_)) {
+        return true;  // 快放时已经解出来的声音也不要
+      }
+      SetFrameSerial(frame.get(), decoder->serial());
+      return OnAudioFrame(frame);
+    });
+  }
+  {
+    std::lock_guard<std::mutex> lock(decoders_mutex_);
+    video_decoder_ = &video_decoder;
+    audio_decoder_ = audio_decoder.get();
+  }
 
-          if (av_frame_copy(frame_to_cb.get(), frame.get()) < 0) {
-            continue;
-          }
+  uint64_t idx = 0;
+  bool eof = false;
+  bool elapsed_reported = false;
+  bool eos_reported = false;
+  AVDiscard video_discard = AVDISCARD_DEFAULT;
+  SeekRequest seek_request;
+
+  while (!stop_requested_) {
+    if (TakeSeekRequest(&seek_request)) {
+      HandleSeek(pFormatCtx, video_stream_index, seek_request, &video_decoder,
+                 audio_decoder.get());
+      eof = false;
+      continue;
+    }
+    if (eof) {
+      if (!eos_reported && video_decoder.eof_drained()) {
+        // 视频帧都交给队列了，送显任务显示完最后一帧时通知 listener
+        eos_reported = true;
+        eos_pending_ = true;
+        KickVideo();
+      }
+      // 播完了，解码线程都留着，等 seek 回去或者停止
+      std::unique_lock<std::mutex> lock(seek_mutex_);
+      seek_cv_.wait_for(lock, std::chrono::milliseconds(100),
+                        [this] { return stop_requested_ || seek_pending_; });
+      continue;
+    }
 
-          if (av_frame_copy_props(frame_to_cb.get(), frame.get()) < 0) {
-            continue;
-          }
+    if (budget_->QueueOverBudget(video_queue_budget_.bytes() +
+                                 audio_queue_budget_.bytes())) {
+      // 所有会话的帧队列加起来超了预算，这个会话又占得多：先别读，
+      // 等自己的队列消费掉一些。seek 和停止照样能叫醒
+      ++demux_throttles_;
+      std::unique_lock<std::mutex> lock(seek_mutex_);
+      seek_cv_.wait_for(lock, std::chrono::milliseconds(kThrottleWaitMs),
+                        [this] { return stop_requested_ || seek_pending_; });
+      continue;
+    }
 
-          OnFrame(std::move(frame_to_cb));  // call back!
-        }
+    AVPacketPtr pkt = createAVPacketPtr();
+    int64_t read_start_us = av_gettime_relative();
+    int read_ret = av_read_frame(pFormatCtx, pkt.get());
+    pipeline_stats_.Record(PipelineStage::kPacketRead,
+                           av_gettime_relative() - read_start_us);
+    if (read_ret < 0) {
+      // EOF：让解码线程把缓存在解码器里的帧全部吐出来
+      video_decoder.PushEof();
+      if (audio_decoder) {
+        audio_decoder->PushEof();
       }
+      eof = true;
+      eos_reported = false;
+      if (!elapsed_reported) {
+        elapsed_reported = true;
+        // 和启动耗时一样从会话开始算
+        spdlog::info("demuxed to end of file in {:.2f}s",
+                     (av_gettime_relative() - start_us_) / 1000000.0);
+      }
+      continue;
     }
-    av_packet_unref(&pkt);
+    if (pkt->stream_index == video_stream_index) {
+      bool key = pkt->flags & AV_PKT_FLAG_KEY;
+      if (key) {
+        keyframe_index_.Add(pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts);
+      }
+      // 快放按倍速调解码器的丢帧级别。从只解关键帧往下切要等到关键帧，
+      // 否则前面没有参考帧，解出来是花的
+      AVDiscard discard = TrickDiscard(playback_rate_);
+      if (discard != video_discard &&
+          (video_discard != AVDISCARD_NONKEY || key)) {
+        video_discard = discard;
+        video_decoder.set_skip_frame(discard);
+      }
+      if (video_discard == AVDISCARD_NONKEY && !key) {
+        // 反正不解，不用送进解码队列
+        continue;
+      }
+      video_decoder.PushPacket(std::move(pkt));
+    } else if (pkt->stream_index == audio_stream_index) {
+      if (AudioMuted(playback_rate_)) {
+        continue;  // 快放不出声音，音频包不解
+      }
+      audio_decoder->PushPacket(std::move(pkt));
+    }
+
+    uint64_t copied_per_second = copy_meter_.BytesPerSecond();
+    if (copied_per_second > 0 && ++idx % 256 == 0) {
+      spdlog::warn("frame data copied: {} bytes/s", copied_per_second);
+    }
+  }
+
+  {
+    // 之后没有人再 Wake 它们
+    std::lock_guard<std::mutex> lock(decoders_mutex_);
+    video_decoder_ = nullptr;
+    audio_decoder_ = nullptr;
+  }
+  video_decoder.Abort();
+  if (audio_decoder) {
+    audio_decoder->Abort();
+  }
+  video_decoder.Join();
+  if (audio_decoder) {
+    audio_decoder->Join();
   }
 
-  gettimeofday(&end, NULL);
-  double elapsedTime =
-      (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
-  printf("Elapsed time: %.2f seconds\n", elapsedTime);
+  double decode_seconds = video_decoder.decode_time_us() / 1000000.0;
+  spdlog::info("video decoded {} frames, {:.2f}s in decoder, {:.1f} fps",
+               video_decoder.decoded_frames(), decode_seconds,
+               decode_seconds > 0
+                   ? video_decoder.decoded_frames() / decode_seconds
+                   : 0.0);
 
   // free
-  avcodec_free_context(&pCodecCtx);
   avformat_close_input(&pFormatCtx);
 }
 
-void VideoCodec::ProcessFrameFromQueue() {
-  AVFramePtr frame;
-  while (!stream_time_base_ready_) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+double VideoCodec::AudioFrameSeconds(const AVFrame* frame) const {
+  return FrameSeconds(frame, audio_stream_time_base_);
+}
+
+void VideoCodec::MarkStartup(StartupStage stage) {
+  std::atomic<int64_t>& slot = startup_us_[static_cast<int>(stage)];
+  if (slot.load(std::memory_order_relaxed) >= 0) {
+    return;
+  }
+  int64_t expected = -1;
+  if (!slot.compare_exchange_strong(expected,
+                                    av_gettime_relative() - start_us_)) {
+    return;
+  }
+  if (stage == StartupStage::kFirstFrame) {
+    StartupStats s = GetStartupStats();
+    spdlog::info(
+        "time to first frame: {:.1f}ms (open {:.1f}, probe {:.1f}, "
+        "decoders {:.1f}, first decode {:.1f})",
+        s.first_frame_ms, s.open_ms, s.probe_ms, s.decoders_ms,
+        s.first_decode_ms);
   }
+}
 
-  while ((frame = fq_.pop())) {
-    if (frame->pts != AV_NOPTS_VALUE) {
-      double time = av_q2d(stream_time_base_) * frame->pts;
-      if (frame->pts == 0) {
-        listener_->OnVideoFrame(std::move(frame));
+StartupStats VideoCodec::GetStartupStats() {
+  auto ms = [this](StartupStage stage) {
+    int64_t us = startup_us_[static_cast<int>(stage)];
+    return us < 0 ? -1.0 : us / 1000.0;
+  };
+  StartupStats stats;
+  stats.open_ms = ms(StartupStage::kOpen);
+  stats.probe_ms = ms(StartupStage::kProbe);
+  stats.decoders_ms = ms(StartupStage::kDecoders);
+  stats.first_decode_ms = ms(StartupStage::kFirstDecode);
+  stats.first_frame_ms = ms(StartupStage::kFirstFrame);
+  stats.first_audio_ms = ms(StartupStage::kFirstAudio);
+  return stats;
+}
 
-        continue;
-      }
+SyncStats VideoCodec::GetSyncStats() {
+  std::lock_guard<std::mutex> lock(sync_stats_mutex_);
+  return sync_stats_;
+}
 
-      WaitForFrameAudio(time);
+void VideoCodec::ResetWallClock(double pts) {
+  wall_clock_pts_ = pts;
+  wall_clock_us_ = av_gettime_relative();
+}
 
-      listener_->OnVideoFrame(std::move(frame));
+double VideoCodec::MasterClock(bool* audio_master) {
+  *audio_master = false;
+  if (!AudioMuted(video_rate_)) {
+    // 变速时音频时钟本身按倍速走
+    bool fresh = false;
+    double audio_time = audio_clock_.Now(&fresh);
+    *audio_master = fresh;
+    if (fresh) {
+      // 墙上时钟一直对齐到音频，音频断了（播完、卡住）可以无缝接上
+      ResetWallClock(audio_time);
+      return audio_time;
     }
-    frame = nullptr;
   }
+  // 没有声音时按墙上时钟的倍速走
+  return wall_clock_pts_ +
+         (av_gettime_relative() - wall_clock_us_) / 1000000.0 * video_rate_;
+}
 
-  spdlog::info("decode ended");
+void VideoCodec::UpdateSyncStats(double drift, bool audio_master,
+                                 bool dropped, bool repeated) {
+  std::lock_guard<std::mutex> lock(sync_stats_mutex_);
+  sync_stats_.audio_master = audio_master;
+  if (dropped) {
+    ++sync_stats_.dropped;
+    return;
+  }
+  ++sync_stats_.presented;
+  if (drift < -kLateToleranceSeconds) {
+    ++sync_stats_.late;
+  }
+  if (repeated) {
+    ++sync_stats_.repeated;
+  }
+  sync_stats_.drift = drift;
+  if (std::fabs(drift) > std::fabs(sync_stats_.max_drift)) {
+    sync_stats_.max_drift = drift;
+  }
+  if (sync_stats_.presented % kSyncLogInterval == 0) {
+    spdlog::info(
+        "av sync: master={} drift={:.1f}ms max={:.1f}ms presented={} "
+        "dropped={} late={} repeated={}",
+        audio_master ? "audio" : "wall", drift * 1000,
+        sync_stats_.max_drift * 1000, sync_stats_.presented,
+        sync_stats_.dropped, sync_stats_.late, sync_stats_.repeated);
+  }
 }
 
-void VideoCodec::ProcessAudioFrameFromQueue() {
-  AVFramePtr frame;
-  while (!stream_time_base_ready_) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+void VideoCodec::RecordSeekLatency() {
+  double latency = (av_gettime_relative() - seek_start_us_) / 1000000.0;
+  std::lock_guard<std::mutex> lock(sync_stats_mutex_);
+  ++sync_stats_.seeks;
+  sync_stats_.last_seek_latency = latency;
+  sync_stats_.max_seek_latency =
+      std::max(sync_stats_.max_seek_latency, latency);
+  spdlog::info("seek latency {:.1f}ms (max {:.1f}ms, {} seeks)",
+               latency * 1000, sync_stats_.max_seek_latency * 1000,
+               sync_stats_.seeks);
+}
+
+void VideoCodec::RecordResumeLatency(int64_t latency_us) {
+  double latency = latency_us / 1000000.0;
+  std::lock_guard<std::mutex> lock(sync_stats_mutex_);
+  ++sync_stats_.resumes;
+  sync_stats_.last_resume_latency = latency;
+  sync_stats_.max_resume_latency =
+      std::max(sync_stats_.max_resume_latency, latency);
+  spdlog::info("resume latency {:.1f}ms (max {:.1f}ms, {} resumes)",
+               latency * 1000, sync_stats_.max_resume_latency * 1000,
+               sync_stats_.resumes);
+}
+
+void VideoCodec::UpdateDecodeQuality(double late, bool dropped) {
+  if (!options_.adaptive_quality || video_rate_ != 1) {
+    return;  // 快放/慢放时的丢帧和迟到不代表解码负载
+  }
+  // 按字节和按时长哪个先到上限，就按哪个算填充率
+  double fill = 0;
+  if (options_.video_queue_bytes > 0) {
+    fill = static_cast<double>(video_queue_budget_.bytes()) /
+           options_.video_queue_bytes;
   }
+  if (options_.video_queue_seconds > 0) {
+    fill = std::max(fill, video_queue_budget_.seconds() /
+                              options_.video_queue_seconds);
+  }
+  int old_level = quality_.level();
+  if (!quality_.OnFrame(av_gettime_relative(), late, dropped, fill)) {
+    return;
+  }
+  int level = quality_.level();
+  spdlog::info("decode quality {} -> {} ({}/{}): {}",
+               DecodeQualityController::Settings(old_level).name,
+               DecodeQualityController::Settings(level).name, level,
+               quality_.max_level(), quality_.reason());
+  decode_quality_ = level;
+  std::lock_guard<std::mutex> lock(decoders_mutex_);
+  if (video_decoder_) {
+    video_decoder_->set_quality(DecodeQualityController::Settings(level));
+  }
+}
 
-  while ((frame = afq_.pop())) {
-    if (frame->pts != AV_NOPTS_VALUE) {
-      double time = av_q2d(audio_stream_time_base_) * frame->pts;
-      if (frame->pts == 0) {
-        listener_->OnAudioFrame(std::move(frame));
-        continue;
-      }
+void VideoCodec::MaybeLogStats() {
+  int64_t now_us = av_gettime_relative();
+  if (now_us - stats_log_us_ < kStatsLogIntervalUs) {
+    return;
+  }
+  stats_log_us_ = now_us;
+  spdlog::info("latency p50/p99/max ms: {}",
+               PipelineStats::FormatSummary(pipeline_stats_.GetSnapshot()));
+  spdlog::info(
+      "frame queues: video {:.1f} MB / {:.2f}s, audio {:.1f} MB / {:.2f}s, "
+      "all sessions {:.1f} MB, {} demux throttles",
+      video_queue_budget_.bytes() / 1048576.0, video_queue_budget_.seconds(),
+      audio_queue_budget_.bytes() / 1048576.0, audio_queue_budget_.seconds(),
+      budget_->queued_bytes() / 1048576.0, demux_throttles_.load());
+}
 
-      WaitForFrame(time);
+void VideoCodec::KickVideo() {
+  if (!video_kicked_.exchange(true)) {
+    video_strand_.Post([this] {
+      video_kicked_ = false;
+      PresentDueFrames();
+    });
+  }
+}
 
-      listener_->OnAudioFrame(std::move(frame));
+bool VideoCodec::TakeVideoFrame() {
+  while (true) {
+    std::optional<QueuedFrame> item = fq_.popOrEmpty();
+    if (item) {
+      // 先归还额度再叫醒解码器，不然它可能看到的还是满的
+      item->charge = FrameQueueBudget::Charge();
     }
-    frame = nullptr; 
+    // 取过（包括 clear 掉旧帧）就可能腾出了空间
+    WakeDecoder(false);
+    if (!item) {
+      return false;  // 队列空，等解码器交帧时再排
+    }
+    if (!item->frame || IsStale(item->frame.get())) {
+      continue;
+    }
+    pipeline_stats_.Record(PipelineStage::kVideoQueueWait,
+                           av_gettime_relative() - item->enqueue_us);
+    video_frame_ = std::move(item->frame);
+    break;
   }
 
-  spdlog::info("audio decode ended");
+  video_first_after_seek_ = false;
+  if (FrameSerial(video_frame_.get()) != video_serial_) {
+    // seek 之后的第一帧，按新位置重新对齐
+    video_serial_ = FrameSerial(video_frame_.get());
+    wall_clock_us_ = -1;
+    video_last_pts_ = NAN;
+    video_first_after_seek_ = true;
+  }
+  double pts = FrameSeconds(video_frame_.get(), stream_time_base_);
+  video_frame_duration_ = (!std::isnan(video_last_pts_) && pts > video_last_pts_)
+                              ? pts - video_last_pts_
+                              : kDefaultFrameDuration;
+  video_frame_pts_ = pts;
+  if (!std::isnan(pts)) {
+    video_last_pts_ = pts;
+    if (wall_clock_us_ < 0) {
+      // 第一帧，音频还没起来时以它为起点
+      ResetWallClock(pts);
+    }
+  }
+  return true;
 }
 
-void VideoCodec::WaitForFrame(double frame_time) {
-  int64_t frame_time_us = static_cast<int64_t>(frame_time * 1000000.0);
-
-  if (is_first_frame_) {
-    first_frame_time_us_ = av_gettime();
-    is_first_frame_ = false;
+void VideoCodec::PresentDueFrames() {
+  if (paused_) {
+    PresentPausedSeekFrame();
+    return;
   }
+  // 暂停时已经取出来的帧也留着，恢复后先显示它
+  while (!stop_requested_ && !paused_) {
+    if (!video_frame_ && !TakeVideoFrame()) {
+      if (eos_pending_ && fq_.empty() && eos_pending_.exchange(false) &&
+          listener_) {
+        listener_->OnEndOfStream();
+      }
+      return;
+    }
+    if (IsStale(video_frame_.get())) {
+      // 等待期间发生了 seek
+      video_frame_ = nullptr;
+      continue;
+    }
+
+    double pts = video_frame_pts_;
+    if (std::isnan(pts)) {
+      PresentFrame(std::move(video_frame_));
+      video_frame_ = nullptr;
+      continue;
+    }
 
-  int64_t now_us = av_gettime();
-  frame_time_us += first_frame_time_us_;
+    if (!options_.paced) {
+      // 不排期：到手就显示，一帧不丢
+      int64_t ts = FrameTimestamp(video_frame_.get());
+      PresentFrame(std::move(video_frame_));
+      video_frame_ = nullptr;
+      position_ = pts;
+      position_pts_ = ts;
+      MarkStartup(StartupStage::kFirstFrame);
+      UpdateSyncStats(0, false, false, false);
+      MaybeLogStats();
+      continue;
+    }
 
-  if (now_us < frame_time_us) {
-    int64_t wait_time_us = frame_time_us - now_us;
-    std::this_thread::sleep_for(std::chrono::microseconds(wait_time_us));
+    // 主时钟按倍速走，媒体时间差除以倍速才是要等的墙上时间
+    bool audio_master = false;
+    double remaining = (pts - MasterClock(&audio_master)) / video_rate_;
+    if (remaining > kMaxWaitSeconds) {
+      // 时间戳跳变，不值得等，直接按这一帧重新对齐
+      spdlog::warn("video pts jumped {:.3f}s ahead of clock", remaining);
+      ResetWallClock(pts);
+    } else if (remaining > kEarlySeconds) {
+      // 还没到时间：不占着工作线程等，排一个延时任务回来再看。
+      // 新排的会让之前排的失效，同一时刻只有一个在等
+      int64_t delay_us = std::min(static_cast<int64_t>(remaining * 1e6),
+                                  kMaxVideoTimerUs);
+      uint64_t timer = ++video_timer_;
+      video_strand_.PostAfter(delay_us, [this, timer] {
+        if (timer == video_timer_) {
+          PresentDueFrames();
+        }
+      });
+      return;
+    }
+
+    double late = MasterClock(&audio_master) - pts;
+    int64_t now_us = av_gettime_relative();
+    bool too_dense = video_rate_ > 1 &&
+                     now_us - video_last_present_us_ < kMinTrickFrameUs;
+    if ((late > kMaxLateSeconds * video_rate_ || too_dense) && !fq_.empty() &&
+        !video_first_after_seek_) {
+      // 已经赶不上了，或者快放时比屏幕能显示的还密：后面还有帧就直接丢
+      UpdateSyncStats(-late, audio_master, true, false);
+      UpdateDecodeQuality(late, true);
+      video_frame_ = nullptr;
+      continue;
+    }
+    video_last_present_us_ = now_us;
+
+    int64_t ts = FrameTimestamp(video_frame_.get());
+    PresentFrame(std::move(video_frame_));
+    video_frame_ = nullptr;
+    position_ = pts;
+    position_pts_ = ts;
+    MarkStartup(StartupStage::kFirstFrame);
+    if (resume_us_.load(std::memory_order_relaxed) >= 0) {
+      RecordResumeLatency(now_us - resume_us_.exchange(-1));
+    }
+    if (!video_first_after_seek_) {
+      UpdateDecodeQuality(late, false);
+    }
+    UpdateSyncStats(-late, audio_master, false, late > video_frame_duration_);
+    if (video_first_after_seek_ && seek_serial_ > 0) {
+      RecordSeekLatency();
+    }
+    MaybeLogStats();
   }
 }
 
-void VideoCodec::WaitForFrameAudio(double frame_time) {
-  int64_t frame_time_us = static_cast<int64_t>(frame_time * 1000000.0);
+void VideoCodec::PresentPausedSeekFrame() {
+  if (video_frame_ && IsStale(video_frame_.get())) {
+    video_frame_ = nullptr;
+  }
+  // 释放 seek 时 clear 掉的旧帧，解码器才有地方放新位置的帧
+  fq_.reclaim();
+  WakeDecoder(false);
+  // 只显示 seek 之后的第一帧，不往前播
+  if (video_frame_ || seek_pending_ || video_serial_ == seek_serial_ ||
+      !TakeVideoFrame()) {
+    return;
+  }
+  double pts = video_frame_pts_;
+  int64_t ts = FrameTimestamp(video_frame_.get());
+  PresentFrame(std::move(video_frame_));
+  video_frame_ = nullptr;
+  if (!std::isnan(pts)) {
+    position_ = pts;
+    position_pts_ = ts;
+    // 恢复播放时从这一帧接着走
+    video_pause_clock_ = pts;
+  }
+  RecordSeekLatency();
+}
 
-  if (is_first_audio_frame_) {
-    first_audio_frame_time_us_ = av_gettime();
-    is_first_audio_frame_ = false;
+void VideoCodec::KickAudio() {
+  if (!audio_kicked_.exchange(true)) {
+    audio_strand_.Post([this] {
+      audio_kicked_ = false;
+      DeliverAudioFrames();
+    });
   }
+}
 
-  int64_t now_us = av_gettime();
-  frame_time_us += first_audio_frame_time_us_;
+void VideoCodec::ResumeAudioOutput() { KickAudio(); }
 
-  if (now_us < frame_time_us) {
-    int64_t wait_time_us = frame_time_us - now_us;
-    std::this_thread::sleep_for(std::chrono::microseconds(wait_time_us));
+void VideoCodec::DeliverAudioFrames() {
+  // 不按时间等：输出端的 PCM 环就是缓冲，声卡的消费速度就是节奏。
+  // 暂停时声卡不取数据，直接停下，恢复播放时再排
+  if (paused_) {
+    // 只释放 seek 时 clear 掉的旧帧，音频解码器占满队列会把解封装堵住
+    afq_.reclaim();
+    WakeDecoder(true);
+    return;
+  }
+  while (!stop_requested_ && !paused_ && listener_) {
+    if (!audio_frame_) {
+      std::optional<QueuedFrame> item = afq_.popOrEmpty();
+      if (item) {
+        item->charge = FrameQueueBudget::Charge();
+      }
+      WakeDecoder(true);
+      if (!item) {
+        return;
+      }
+      if (item->frame) {
+        pipeline_stats_.Record(PipelineStage::kAudioQueueWait,
+                               av_gettime_relative() - item->enqueue_us);
+      }
+      audio_frame_ = std::move(item->frame);
+    }
+    if (!audio_frame_ || IsStale(audio_frame_.get())) {
+      audio_frame_ = nullptr;
+      continue;
+    }
+    AudioSinkState sink = listener_->GetAudioSinkState();
+    if (sink == AudioSinkState::kOpening) {
+      // 不轮询，输出端打开后会 ResumeAudioOutput
+      return;
+    }
+    if (sink == AudioSinkState::kFull) {
+      uint64_t timer = ++audio_timer_;
+      audio_strand_.PostAfter(kAudioRetryUs, [this, timer] {
+        if (timer == audio_timer_) {
+          DeliverAudioFrames();
+        }
+      });
+      return;
+    }
+    listener_->OnAudioFrame(std::move(audio_frame_));
+    MarkStartup(StartupStage::kFirstAudio);
+    audio_frame_ = nullptr;
   }
 }
-
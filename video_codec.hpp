@@ -13,74 +13,332 @@ extern "C" {
 }
 #include <stdio.h>
 
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 
-#include "blocking_queue.h"
+#include "frame_pool.hpp"
+#include "gop_cache.hpp"
+#include "keyframe_index.hpp"
+#include "local_file_io.hpp"
+#include "media_clock.hpp"
+#include "pipeline_stats.hpp"
+#include "resource_budget.hpp"
+#include "spsc_queue.h"
+#include "stream_decoder.hpp"
+#include "task_scheduler.hpp"
 
-struct AVFrameDeleter {
-  void operator()(AVFrame* frame) const {
-    if (frame) {
-      av_frame_free(&frame);
-    }
-  }
-};
-
-using AVFramePtr = std::shared_ptr<AVFrame>;
+class GopDecoder;
 
-inline AVFramePtr createAVFramePtr() {
-    return AVFramePtr(av_frame_alloc(), AVFrameDeleter());
-}
+enum class AudioSinkState {
+  kReady,    // 能收下一帧
+  kFull,     // 输出缓冲满了，隔一会儿再问
+  kOpening,  // 输出端还没打开，打开后由输出端调 ResumeAudioOutput
+};
 
 class VideoCodecListener {
  public:
+  virtual ~VideoCodecListener() = default;
+  // 送显和音频输出都跑在 TaskScheduler 的工作线程上（各自的 strand），
+  // 不要在里面长时间阻塞
   virtual void OnVideoFrame(AVFramePtr frame) = 0;
   virtual void OnAudioFrame(AVFramePtr frame) = 0;
+  // 音频输出端还能不能收下一帧。不是 kReady 时这一帧先留着，
+  // 免得 OnAudioFrame 在工作线程上等输出缓冲腾空间
+  virtual AudioSinkState GetAudioSinkState() { return AudioSinkState::kReady; }
   virtual void OnMediaError() = 0;
+  // seek 已经生效，之前交出去还没播放的音视频数据都应丢掉。在解封装线程调用
+  virtual void OnSeek() {}
+  // 选好音频流、还没打开解码器时在解封装线程调用，输出端可以趁解码器
+  // 初始化的时候提前打开声卡。参数来自容器，实际格式以帧为准
+  virtual void OnAudioStreamInfo(int sample_rate, int channels,
+                                 int sample_format) {}
+  // 播到结尾，最后一帧视频已经送显。在送显任务里调用，seek 回去后还会再播
+  virtual void OnEndOfStream() {}
+};
+
+// 启动各阶段完成的时刻，毫秒，从 StartCodec 算起；还没到的阶段为负
+struct StartupStats {
+  double open_ms = -1;          // 打开文件
+  double probe_ms = -1;         // avformat_find_stream_info
+  double decoders_ms = -1;      // 解码器都打开了
+  double first_decode_ms = -1;  // 解出第一帧视频
+  double first_frame_ms = -1;   // 第一帧交给界面，即首帧时间
+  double first_audio_ms = -1;   // 第一帧音频交给输出端
+};
+
+// GetStats 返回的一次快照
+struct CodecStats {
+  PipelineStats::Snapshot latency;
+  SyncStats sync;
+  StartupStats startup;
+  FileIoStats file_io;
+  GopCache::Stats gop_cache;
+  uint64_t decoded_frames = 0;  // 本次 StartCodec 以来解出的视频帧
+  int decode_quality = 0;       // DecodeQualityController 的当前档位
+  uint64_t decoded_fps = 0;
+  uint64_t copied_bytes_per_second = 0;
+  uint64_t video_queue_bytes = 0;
+  double video_queue_seconds = 0;
+  uint64_t video_queue_peak_bytes = 0;
+  uint64_t video_queue_peak_frames = 0;
+  uint64_t audio_queue_bytes = 0;
+  double audio_queue_seconds = 0;
+  uint64_t audio_queue_peak_bytes = 0;
+  uint64_t audio_queue_peak_frames = 0;
+  uint64_t all_queues_bytes = 0;  // 所有会话的帧队列
+  uint64_t demux_throttles = 0;   // 帧队列总量超预算、解封装让路的次数
 };
 
+// 队列里的帧带着入队时间，取出时记排队时长；charge 是它占的队列额度
+struct QueuedFrame {
+  AVFramePtr frame;
+  int64_t enqueue_us = 0;
+  FrameQueueBudget::Charge charge;
+};
+
+enum class SeekMode {
+  kKeyframe,  // 跳到离目标最近的关键帧，不用解多余的帧，最快
+  kAccurate,  // 从目标前的关键帧开始解，丢掉目标之前的帧，精确到帧
+};
+
+// 一个播放会话，可以同时开多个。只有解封装（文件 IO）和逐帧各占一个线程，
+// 解码、视频送显（含 YUV 转换）、音频输出（含重采样）都作为任务投到
+// scheduler 上，由所有会话共享的工作线程执行。
+// 解码线程数和 GOP 缓存大小从 budget 里分，多个会话共用一个 budget
 class VideoCodec {
  public:
+  explicit VideoCodec(ResourceBudget* budget = &ResourceBudget::Shared(),
+                      TaskScheduler* scheduler = &TaskScheduler::Shared());
+  ~VideoCodec();
+
   VideoCodec(const VideoCodec&) = delete;
   VideoCodec& operator=(const VideoCodec&) = delete;
 
-  static VideoCodec& getInstance() {
-    static VideoCodec instance;
-    return instance;
-  }
-
   void Register(VideoCodecListener* listener);
   void UnRegister(VideoCodecListener* listener);
-  void StartCodec(const std::string& file_path);
+  void StartCodec(const std::string& file_path,
+                  const DecoderOptions& options = DecoderOptions());
   void StopCodec();
+  // 暂停冻结主时钟，队列、解码器和输出端的数据都保留；恢复时从屏幕上
+  // 那一帧接着播，不重解。暂停期间逐帧走过的话，恢复时从走到的位置接着播
   void PauseCodec(bool pause);
+  // 暂停时把最后显示的那一帧再交给 listener 一次，窗口尺寸变了要按新
+  // 尺寸重新转换时用。任意线程调用，在送显任务里执行，连续调用会合并；
+  // 没暂停时下一帧自然按新尺寸出，什么也不做
+  void RefreshFrame();
+  // 输出端从 kOpening 变成能收帧之后调用，音频输出任务接着送。任意线程
+  void ResumeAudioOutput();
+  // 暂停状态下前进（正数）或后退（负数）frames 帧，异步执行。
+  // 帧从 GOP 缓存取，不在缓存里时先解出整个 GOP；后退时顺带预解前一个 GOP
+  void StepFrame(int frames);
+  // 倒放：暂停正向播放，按帧间隔一帧帧往回显示，没有声音。
+  // 关掉后停在当前帧，处于暂停状态
+  void SetReversePlayback(bool reverse);
+  // 播放速度：0.5~32 正向，-32~-1 倒放，(-1, 0.5) 之间按 0.5x。2x 以内
+  // 声音变速不变调（由输出端拉伸，倍速从 playback_rate() 取），切换时
+  // 不清队列不重解；再快不出声音，4x 起解码器不解非参考帧、8x 起只解
+  // 关键帧；倒放 4x 起只显示关键帧。
+  // 设正数时如果在倒放，切回正向；暂停由调用方处理
+  void SetPlaybackRate(double rate);
+  double playback_rate() const { return playback_rate_; }
+  GopCache::Stats GetGopCacheStats() { return gop_cache_.stats(); }
   void Codec(const std::string& file_path);
-  void ProcessFrameFromQueue();
-  void ProcessAudioFrameFromQueue();
-  void OnFrame(AVFramePtr frame);
-  void OnAudioFrame(AVFramePtr frame);
-  void WaitForFrame(double frame_time);
-  void WaitForFrameAudio(double frame_time);
+  // 解码器交帧，队列满（或暂停）时返回 false，等 Wake 之后重投
+  bool OnFrame(const AVFramePtr& frame);
+  bool OnAudioFrame(const AVFramePtr& frame);
+  // 异步 seek，seconds 是流时间戳（秒）。解封装/解码线程都不重启，
+  // 连续调用（拖动、连按方向键）只执行最后一次
+  void Seek(double seconds, SeekMode mode);
+  // 当前播放位置（秒），有还没执行的 seek 时返回它的目标
+  double Position();
+  const KeyframeIndex& keyframe_index() const { return keyframe_index_; }
+  // 音频输出端把声卡的消费进度报给这个时钟，视频按它来排期
+  AudioClock& audio_clock() { return audio_clock_; }
+  // 音频帧的时间戳（秒），没有时间戳时返回 NAN
+  double AudioFrameSeconds(const AVFrame* frame) const;
+  SyncStats GetSyncStats();
+  StartupStats GetStartupStats();
+  // 解码器到队列之间每秒拷贝的帧数据量，零拷贝路径下应为 0
+  uint64_t CopiedBytesPerSecond();
+  // 视频解码吞吐，最近一秒解出的帧数
+  uint64_t DecodedFramesPerSecond();
+  // 当前文件的读取统计，没有用自定义 IO 时 mode 为 "ffmpeg"
+  FileIoStats GetFileIoStats();
+  // 各阶段延迟直方图，每次 StartCodec 清零。listener 把转换、界面、
+  // 音频回调的耗时也记到这里
+  PipelineStats& pipeline_stats() { return pipeline_stats_; }
+  CodecStats GetStats();
+  // GetStats 的 JSON 形式
+  std::string GetStatsJson();
 
  private:
-  VideoCodec();
-  ~VideoCodec();
+  // options_ 的解码线程数按预算份额封顶
+  DecoderOptions BudgetedOptions();
+
+  ResourceBudget* budget_;
+  int budget_session_ = 0;
 
- private:
   VideoCodecListener* listener_ = nullptr;
-  int stop_requested_ = 0;
+  std::atomic<bool> stop_requested_{false};
   std::thread codec_thread_;
-  std::thread getting_frame_thread_;
-  std::thread getting_audio_frame_thread_;
-  BlockingQueue<AVFramePtr> fq_;
-  BlockingQueue<AVFramePtr> afq_;
-  bool is_first_frame_ = true;
-  int64_t first_frame_time_us_;
-  bool is_first_audio_frame_ = true;
-  int64_t first_audio_frame_time_us_;
+  // 放在队列前面：队列里的帧析构时要归还额度
+  FrameQueueBudget video_queue_budget_;
+  FrameQueueBudget audio_queue_budget_;
+  std::atomic<uint64_t> demux_throttles_{0};
+  SpscQueue<QueuedFrame> fq_;
+  SpscQueue<QueuedFrame> afq_;
+  FramePool frame_pool_;
+  FrameCopyMeter copy_meter_;
+  RateMeter decode_fps_meter_;
+  std::atomic<uint64_t> decoded_frames_{0};
+  // 视频解完了，送显任务显示完队列里剩下的帧就通知 OnEndOfStream
+  std::atomic<bool> eos_pending_{false};
+  std::atomic<int> decode_quality_{0};
+  DecoderOptions options_;
+
+  // 视频送显：fq_ 来了新帧时排一次，帧没到时间就排一个延时任务再看。
+  // 只在 video_strand_ 上运行
+  void KickVideo();
+  void PresentDueFrames();
+  // 取下一帧并做按帧的准备（批次、时长），没有帧返回 false
+  bool TakeVideoFrame();
+  // 音频输出：afq_ 来了新帧时排一次，输出端满了时隔一会儿再试，
+  // 还没打开时等 ResumeAudioOutput。
+  // 只在 audio_strand_ 上运行
+  void KickAudio();
+  void DeliverAudioFrames();
+  // 下游队列腾出了空间，让等着的解码器接着交帧
+  void WakeDecoder(bool audio);
+
+  // 主时钟：音频在推进时跟音频走，否则退回到墙上时钟。只在 video_strand_ 访问
+  double MasterClock(bool* audio_master);
+  void ResetWallClock(double pts);
+  void UpdateSyncStats(double drift, bool audio_master, bool dropped,
+                       bool repeated);
+  void RecordSeekLatency();
+  void RecordResumeLatency(int64_t latency_us);
+  // 暂停期间的送显：只把 seek 到的那一帧显示出来，在 video_strand_ 上调用
+  void PresentPausedSeekFrame();
+  // 每显示或丢掉一帧喂给 quality_，档位变了就设给视频解码器
+  void UpdateDecodeQuality(double late, bool dropped);
+  // 隔一段时间打一行各阶段延迟，在 video_strand_ 上调用
+  void MaybeLogStats();
+
+  enum class StartupStage {
+    kOpen,
+    kProbe,
+    kDecoders,
+    kFirstDecode,
+    kFirstFrame,
+    kFirstAudio,
+    kCount,
+  };
+  // 记下某个阶段第一次完成的时刻，之后再调用不变。任意线程
+  void MarkStartup(StartupStage stage);
+  int64_t start_us_ = 0;
+  std::atomic<int64_t> startup_us_[static_cast<int>(StartupStage::kCount)];
+
+  AudioClock audio_clock_;
+  double wall_clock_pts_ = 0;
+  int64_t wall_clock_us_ = -1;
 
+  // 以下只在 video_strand_ 上访问
+  AVFramePtr video_frame_;  // 已经取出、还没到显示时间的帧
+  double video_frame_pts_ = NAN;
+  double video_frame_duration_ = 0;
+  bool video_first_after_seek_ = false;
+  double video_last_pts_ = NAN;
+  int video_serial_ = 0;
+  uint64_t video_timer_ = 0;  // 只有最新排的延时任务有效
+  double video_rate_ = 1;      // 主时钟的走速，跟 playback_rate_ 同步
+  double video_pause_clock_ = NAN;  // 暂停时的主时钟，恢复时从这里接着走
+  DecodeQualityController quality_;
+  int64_t video_last_present_us_ = 0;
+  int64_t stats_log_us_ = 0;
+  // 以下只在 audio_strand_ 上访问
+  AVFramePtr audio_frame_;  // 输出端暂时收不下的帧
+  uint64_t audio_timer_ = 0;
+
+  std::atomic<bool> video_kicked_{false};
+  std::atomic<bool> refresh_pending_{false};
+  std::atomic<bool> audio_kicked_{false};
+  // 解封装线程打开的自定义 IO，StopCodec 时释放
+  std::mutex file_io_mutex_;
+  std::unique_ptr<LocalFileIO> file_io_;
+  // 解封装线程里的解码器，只在 Codec 运行期间有效
+  std::mutex decoders_mutex_;
+  StreamDecoder* video_decoder_ = nullptr;
+  StreamDecoder* audio_decoder_ = nullptr;
+  std::mutex sync_stats_mutex_;
+  SyncStats sync_stats_;
+  PipelineStats pipeline_stats_;
+
+  struct SeekRequest {
+    double seconds = 0;
+    SeekMode mode = SeekMode::kKeyframe;
+    int64_t request_us = 0;
+    uint64_t id = 0;
+  };
+  // 逐帧和倒放跑在 step_thread_ 上
+  void StepLoop();
+  // 走一帧，返回这一步跨过的时间（秒），走不动了返回负数
+  double StepOnce(GopDecoder* gop_decoder, int direction);
+  // 快速倒放：直接退到前一个关键帧
+  double RewindKeyframe(GopDecoder* gop_decoder);
+  void PresentFrame(AVFramePtr frame);
+  void LogGopCacheStats();
+
+  GopCache gop_cache_;
+  std::string file_path_;
+  std::thread step_thread_;
+  std::mutex step_mutex_;
+  std::condition_variable step_cv_;
+  int pending_steps_ = 0;
+  bool reverse_ = false;
+  double reverse_rate_ = 1;
+  std::atomic<double> playback_rate_{1};
+  std::atomic<bool> paused_{false};
+  std::atomic<bool> stepped_{false};  // 暂停期间显示位置被逐帧移动过
+  // 调度线程和逐帧线程都会往 listener 送帧，不能同时送
+  std::mutex present_mutex_;
+  // 最后交给 listener 的帧，RefreshFrame 用。present_mutex_ 保护
+  AVFramePtr last_presented_frame_;
+
+  // 以下两个只在解封装线程调用
+  bool TakeSeekRequest(SeekRequest* request);
+  void HandleSeek(AVFormatContext* format_ctx, int video_stream_index,
+                  const SeekRequest& request, StreamDecoder* video_decoder,
+                  StreamDecoder* audio_decoder);
+  // seek 还没生效，或者帧属于 seek 之前的批次
+  bool IsStale(const AVFrame* frame) const;
+
+  KeyframeIndex keyframe_index_;
+  std::mutex seek_mutex_;
+  std::condition_variable seek_cv_;
+  SeekRequest seek_request_;
+  uint64_t handled_seek_id_ = 0;
+  std::atomic<bool> seek_pending_{false};
+  // 每次 seek 加一，解出来的帧在 AVFrame::opaque 里带着自己的批次号
+  std::atomic<int> seek_serial_{0};
+  std::atomic<int64_t> seek_start_us_{0};
+  // 最近一次恢复播放的时间，恢复后第一帧显示时算延迟，-1 表示没有
+  std::atomic<int64_t> resume_us_{-1};
+  // 早于这个时间（秒）的帧解出来直接丢，精确 seek 用
+  std::atomic<double> seek_floor_{0};
+  std::atomic<double> position_{0};
+  std::atomic<int64_t> position_pts_{AV_NOPTS_VALUE};  // 视频流 time_base
+
+  // Codec 里解码器开始交帧之前设好，之后只读
   AVRational stream_time_base_;
   AVRational audio_stream_time_base_;
-  bool stream_time_base_ready_ = false;
+
+  // 放在最后、最先析构：等还在跑的送显/音频任务结束时别的成员都还在
+  TaskStrand video_strand_;
+  TaskStrand audio_strand_;
 };
 #endif /* video_codec_hpp */
@@ -0,0 +1,65 @@
+//
+//  video_grid_view.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/24.
+//
+
+#include "video_grid_view.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <QGridLayout>
+#include <cmath>
+#include <string>
+
+#include "task_scheduler.hpp"
+
+static const int kReportIntervalMs = 5000;
+
+VideoGridView::VideoGridView(const std::vector<std::string>& paths,
+                             const DecoderOptions& options)
+    : QWidget(nullptr) {
+  int columns = static_cast<int>(std::ceil(std::sqrt(paths.size())));
+  auto* layout = new QGridLayout(this);
+  layout->setContentsMargins(0, 0, 0, 0);
+  layout->setSpacing(2);
+
+  for (size_t i = 0; i < paths.size(); ++i) {
+    DecoderOptions session_options = options;
+    session_options.decode_audio = (i == 0);
+    auto* view =
+        new VideoPlayerView(paths[i].c_str(), session_options, this);
+    layout->addWidget(view, static_cast<int>(i) / columns,
+                      static_cast<int>(i) % columns);
+    views_.push_back(view);
+  }
+  spdlog::info("grid: {} sessions in {} columns", paths.size(), columns);
+
+  connect(&report_timer_, &QTimer::timeout, this,
+          &VideoGridView::ReportThroughput);
+  report_timer_.start(kReportIntervalMs);
+}
+
+void VideoGridView::ReportThroughput() {
+  uint64_t decoded = 0;
+  uint64_t superseded = 0;
+  for (VideoPlayerView* view : views_) {
+    decoded += view->codec().DecodedFramesPerSecond();
+    superseded += view->superseded_frames();
+  }
+  spdlog::info(
+      "grid: {} sessions, aggregate decode {} fps, {} frames superseded "
+      "before paint",
+      views_.size(), decoded, superseded);
+
+  std::vector<TaskScheduler::WorkerStats> workers =
+      TaskScheduler::Shared().GetWorkerStats();
+  std::string utilization;
+  for (const TaskScheduler::WorkerStats& worker : workers) {
+    utilization += fmt::format(" {:.0f}%", worker.utilization * 100);
+  }
+  spdlog::info("grid: {} workers, mean utilization {:.0f}%, per worker{}",
+               workers.size(),
+               TaskScheduler::MeanUtilization(workers) * 100, utilization);
+}
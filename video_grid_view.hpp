@@ -0,0 +1,35 @@
+//
+//  video_grid_view.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/24.
+//
+
+#ifndef video_grid_view_hpp
+#define video_grid_view_hpp
+
+#include <QTimer>
+#include <QWidget>
+#include <string>
+#include <vector>
+
+#include "video_player_view.hpp"
+
+// 多路同屏：每个格子是一个独立的 VideoPlayerView 会话，
+// 所有会话共用进程的 CPU/内存预算。只有第一路出声音。
+class VideoGridView : public QWidget {
+  Q_OBJECT
+
+ public:
+  VideoGridView(const std::vector<std::string>& paths,
+                const DecoderOptions& options);
+
+ private:
+  // 定时打印所有会话加起来的解码吞吐
+  void ReportThroughput();
+
+  std::vector<VideoPlayerView*> views_;  // 由 Qt 父子关系负责释放
+  QTimer report_timer_;
+};
+
+#endif /* video_grid_view_hpp */
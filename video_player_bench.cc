@@ -0,0 +1,485 @@
+//
+//  video_player_bench.cc
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/12.
+//
+//  热点路径的 microbenchmark。每个结果输出一行 JSON 到 stdout，方便回归对比：
+//    {"bench":"convert/1080p","value":123.4,"unit":"fps"}
+//  用法：./VideoPlayerBench [名字过滤子串]
+//
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/time.h>
+}
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_resampler.hpp"
+#include "bench_media.hpp"
+#include "blocking_queue.h"
+#include "frame_converter.hpp"
+#include "resource_budget.hpp"
+#include "spsc_queue.h"
+#include "stream_decoder.hpp"
+#include "task_scheduler.hpp"
+#include "video_codec.hpp"
+
+static const char* g_filter = nullptr;
+
+static bool Selected(const std::string& name) {
+  return !g_filter || name.find(g_filter) != std::string::npos;
+}
+
+static void Report(const std::string& name, double value, const char* unit) {
+  printf("{\"bench\":\"%s\",\"value\":%.3f,\"unit\":\"%s\"}\n", name.c_str(),
+         value, unit);
+  fflush(stdout);
+}
+
+static double SecondsSince(int64_t start_us) {
+  return (av_gettime_relative() - start_us) / 1000000.0;
+}
+
+// 一个生产者一个消费者，队列容量很小，逼出满/空两侧的等待。
+// 元素用 AVFramePtr 同款的 shared_ptr，和帧队列的实际负载一致
+template <typename Queue>
+static void BenchQueue(const std::string& name) {
+  if (!Selected(name)) {
+    return;
+  }
+  const int kOps = 1000000;
+  Queue queue(16);
+  std::vector<std::shared_ptr<int>> items;
+  for (int i = 0; i < 64; ++i) {
+    items.push_back(std::make_shared<int>(i));
+  }
+
+  int64_t start_us = av_gettime_relative();
+  std::thread producer([&queue, &items] {
+    for (int i = 0; i < kOps; ++i) {
+      queue.push(items[i % items.size()]);
+    }
+  });
+  int64_t sum = 0;
+  for (int i = 0; i < kOps; ++i) {
+    sum += *queue.pop();
+  }
+  producer.join();
+  double seconds = SecondsSince(start_us);
+
+  int64_t expected = 0;
+  for (int i = 0; i < kOps; ++i) {
+    expected += i % items.size();
+  }
+  if (sum != expected) {
+    spdlog::error("{}: lost items", name);
+  }
+  Report(name, kOps / seconds, "ops/s");
+}
+
+struct BenchSize {
+  const char* name;
+  int width;
+  int height;
+};
+
+static const BenchSize kConvertSizes[] = {{"720p", 1280, 720},
+                                          {"1080p", 1920, 1080},
+                                          {"4k", 3840, 2160}};
+
+// 转换 1 秒以上，返回 fps；失败返回负数。8K 这样的大帧少备几张不同的
+// 源帧，免得光测试数据就占掉几百 MB
+static double MeasureConvert(FrameConverter* converter, int width, int height,
+                             AVPixelFormat format, int distinct_frames = 8) {
+  std::vector<AVFramePtr> frames;
+  for (int i = 0; i < distinct_frames; ++i) {
+    frames.push_back(MakeTestPicture(width, height, format, i));
+    if (!frames.back()) {
+      return -1;
+    }
+  }
+
+  if (converter->Convert(frames[0].get()).isNull()) {  // 预热，建转换参数
+    return -1;
+  }
+
+  int converted = 0;
+  int64_t start_us = av_gettime_relative();
+  while (SecondsSince(start_us) < 1.0 || converted < 10) {
+    const AVFrame* frame = frames[converted % distinct_frames].get();
+    QImage image = converter->Convert(frame);
+    if (image.isNull()) {
+      return -1;
+    }
+    ++converted;
+  }
+  return converted / SecondsSince(start_us);
+}
+
+static void BenchConvert() {
+  // 默认路径：yuv420p，自动选择最快的实现
+  for (const BenchSize& size : kConvertSizes) {
+    const std::string name = std::string("convert/") + size.name;
+    if (!Selected(name)) {
+      continue;
+    }
+    FrameConverter converter;
+    double fps =
+        MeasureConvert(&converter, size.width, size.height, AV_PIX_FMT_YUV420P);
+    if (fps < 0) {
+      spdlog::error("{}: convert failed", name);
+      continue;
+    }
+    Report(name, fps, "fps");
+  }
+
+  // 各个实现在 4K 上的对比
+  const YuvKernel kernels[] = {YuvKernel::kScalar, YuvKernel::kSse2,
+                               YuvKernel::kAvx2};
+  for (YuvKernel kernel : kernels) {
+    const std::string name =
+        std::string("convert/4k/") + YuvKernelName(kernel);
+    if (!Selected(name) || !GetYuvToRgb32Row(kernel)) {
+      continue;
+    }
+    FrameConverter converter(kernel);
+    double fps = MeasureConvert(&converter, 3840, 2160, AV_PIX_FMT_YUV420P);
+    if (fps >= 0) {
+      Report(name, fps, "fps");
+    }
+  }
+
+  // 其他输入格式，1080p
+  struct Format {
+    const char* name;
+    AVPixelFormat format;
+  };
+  const Format formats[] = {{"nv12", AV_PIX_FMT_NV12},
+                            {"yuv422p", AV_PIX_FMT_YUV422P},
+                            {"yuv420p10", AV_PIX_FMT_YUV420P10LE}};
+  for (const Format& format : formats) {
+    const std::string name = std::string("convert/1080p/") + format.name;
+    if (!Selected(name)) {
+      continue;
+    }
+    FrameConverter converter;
+    double fps = MeasureConvert(&converter, 1920, 1080, format.format);
+    if (fps < 0) {
+      spdlog::error("{}: convert failed", name);
+      continue;
+    }
+    Report(name, fps, "fps");
+  }
+
+  // 4K 源显示在 960x540 窗口：转换时直接缩放 vs 原尺寸转换后 QImage::scaled
+  const std::string scaled_name = "convert/4k_to_540p/scaled_convert";
+  if (Selected(scaled_name)) {
+    FrameConverter converter;
+    converter.SetTargetSize(960, 540);
+    double fps = MeasureConvert(&converter, 3840, 2160, AV_PIX_FMT_YUV420P);
+    if (fps >= 0) {
+      Report(scaled_name, fps, "fps");
+    }
+  }
+  const std::string qimage_name = "convert/4k_to_540p/qimage_scaled";
+  if (Selected(qimage_name)) {
+    FrameConverter converter;
+    AVFramePtr frame = MakeTestPicture(3840, 2160, AV_PIX_FMT_YUV420P, 0);
+    int converted = 0;
+    int64_t start_us = av_gettime_relative();
+    while (SecondsSince(start_us) < 1.0 || converted < 10) {
+      QImage image = converter.Convert(frame.get())
+                         .scaled(960, 540, Qt::KeepAspectRatio,
+                                 Qt::SmoothTransformation);
+      if (image.isNull()) {
+        break;
+      }
+      ++converted;
+    }
+    Report(qimage_name, converted / SecondsSince(start_us), "fps");
+  }
+}
+
+// 条带并行转换：同一尺寸下单条带和自动条带数的 fps 及加速比。
+// 原尺寸走向量化行转换，8K 缩到 1080p 窗口走 swscale
+static void BenchConvertBands() {
+  struct Case {
+    const char* name;
+    int width;
+    int height;
+    int target_width;
+    int target_height;
+  };
+  const Case cases[] = {{"1080p", 1920, 1080, 0, 0},
+                        {"4k", 3840, 2160, 0, 0},
+                        {"8k", 7680, 4320, 0, 0},
+                        {"4k_to_1080p", 3840, 2160, 1920, 1080},
+                        {"8k_to_1080p", 7680, 4320, 1920, 1080}};
+  for (const Case& c : cases) {
+    const std::string name = std::string("convert_bands/") + c.name;
+    if (!Selected(name)) {
+      continue;
+    }
+    double fps[2];
+    int bands = 0;
+    for (int i = 0; i < 2; ++i) {
+      FrameConverter converter(YuvKernel::kAuto, &TaskScheduler::Shared());
+      converter.set_max_bands(i == 0 ? 1 : 0);
+      converter.SetTargetSize(c.target_width, c.target_height);
+      fps[i] = MeasureConvert(&converter, c.width, c.height,
+                              AV_PIX_FMT_YUV420P, 2);
+      bands = converter.bands();
+    }
+    if (fps[0] < 0 || fps[1] < 0) {
+      spdlog::error("{}: convert failed", name);
+      continue;
+    }
+    Report(name + "/1_band", fps[0], "fps");
+    Report(name + "/" + std::to_string(bands) + "_bands", fps[1], "fps");
+    Report(name + "/speedup", fps[1] / fps[0], "x");
+  }
+}
+
+// 48k FLTP 立体声重采样到 44.1k S16，对应最常见的 AAC -> 声卡路径
+static void BenchResample() {
+  const std::string name = "resample/fltp48k_s16_44k";
+  if (!Selected(name)) {
+    return;
+  }
+  const int kSamplesPerFrame = 1024;
+  const int kDistinctFrames = 16;
+  std::vector<AVFramePtr> frames;
+  for (int i = 0; i < kDistinctFrames; ++i) {
+    frames.push_back(MakeTestAudio(48000, 2, kSamplesPerFrame,
+                                   AV_SAMPLE_FMT_FLTP, i));
+  }
+
+  AudioResampler resampler(44100, AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_STEREO);
+  int64_t samples = 0;
+  int64_t start_us = av_gettime_relative();
+  int i = 0;
+  while (SecondsSince(start_us) < 1.0) {
+    const uint8_t* out = nullptr;
+    if (resampler.Convert(frames[i++ % kDistinctFrames].get(), &out) < 0) {
+      spdlog::error("{}: convert failed", name);
+      return;
+    }
+    samples += kSamplesPerFrame;
+  }
+  Report(name, samples / SecondsSince(start_us), "samples/s");
+}
+
+// 解封装 + 解码整个文件，不做节奏控制，跑的是 VideoCodec::Codec 里的同一套
+// packet 循环。返回解出的帧数，打不开返回 -1
+static int DecodeFile(const std::string& path, const DecoderOptions& options) {
+  AVFormatContext* fmt_ctx = NULL;
+  if (avformat_open_input(&fmt_ctx, path.c_str(), NULL, NULL) != 0 ||
+      avformat_find_stream_info(fmt_ctx, NULL) < 0) {
+    avformat_close_input(&fmt_ctx);
+    return -1;
+  }
+  int video_stream_index =
+      av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+
+  FramePool frame_pool;
+  FrameCopyMeter copy_meter;
+  StreamDecoder decoder("bench", &frame_pool, &copy_meter, 64);
+  if (video_stream_index < 0 ||
+      !decoder.Open(fmt_ctx->streams[video_stream_index], options)) {
+    avformat_close_input(&fmt_ctx);
+    return -1;
+  }
+
+  std::atomic<int> frames{0};
+  decoder.Start([&frames](const AVFramePtr& frame) {
+    ++frames;
+    return true;
+  });
+  while (true) {
+    AVPacketPtr pkt = createAVPacketPtr();
+    if (av_read_frame(fmt_ctx, pkt.get()) < 0) {
+      break;
+    }
+    if (pkt->stream_index == video_stream_index) {
+      decoder.PushPacket(std::move(pkt));
+    }
+  }
+  decoder.Finish();
+  decoder.Join();
+
+  avformat_close_input(&fmt_ctx);
+  return frames;
+}
+
+static void BenchDecode(const std::string& tmp_dir) {
+  const std::string name = "decode/mpeg4_720p";
+  const int kSessionCounts[] = {1, 2, 4, 8};
+  auto sessions_name = [&name](int sessions) {
+    return name + "/sessions_" + std::to_string(sessions);
+  };
+  bool selected = Selected(name);
+  for (int sessions : kSessionCounts) {
+    selected = selected || Selected(sessions_name(sessions));
+  }
+  if (!selected) {
+    return;
+  }
+  const std::string path = tmp_dir + "/qvideo_bench_720p.mp4";
+  if (!WriteTestVideo(path, 1280, 720, 300, 30)) {
+    spdlog::error("{}: could not generate test media", name);
+    return;
+  }
+
+  int64_t start_us = av_gettime_relative();
+  if (Selected(name)) {
+    int frames = DecodeFile(path, DecoderOptions());
+    if (frames < 0) {
+      spdlog::error("{}: could not open {}", name, path);
+    } else {
+      Report(name, frames / SecondsSince(start_us), "fps");
+    }
+  }
+
+  // 多会话并发：每个会话按 ResourceBudget 分到的线程数解码，
+  // 总吞吐应随核数增长，而不是被线程超额订阅拖垮
+  for (int sessions : kSessionCounts) {
+    if (!Selected(sessions_name(sessions))) {
+      continue;
+    }
+    ResourceBudget budget(0, 0);
+    std::vector<int> ids;
+    for (int i = 0; i < sessions; ++i) {
+      ids.push_back(budget.Join(nullptr));
+    }
+    DecoderOptions options;
+    options.thread_count = budget.ThreadShare();
+
+    std::atomic<int> total{0};
+    std::vector<std::thread> threads;
+    // 解码跑在共享的工作线程上，会话只多一个解封装线程；以这里为起点统计利用率
+    TaskScheduler::Shared().GetWorkerStats();
+    start_us = av_gettime_relative();
+    for (int i = 0; i < sessions; ++i) {
+      threads.emplace_back([&path, &options, &total] {
+        total += std::max(DecodeFile(path, options), 0);
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    Report(sessions_name(sessions), total / SecondsSince(start_us), "fps");
+    Report(sessions_name(sessions) + "/worker_utilization",
+           100 * TaskScheduler::MeanUtilization(
+                     TaskScheduler::Shared().GetWorkerStats()),
+           "%");
+    for (int id : ids) {
+      budget.Leave(id);
+    }
+  }
+
+  remove(path.c_str());
+}
+
+// 只等第一帧视频的 listener
+class FirstFrameListener : public VideoCodecListener {
+ public:
+  void OnVideoFrame(AVFramePtr frame) override {
+    Done(av_gettime_relative());
+  }
+  void OnAudioFrame(AVFramePtr frame) override {}
+  void OnMediaError() override { Done(-1); }
+
+  // 返回第一帧到达的时刻，出错或超时返回负数
+  int64_t Wait(int64_t timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                 [this] { return done_; });
+    return done_ ? frame_us_ : -1;
+  }
+
+ private:
+  void Done(int64_t frame_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!done_) {
+      done_ = true;
+      frame_us_ = frame_us;
+    }
+    cv_.notify_all();
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool done_ = false;
+  int64_t frame_us_ = -1;
+};
+
+// 首帧时间：StartCodec 到第一帧交给 listener，默认探测和快速启动各测一次
+static void BenchStartup(const std::string& tmp_dir) {
+  const std::string name = "startup/ttff_mp4_720p";
+  if (!Selected(name)) {
+    return;
+  }
+  const std::string path = tmp_dir + "/qvideo_bench_startup.mp4";
+  if (!WriteTestVideo(path, 1280, 720, 60, 30)) {
+    spdlog::error("{}: could not generate test media", name);
+    return;
+  }
+  for (bool fast : {false, true}) {
+    const int kRuns = 5;
+    double total_ms = 0;
+    int runs = 0;
+    for (int i = 0; i < kRuns; ++i) {
+      DecoderOptions options;
+      options.fast_start = fast;
+      FirstFrameListener listener;
+      VideoCodec codec;
+      codec.Register(&listener);
+      int64_t start_us = av_gettime_relative();
+      codec.StartCodec(path, options);
+      int64_t frame_us = listener.Wait(5000);
+      if (frame_us >= 0) {
+        total_ms += (frame_us - start_us) / 1000.0;
+        ++runs;
+      }
+      codec.StopCodec();
+      codec.UnRegister(&listener);
+    }
+    if (runs > 0) {
+      Report(fast ? name + "/fast" : name, total_ms / runs, "ms");
+    }
+  }
+  remove(path.c_str());
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc > 1) {
+    g_filter = argv[1];
+  }
+  spdlog::set_level(spdlog::level::warn);
+  av_log_set_level(AV_LOG_ERROR);
+
+  const char* tmp_dir = getenv("TMPDIR");
+  BenchQueue<BlockingQueue<std::shared_ptr<int>>>("queue/blocking_queue");
+  BenchQueue<SpscQueue<std::shared_ptr<int>>>("queue/spsc_queue");
+  BenchConvert();
+  BenchConvertBands();
+  BenchResample();
+  BenchDecode(tmp_dir ? tmp_dir : "/tmp");
+  BenchStartup(tmp_dir ? tmp_dir : "/tmp");
+  return 0;
+}
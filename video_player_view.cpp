@@ -9,19 +9,21 @@
 
 extern "C" {
 #include <libavutil/avutil.h>
-#include <libavutil/imgutils.h>
-#include <libswresample/swresample.h>
-#include <libswscale/swscale.h>
-#include <libavutil/opt.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/samplefmt.h>
+#include <libavutil/time.h>
 }
 #include <SDL.h>
 #include <spdlog/spdlog.h>
 
-#include <QPainter>
 #include <QKeyEvent>
+#include <QPainter>
+#include <QResizeEvent>
+#include <algorithm>
 
-static SwsContext* sws_ctx = nullptr;
-static SwrContext* swr_ctx = nullptr;
+static const double kSeekStepSeconds = 10.0;
+// 提前打开声卡时还不知道解码器每帧多少样本，按 AAC 的 1024 请求
+static const int kAudioOpenSamples = 1024;
 
 static void AudioCallbackBridge(void* userdata, Uint8* stream, int len) {
   auto* instance = static_cast<VideoPlayerView*>(userdata);
@@ -29,98 +31,131 @@ static void AudioCallbackBridge(void* userdata, Uint8* stream, int len) {
 }
 
 void VideoPlayerView::AudioCallback(void* userdata, Uint8* stream, int len) {
-  auto opt_frame = audio_frames_.popOrEmpty();
-  if (!*opt_frame) {
-    memset(stream, 0, len);
-    return;
+  int64_t start_us = av_gettime_relative();
+  size_t copied = 0;
+  if (pcm_ring_) {
+    uint64_t begin = 0;
+    copied = pcm_ring_->Read(stream, len, &begin);
+    codec_.audio_clock().OnConsume(begin, copied);
   }
-
-  AVFramePtr frame = *opt_frame;
-
-  int64_t out_channel_layout = AV_CH_LAYOUT_STEREO;
-
-  int out_sample_rate = obtained_.freq;
-  AVSampleFormat out_sample_fmt;
-  switch (obtained_.format) {
-    case AUDIO_U8:
-      out_sample_fmt = AV_SAMPLE_FMT_U8;
-      break;
-    case AUDIO_S16SYS:
-      out_sample_fmt = AV_SAMPLE_FMT_S16;
-      break;
-    case AUDIO_S32SYS:
-      out_sample_fmt = AV_SAMPLE_FMT_S32;
-      break;
-    case AUDIO_F32SYS:
-      out_sample_fmt = AV_SAMPLE_FMT_FLT;
-      break;
-    default:
-      out_sample_fmt = AV_SAMPLE_FMT_S16;
-      break;
+  if (copied < static_cast<size_t>(len)) {
+    memset(stream + copied, obtained_.silence, len - copied);
+    if (pcm_started_) {
+      ++audio_underruns_;
+    }
   }
+  codec_.pipeline_stats().Record(PipelineStage::kAudioCallback,
+                                 av_gettime_relative() - start_us);
+}
 
-  if (frame->sample_rate <= 0) {
-    memset(stream, 0, len);
-    return;
+void VideoPlayerView::SetPaused(bool pause) {
+  codec_.PauseCodec(pause);
+  std::lock_guard<std::mutex> lock(audio_pause_mutex_);
+  pause_ = pause;
+  if (audio_opened_) {
+    // 暂停时声卡也停下，不把缺数据算成 underrun
+    SDL_PauseAudioDevice(audio_device_, pause ? 1 : 0);
   }
-
-  if (!swr_ctx) {
-    swr_ctx = swr_alloc();
-    av_opt_set_int(swr_ctx, "in_channel_layout", frame->channel_layout, 0);
-    av_opt_set_int(swr_ctx, "in_sample_rate", frame->sample_rate, 0);
-    av_opt_set_sample_fmt(swr_ctx, "in_sample_fmt",
-                          (AVSampleFormat)frame->format, 0);
-    av_opt_set_int(swr_ctx, "out_channel_layout", out_channel_layout, 0);
-    av_opt_set_int(swr_ctx, "out_sample_rate", out_sample_rate, 0);
-    av_opt_set_sample_fmt(swr_ctx, "out_sample_fmt", out_sample_fmt, 0);
-    swr_init(swr_ctx);
-  }
-
-  uint8_t* outBuffer[2] = {nullptr, nullptr};
-  int out_samples = av_rescale_rnd(
-      swr_get_delay(swr_ctx, frame->sample_rate) + frame->nb_samples,
-      out_sample_rate, frame->sample_rate, AV_ROUND_UP);
-  int out_buffer_size = av_samples_alloc(
-      outBuffer, nullptr, av_get_channel_layout_nb_channels(out_channel_layout),
-      out_samples, out_sample_fmt, 0);
-
-  if (out_buffer_size < 0) {
-    memset(stream, 0, len);
-    av_freep(&outBuffer[0]);
-    return;
-  }
-
-  swr_convert(swr_ctx, outBuffer, out_samples, (const uint8_t**)frame->data,
-              frame->nb_samples);
-
-  int bytes_to_copy = std::min(len, out_buffer_size);
-
-  SDL_memcpy(stream, outBuffer[0], bytes_to_copy);
-
-  av_freep(&outBuffer[0]);
 }
 
 void VideoPlayerView::keyPressEvent(QKeyEvent *event) {
   if (event->key() == Qt::Key_Space) {
     spdlog::info("Space key pressed");
-    pause_ = !pause_;
-    VideoCodec::getInstance().PauseCodec(pause_);
+    if (reverse_) {
+      // 倒放中按空格：停在当前帧
+      reverse_ = false;
+      codec_.SetReversePlayback(false);
+    } else {
+      SetPaused(!pause_);
+    }
+  } else if (event->key() == Qt::Key_Left || event->key() == Qt::Key_Right) {
+    // 左右键前后跳 10 秒，按住 Shift 精确到帧。连按时从上一次的目标接着算
+    double step = event->key() == Qt::Key_Left ? -kSeekStepSeconds
+                                               : kSeekStepSeconds;
+    SeekMode mode = (event->modifiers() & Qt::ShiftModifier)
+                        ? SeekMode::kAccurate
+                        : SeekMode::kKeyframe;
+    codec_.Seek(std::max(0.0, codec_.Position() + step), mode);
+  } else if (event->key() == Qt::Key_Comma ||
+             event->key() == Qt::Key_Period) {
+    // 逗号/句号逐帧后退/前进，播放中按下先暂停
+    if (reverse_) {
+      reverse_ = false;
+      codec_.SetReversePlayback(false);
+    } else if (!pause_) {
+      SetPaused(true);
+    }
+    codec_.StepFrame(event->key() == Qt::Key_Comma ? -1 : 1);
+  } else if (event->key() == Qt::Key_R) {
+    // R 切换倒放和正向播放
+    reverse_ = !reverse_;
+    if (reverse_) {
+      SetPaused(true);
+      codec_.SetReversePlayback(true);
+    } else {
+      codec_.SetReversePlayback(false);
+      SetPaused(false);
+    }
+  } else if (event->key() == Qt::Key_J || event->key() == Qt::Key_K ||
+             event->key() == Qt::Key_L) {
+    // JKL：L 快进、J 快退，连按倍速翻倍到 32x，K 回到 1x 正常播放
+    double rate = codec_.playback_rate();
+    if (event->key() == Qt::Key_J) {
+      rate = rate > 0 ? -1 : std::max(rate * 2, -32.0);
+      if (!reverse_) {
+        reverse_ = true;
+        SetPaused(true);
+      }
+      codec_.SetPlaybackRate(rate);
+    } else {
+      rate = event->key() == Qt::Key_K ? 1
+             : rate < 0                ? 1
+                                       : std::min(rate * 2, 32.0);
+      reverse_ = false;
+      codec_.SetPlaybackRate(rate);
+      SetPaused(false);
+    }
+  } else if (event->key() == Qt::Key_BracketLeft ||
+             event->key() == Qt::Key_BracketRight) {
+    // [ ] 在 0.5x~2x 之间换档，声音变速不变调
+    static const double kRates[] = {0.5, 0.75, 1, 1.25, 1.5, 2};
+    double rate = codec_.playback_rate();
+    double next = event->key() == Qt::Key_BracketLeft ? kRates[0] : 2;
+    for (double preset : kRates) {
+      if (event->key() == Qt::Key_BracketLeft ? preset < rate
+                                              : preset > rate) {
+        next = preset;
+        if (event->key() == Qt::Key_BracketRight) {
+          break;
+        }
+      }
+    }
+    codec_.SetPlaybackRate(next);
+    if (reverse_) {
+      // 倒放中按下：切回正向播放
+      reverse_ = false;
+      SetPaused(false);
+    }
+  } else if (event->key() == Qt::Key_I) {
+    // I 把各阶段延迟和其他统计以 JSON 打到日志里
+    spdlog::info("stats: {}", codec_.GetStatsJson());
   } else {
     QWidget::keyPressEvent(event);
   }
 }
 
-bool VideoPlayerView::InitSdlAudio(AVFramePtr frame) {
+bool VideoPlayerView::InitSdlAudio(int sample_rate, int channels,
+                                   int sample_format, int samples) {
   SDL_AudioSpec wanted_spec;
 
-  wanted_spec.freq = frame->sample_rate;
-  wanted_spec.channels = frame->channels;
+  wanted_spec.freq = sample_rate;
+  wanted_spec.channels = channels;
   wanted_spec.silence = 0;
-  wanted_spec.samples = frame->nb_samples;
+  wanted_spec.samples = samples;
   wanted_spec.callback = AudioCallbackBridge;
   wanted_spec.userdata = this;
 
-  switch (frame->format) {
+  switch (sample_format) {
     case AV_SAMPLE_FMT_U8:
     case AV_SAMPLE_FMT_U8P:
       wanted_spec.format = AUDIO_U8;
@@ -142,97 +177,276 @@ bool VideoPlayerView::InitSdlAudio(AVFramePtr frame) {
       return false;
   }
 
-  if (SDL_OpenAudio(&wanted_spec, &obtained_) < 0) {
+  // 每个会话开自己的输出设备，多个播放窗口可以同时出声
+  if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+    spdlog::info("Could not init audio: {}", SDL_GetError());
+    return false;
+  }
+  audio_device_ = SDL_OpenAudioDevice(NULL, 0, &wanted_spec, &obtained_,
+                                      SDL_AUDIO_ALLOW_ANY_CHANGE);
+  if (audio_device_ == 0) {
     spdlog::info("Could not open audio: {}", SDL_GetError());
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
     return false;
   }
 
-  SDL_PauseAudio(0);
-
-  return true;
-}
-
-static QImage convertToQImage(AVFramePtr frame) {
-  if (frame->format != AV_PIX_FMT_YUV420P &&
-      frame->format != AV_PIX_FMT_YUVJ420P) {
-    return QImage();
+  AVSampleFormat out_sample_fmt;
+  switch (obtained_.format) {
+    case AUDIO_U8:
+      out_sample_fmt = AV_SAMPLE_FMT_U8;
+      break;
+    case AUDIO_S16SYS:
+      out_sample_fmt = AV_SAMPLE_FMT_S16;
+      break;
+    case AUDIO_S32SYS:
+      out_sample_fmt = AV_SAMPLE_FMT_S32;
+      break;
+    case AUDIO_F32SYS:
+      out_sample_fmt = AV_SAMPLE_FMT_FLT;
+      break;
+    default:
+      out_sample_fmt = AV_SAMPLE_FMT_S16;
+      break;
   }
-
-  if (!sws_ctx /* || 检查帧格式或大小是否改变 */) {
-    if (sws_ctx) {
-      sws_freeContext(sws_ctx);
-    }
-    sws_ctx = sws_getContext(frame->width, frame->height,
-                             static_cast<AVPixelFormat>(frame->format),
-                             frame->width, frame->height, AV_PIX_FMT_RGB32,
-                             SWS_BILINEAR, nullptr, nullptr, nullptr);
-    if (!sws_ctx) {
-      return QImage();
+  // 按声卡实际给的声道数输出，不一定是请求的声道数
+  resampler_.reset(new AudioResampler(
+      obtained_.freq, out_sample_fmt,
+      av_get_default_channel_layout(obtained_.channels)));
+  stretcher_.reset(new AudioTimeStretcher(obtained_.freq, obtained_.channels,
+                                          out_sample_fmt));
+
+  // 至少能放下 4 次回调或 200ms 的数据
+  size_t bytes_per_second = static_cast<size_t>(obtained_.freq) *
+                            obtained_.channels *
+                            av_get_bytes_per_sample(out_sample_fmt);
+  pcm_ring_.reset(new PcmRingBuffer(
+      std::max<size_t>(obtained_.size * 4, bytes_per_second / 5)));
+  // 声卡内部大约还缓冲着一个回调的数据
+  codec_.audio_clock().Configure(
+      bytes_per_second, static_cast<double>(obtained_.samples) / obtained_.freq);
+
+  {
+    // 声卡可能在工作线程上提前打开，这期间用户已经按了暂停
+    std::lock_guard<std::mutex> lock(audio_pause_mutex_);
+    audio_opened_ = true;
+    if (!pause_) {
+      SDL_PauseAudioDevice(audio_device_, 0);
     }
   }
 
-  uint8_t* dest[4] = {nullptr};
-  int dest_linesize[4] = {0};
-  av_image_alloc(dest, dest_linesize, frame->width, frame->height,
-                 AV_PIX_FMT_RGB32, 1);
-
-  sws_scale(sws_ctx, frame->data, frame->linesize, 0, frame->height, dest,
-            dest_linesize);
-
-  QImage img(dest[0], frame->width, frame->height, dest_linesize[0],
-             QImage::Format_RGB32);
-
-  av_freep(&dest[0]);
-
-  return img;
+  return true;
 }
 
-VideoPlayerView::VideoPlayerView(const char* path) : QWidget(nullptr), audio_frames_(1) {
+VideoPlayerView::VideoPlayerView(const char* path,
+                                 const DecoderOptions& options,
+                                 QWidget* parent)
+    : QWidget(parent) {
   spdlog::info("VideoPlayerView");
 
-  connect(this, &VideoPlayerView::frameReady, this,
-          &VideoPlayerView::renderFrame);
+  connect(this, &VideoPlayerView::frameAvailable, this,
+          &VideoPlayerView::renderFrame, Qt::QueuedConnection);
 
-  VideoCodec::getInstance().Register(this);
-  VideoCodec::getInstance().StartCodec(path);
+  codec_.Register(this);
+  codec_.StartCodec(path, options);
 }
 
 VideoPlayerView::~VideoPlayerView() {
   spdlog::info("~VideoPlayerView");
 
-  VideoCodec::getInstance().StopCodec();
-  VideoCodec::getInstance().UnRegister(this);
+  // 提前打开声卡的线程可能还在跑，等它结束再看 pcm_ring_
+  if (audio_open_thread_.joinable()) {
+    audio_open_thread_.join();
+  }
+  // 之后音频输出任务的 Write 都直接丢弃
+  if (pcm_ring_) {
+    pcm_ring_->Close();
+  }
+  codec_.StopCodec();
+  codec_.UnRegister(this);
+
+  if (audio_opened_) {
+    SDL_CloseAudioDevice(audio_device_);
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    spdlog::info("audio underruns: {}", audio_underruns_.load());
+  }
+  spdlog::info("video frames superseded before paint: {}/{}",
+               mailbox_.superseded(), mailbox_.published());
 }
 
 void VideoPlayerView::OnVideoFrame(AVFramePtr frame) {
-  QImage image = convertToQImage(frame);
-  emit frameReady(image);
+  int64_t start_us = av_gettime_relative();
+  QImage image = converter_.Convert(frame.get());
+  int64_t converted_us = av_gettime_relative();
+  codec_.pipeline_stats().Record(PipelineStage::kConvert,
+                                 converted_us - start_us);
+  // 界面线程忙（拖动、缩放窗口）时只留最新一帧，不往事件队列里堆信号
+  if (mailbox_.Publish(std::move(image), converted_us)) {
+    emit frameAvailable();
+  }
 }
 
 void VideoPlayerView::OnAudioFrame(AVFramePtr frame) {
-  if (first_audio_frame_ && InitSdlAudio(frame)) {
+  // 提前打开失败或者容器里没有音频参数时，按第一帧的格式打开
+  if (first_audio_frame_ &&
+      InitSdlAudio(frame->sample_rate, frame->channels, frame->format,
+                   frame->nb_samples)) {
     first_audio_frame_ = false;
   }
-  audio_frames_.push(frame);
+  if (!resampler_) {
+    return;
+  }
+
+  const uint8_t* out_buffer = nullptr;
+  int out_buffer_size = resampler_->Convert(frame.get(), &out_buffer);
+  if (out_buffer_size <= 0) {
+    return;
+  }
+  if (stretcher_reset_.exchange(false)) {
+    stretcher_->Reset();
+    DropPendingPcm();
+  }
+  // 变速不变调，1x 时原样透传。在这里而不是音频回调里做，回调只管拷贝
+  double rate = codec_.playback_rate();
+  double pts = NAN;
+  out_buffer_size = stretcher_->Process(
+      out_buffer, out_buffer_size, codec_.AudioFrameSeconds(frame.get()), rate,
+      &out_buffer, &pts);
+  if (out_buffer_size <= 0) {
+    return;
+  }
+  codec_.audio_clock().OnWrite(pts, out_buffer_size, rate);
+  // 环满时不在工作线程上等，剩下的留给下一次 GetAudioSinkState 补写
+  size_t written = pcm_ring_->Write(out_buffer, out_buffer_size);
+  if (written < size_t(out_buffer_size)) {
+    pcm_pending_.assign(out_buffer + written, out_buffer + out_buffer_size);
+    pcm_pending_offset_ = 0;
+  }
+  pcm_started_ = true;
+}
+
+void VideoPlayerView::OnAudioStreamInfo(int sample_rate, int channels,
+                                        int sample_format) {
+  if (!first_audio_frame_) {
+    return;
+  }
+  // 解封装线程接着去打开解码器，声卡在单独的线程上同时打开。
+  // 打开之前音频输出任务会被 GetAudioSinkState 挡住，不会碰到半初始化的成员
+  if (audio_open_thread_.joinable()) {
+    audio_open_thread_.join();
+  }
+  audio_opening_ = true;
+  audio_open_thread_ = std::thread([this, sample_rate, channels,
+                                    sample_format] {
+    int64_t start_us = av_gettime_relative();
+    if (InitSdlAudio(sample_rate, channels, sample_format,
+                     kAudioOpenSamples)) {
+      first_audio_frame_ = false;
+      spdlog::info("audio device opened in {:.1f}ms",
+                   (av_gettime_relative() - start_us) / 1000.0);
+    }
+    audio_opening_ = false;
+    // 这期间到的音频帧都在队列里等着，打开了马上接着送
+    codec_.ResumeAudioOutput();
+  });
+}
+
+AudioSinkState VideoPlayerView::GetAudioSinkState() {
+  if (audio_opening_) {
+    return AudioSinkState::kOpening;
+  }
+  if (!pcm_ring_) {
+    return AudioSinkState::kReady;
+  }
+  // seek 之后上一段没写完的声音也作废
+  if (stretcher_reset_) {
+    DropPendingPcm();
+  }
+  // 先补写上一帧剩下的部分，还写不完就等回调再消费一些
+  if (pcm_pending_offset_ < pcm_pending_.size()) {
+    pcm_pending_offset_ +=
+        pcm_ring_->Write(pcm_pending_.data() + pcm_pending_offset_,
+                         pcm_pending_.size() - pcm_pending_offset_);
+    if (pcm_pending_offset_ < pcm_pending_.size()) {
+      return AudioSinkState::kFull;
+    }
+    DropPendingPcm();
+  }
+  // 环里还有一半以上的数据就先不写
+  return pcm_ring_->ReadAvailable() <= pcm_ring_->capacity() / 2
+             ? AudioSinkState::kReady
+             : AudioSinkState::kFull;
+}
+
+void VideoPlayerView::DropPendingPcm() {
+  pcm_pending_.clear();
+  pcm_pending_offset_ = 0;
 }
 
 void VideoPlayerView::OnMediaError() {
   close(); 
 }
 
-void VideoPlayerView::renderFrame(QImage frame) {
-  current_frame_ = frame;
+void VideoPlayerView::OnSeek() {
+  // 环里是 seek 之前的声音，交给回调在下次取数据时丢掉。
+  // pcm_started_ 之后 pcm_ring_ 才一定已经创建
+  if (pcm_started_) {
+    pcm_ring_->Clear();
+  }
+  stretcher_reset_ = true;
+}
+
+void VideoPlayerView::renderFrame() {
+  // 不在这里取帧：多次 update 会合并成一次重绘，到 paintEvent 再取最新的
   update();
 }
 
+void VideoPlayerView::resizeEvent(QResizeEvent* event) {
+  // 转换线程直接输出窗口大小的图像（物理像素）
+  QSize target = (QSizeF(size()) * devicePixelRatioF()).toSize();
+  converter_.SetTargetSize(target.width(), target.height());
+  // 暂停时没有新帧会来，让送显任务按新尺寸把当前帧重新转换一遍
+  codec_.RefreshFrame();
+  super_class::resizeEvent(event);
+}
+
 void VideoPlayerView::paintEvent(QPaintEvent* event) {
   QPainter painter(this);
-  if (!current_frame_.isNull()) {
-    QSize windowSize = this->size();
-    QImage scaledFrame = current_frame_.scaled(windowSize, Qt::KeepAspectRatio,
-                                               Qt::SmoothTransformation);
-    int startX = (windowSize.width() - scaledFrame.width()) / 2;
-    int startY = (windowSize.height() - scaledFrame.height()) / 2;
-    painter.drawImage(startX, startY, scaledFrame);
+  int64_t published_us = 0;
+  if (mailbox_.Take(&current_frame_, &published_us)) {
+    // 从放进信箱到界面线程画出来之前取走的时间
+    codec_.pipeline_stats().Record(PipelineStage::kDeliver,
+                                   av_gettime_relative() - published_us);
   }
+  if (current_frame_.isNull()) {
+    return;
+  }
+  int64_t start_us = av_gettime_relative();
+
+  qreal dpr = devicePixelRatioF();
+  QSize target = (QSizeF(size()) * dpr).toSize();
+  QSize fitted = current_frame_.size().scaled(target, Qt::KeepAspectRatio);
+
+  // 正常情况下图像已经是窗口的物理像素大小，按 1:1 贴图。刚 resize 时
+  // 还是旧尺寸的帧，按新尺寸的帧送到之前先快速缩放一次并缓存，之后的
+  // 重绘直接用，不再重新采样
+  const QImage* image = &current_frame_;
+  if (current_frame_.size() != fitted) {
+    if (scaled_frame_key_ != current_frame_.cacheKey() ||
+        scaled_frame_.size() != fitted) {
+      scaled_frame_ = current_frame_.scaled(fitted, Qt::IgnoreAspectRatio,
+                                            Qt::FastTransformation);
+      scaled_frame_key_ = current_frame_.cacheKey();
+    }
+    image = &scaled_frame_;
+  } else {
+    scaled_frame_ = QImage();
+  }
+
+  QSizeF logical_size = QSizeF(image->size()) / dpr;
+  QRectF rect((width() - logical_size.width()) / 2,
+              (height() - logical_size.height()) / 2, logical_size.width(),
+              logical_size.height());
+  painter.drawImage(rect, *image);
+  codec_.pipeline_stats().Record(PipelineStage::kPaint,
+                                 av_gettime_relative() - start_us);
 }
@@ -12,8 +12,17 @@
 #include <stdio.h>
 
 #include <QWidget>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-#include "blocking_queue.h"
+#include "audio_resampler.hpp"
+#include "audio_time_stretcher.hpp"
+#include "frame_converter.hpp"
+#include "frame_mailbox.hpp"
+#include "pcm_ring_buffer.hpp"
 #include "video_codec.hpp"
 
 class VideoPlayerView : public QWidget, public VideoCodecListener {
@@ -23,30 +32,79 @@ class VideoPlayerView : public QWidget, public VideoCodecListener {
   Q_OBJECT
 
  public:
-  VideoPlayerView(const char* path);
+  VideoPlayerView(const char* path,
+                  const DecoderOptions& options = DecoderOptions(),
+                  QWidget* parent = nullptr);
   ~VideoPlayerView();
 
-  void renderFrame(QImage frame);
+  // frameAvailable 的槽：信箱里有新帧，安排一次重绘
+  void renderFrame();
   void paintEvent(QPaintEvent* event) override;
+  void resizeEvent(QResizeEvent* event) override;
   void AudioCallback(void* userdata, Uint8* stream, int len);
-  bool InitSdlAudio(AVFramePtr frame);
+  // 按给定格式打开声卡并建好重采样、PCM 环。samples 是每次回调的帧数
+  bool InitSdlAudio(int sample_rate, int channels, int sample_format,
+                    int samples);
+  // 音频回调拿不到足够 PCM、只能补静音的次数
+  uint64_t audio_underruns() const { return audio_underruns_; }
+  // 转换好了但还没画出来就被更新的帧顶掉的次数
+  uint64_t superseded_frames() const { return mailbox_.superseded(); }
+  VideoCodec& codec() { return codec_; }
 
  signals:
-  void frameReady(QImage frame);
+  // 信箱从空变成有帧时发出，界面线程没处理之前不会再发
+  void frameAvailable();
   void audioFrameReady(AVFramePtr frame);
 
  private:
   void OnVideoFrame(AVFramePtr frame) override;
   void OnAudioFrame(AVFramePtr frame) override;
+  AudioSinkState GetAudioSinkState() override;
   void OnMediaError() override;
+  void OnSeek() override;
+  void OnAudioStreamInfo(int sample_rate, int channels,
+                         int sample_format) override;
   void keyPressEvent(QKeyEvent *event) override;
+  void SetPaused(bool pause);
+  void DropPendingPcm();
 
  private:
+  // 送显任务把转换好的帧放进信箱，界面线程在 paintEvent 里取最新的一帧
+  FrameMailbox mailbox_;
   QImage current_frame_;
-  BlockingQueue<AVFramePtr> audio_frames_;
-  bool first_audio_frame_ = true;
+  // 转换线程按新窗口尺寸出的帧送到之前，旧尺寸帧缩放后的缓存
+  QImage scaled_frame_;
+  qint64 scaled_frame_key_ = 0;
+  std::atomic<bool> first_audio_frame_{true};
+  std::atomic<bool> audio_opened_{false};
+  // 声卡在 audio_open_thread_ 上提前打开，期间 GetAudioSinkState 返回
+  // kOpening。打开很慢时会一直占着线程，所以不用调度器的工作线程
+  std::atomic<bool> audio_opening_{false};
+  std::thread audio_open_thread_;
+  SDL_AudioDeviceID audio_device_ = 0;
   SDL_AudioSpec obtained_;
-  bool pause_ = false; 
+  // 大帧按条带分给共享调度器并行转换
+  FrameConverter converter_{YuvKernel::kAuto, &TaskScheduler::Shared()};
+  // 重采样和变速在 codec 的音频输出任务里完成，回调只从 pcm_ring_ 拷贝。
+  // 三者都只在音频输出任务里访问
+  std::unique_ptr<AudioResampler> resampler_;
+  std::unique_ptr<AudioTimeStretcher> stretcher_;
+  // OnSeek 可能在别的线程，只打个标记，由音频输出任务去 Reset stretcher_
+  std::atomic<bool> stretcher_reset_{false};
+  std::unique_ptr<PcmRingBuffer> pcm_ring_;
+  // 环满时没写进去的 PCM，下次 GetAudioSinkState 先补写。
+  // 只在音频输出任务里访问
+  std::vector<uint8_t> pcm_pending_;
+  size_t pcm_pending_offset_ = 0;
+  std::atomic<bool> pcm_started_{false};
+  std::atomic<uint64_t> audio_underruns_{0};
+  // 界面线程写，提前打开声卡的任务里也要读；和打开声卡、暂停声卡一起
+  // 在 audio_pause_mutex_ 下改，不会出现刚打开就在暂停中出声
+  std::atomic<bool> pause_{false};
+  std::mutex audio_pause_mutex_;
+  bool reverse_ = false;
+  // 放在最后、最先析构：解码和送显任务的回调会用到上面这些成员
+  VideoCodec codec_;
 };
 
 #endif /* video_player_view_hpp */
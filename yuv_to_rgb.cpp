@@ -0,0 +1,327 @@
+//
+//  yuv_to_rgb.cpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/15.
+//
+
+#include "yuv_to_rgb.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define QVP_HAS_X86_SIMD 1
+#define QVP_TARGET(x) __attribute__((target(x)))
+#else
+#define QVP_HAS_X86_SIMD 0
+#endif
+
+// 系数都是乘以 64 之后取整。Y 项最大 239 * 75，加上色度项后可能超出 int16，
+// 所有实现都按 int16 饱和加法算，超出的部分最后本来就会被截到 255
+YuvToRgbParams MakeYuvToRgbParams(bool bt709, bool full_range) {
+  if (bt709) {
+    return full_range ? YuvToRgbParams{0, 64, 101, 12, 30, 119}
+                      : YuvToRgbParams{16, 75, 115, 14, 34, 135};
+  }
+  return full_range ? YuvToRgbParams{0, 64, 90, 22, 46, 113}
+                    : YuvToRgbParams{16, 75, 102, 25, 52, 129};
+}
+
+static inline int Sat16(int value) {
+  return value < -32768 ? -32768 : (value > 32767 ? 32767 : value);
+}
+
+static inline uint8_t ClampToByte(int value) {
+  return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+void YuvToRgb32Row_C(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+                     uint8_t* dst, int width, const YuvToRgbParams& p) {
+  for (int x = 0; x < width; ++x) {
+    int yy = (y[x] - p.y_offset) * p.y_coef;
+    int uu = u[x >> 1] - 128;
+    int vv = v[x >> 1] - 128;
+    int r = Sat16(Sat16(yy + p.v_to_r * vv) + 32);
+    int g = Sat16(Sat16(Sat16(yy - p.u_to_g * uu) - p.v_to_g * vv) + 32);
+    int b = Sat16(Sat16(yy + p.u_to_b * uu) + 32);
+    dst[0] = ClampToByte(b >> 6);
+    dst[1] = ClampToByte(g >> 6);
+    dst[2] = ClampToByte(r >> 6);
+    dst[3] = 0xff;
+    dst += 4;
+  }
+}
+
+static void SplitUvRow_C(const uint8_t* uv, uint8_t* u, uint8_t* v, int count) {
+  for (int i = 0; i < count; ++i) {
+    u[i] = uv[2 * i];
+    v[i] = uv[2 * i + 1];
+  }
+}
+
+static void Shift10To8Row_C(const uint16_t* src, uint8_t* dst, int count) {
+  for (int i = 0; i < count; ++i) {
+    dst[i] = ClampToByte(src[i] >> 2);
+  }
+}
+
+#if QVP_HAS_X86_SIMD
+
+// 8 个像素的 B/G/R 通道，输入是已经减过偏移的 int16
+QVP_TARGET("sse2")
+static inline void ChannelsSSE2(__m128i yy, __m128i uu, __m128i vv,
+                                const YuvToRgbParams& p, __m128i* b,
+                                __m128i* g, __m128i* r) {
+  const __m128i round = _mm_set1_epi16(32);
+  __m128i rr = _mm_adds_epi16(yy, _mm_mullo_epi16(vv, _mm_set1_epi16(p.v_to_r)));
+  __m128i gg = _mm_subs_epi16(yy, _mm_mullo_epi16(uu, _mm_set1_epi16(p.u_to_g)));
+  gg = _mm_subs_epi16(gg, _mm_mullo_epi16(vv, _mm_set1_epi16(p.v_to_g)));
+  __m128i bb = _mm_adds_epi16(yy, _mm_mullo_epi16(uu, _mm_set1_epi16(p.u_to_b)));
+  *r = _mm_srai_epi16(_mm_adds_epi16(rr, round), 6);
+  *g = _mm_srai_epi16(_mm_adds_epi16(gg, round), 6);
+  *b = _mm_srai_epi16(_mm_adds_epi16(bb, round), 6);
+}
+
+QVP_TARGET("sse2")
+static void YuvToRgb32Row_SSE2(const uint8_t* y, const uint8_t* u,
+                               const uint8_t* v, uint8_t* dst, int width,
+                               const YuvToRgbParams& p) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha = _mm_set1_epi8(static_cast<char>(0xff));
+  const __m128i c128 = _mm_set1_epi16(128);
+  const __m128i y_offset = _mm_set1_epi16(p.y_offset);
+  const __m128i y_coef = _mm_set1_epi16(p.y_coef);
+
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+    __m128i u8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + x / 2));
+    __m128i v8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(v + x / 2));
+
+    // 色度样本复制成两个像素
+    __m128i u16 = _mm_sub_epi16(_mm_unpacklo_epi8(u8, zero), c128);
+    __m128i v16 = _mm_sub_epi16(_mm_unpacklo_epi8(v8, zero), c128);
+    __m128i u_lo = _mm_unpacklo_epi16(u16, u16);
+    __m128i u_hi = _mm_unpackhi_epi16(u16, u16);
+    __m128i v_lo = _mm_unpacklo_epi16(v16, v16);
+    __m128i v_hi = _mm_unpackhi_epi16(v16, v16);
+
+    __m128i y_lo = _mm_mullo_epi16(
+        _mm_sub_epi16(_mm_unpacklo_epi8(y8, zero), y_offset), y_coef);
+    __m128i y_hi = _mm_mullo_epi16(
+        _mm_sub_epi16(_mm_unpackhi_epi8(y8, zero), y_offset), y_coef);
+
+    __m128i b_lo, g_lo, r_lo, b_hi, g_hi, r_hi;
+    ChannelsSSE2(y_lo, u_lo, v_lo, p, &b_lo, &g_lo, &r_lo);
+    ChannelsSSE2(y_hi, u_hi, v_hi, p, &b_hi, &g_hi, &r_hi);
+    __m128i b = _mm_packus_epi16(b_lo, b_hi);
+    __m128i g = _mm_packus_epi16(g_lo, g_hi);
+    __m128i r = _mm_packus_epi16(r_lo, r_hi);
+
+    __m128i bg_lo = _mm_unpacklo_epi8(b, g);
+    __m128i bg_hi = _mm_unpackhi_epi8(b, g);
+    __m128i ra_lo = _mm_unpacklo_epi8(r, alpha);
+    __m128i ra_hi = _mm_unpackhi_epi8(r, alpha);
+    __m128i* out = reinterpret_cast<__m128i*>(dst + x * 4);
+    _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(bg_lo, ra_lo));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(bg_lo, ra_lo));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(bg_hi, ra_hi));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(bg_hi, ra_hi));
+  }
+
+  if (x < width) {
+    YuvToRgb32Row_C(y + x, u + x / 2, v + x / 2, dst + x * 4, width - x, p);
+  }
+}
+
+QVP_TARGET("avx2")
+static inline void ChannelsAVX2(__m256i yy, __m256i uu, __m256i vv,
+                                const YuvToRgbParams& p, __m256i* b,
+                                __m256i* g, __m256i* r) {
+  const __m256i round = _mm256_set1_epi16(32);
+  __m256i rr =
+      _mm256_adds_epi16(yy, _mm256_mullo_epi16(vv, _mm256_set1_epi16(p.v_to_r)));
+  __m256i gg =
+      _mm256_subs_epi16(yy, _mm256_mullo_epi16(uu, _mm256_set1_epi16(p.u_to_g)));
+  gg = _mm256_subs_epi16(gg,
+                         _mm256_mullo_epi16(vv, _mm256_set1_epi16(p.v_to_g)));
+  __m256i bb =
+      _mm256_adds_epi16(yy, _mm256_mullo_epi16(uu, _mm256_set1_epi16(p.u_to_b)));
+  *r = _mm256_srai_epi16(_mm256_adds_epi16(rr, round), 6);
+  *g = _mm256_srai_epi16(_mm256_adds_epi16(gg, round), 6);
+  *b = _mm256_srai_epi16(_mm256_adds_epi16(bb, round), 6);
+}
+
+// AVX2 的 unpack/pack 都是按 128bit lane 进行的，下面的 permute 用来把
+// 像素顺序理顺，注释里的 px 指这一批 32 个像素中的序号
+QVP_TARGET("avx2")
+static void YuvToRgb32Row_AVX2(const uint8_t* y, const uint8_t* u,
+                               const uint8_t* v, uint8_t* dst, int width,
+                               const YuvToRgbParams& p) {
+  const __m256i alpha = _mm256_set1_epi8(static_cast<char>(0xff));
+  const __m256i c128 = _mm256_set1_epi16(128);
+  const __m256i y_offset = _mm256_set1_epi16(p.y_offset);
+  const __m256i y_coef = _mm256_set1_epi16(p.y_coef);
+
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    __m256i y_lo = _mm256_cvtepu8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x)));
+    __m256i y_hi = _mm256_cvtepu8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x + 16)));
+    y_lo = _mm256_mullo_epi16(_mm256_sub_epi16(y_lo, y_offset), y_coef);
+    y_hi = _mm256_mullo_epi16(_mm256_sub_epi16(y_hi, y_offset), y_coef);
+
+    // 16 个色度样本 c0..c15，重排成 lane0: c0-3 c8-11，lane1: c4-7 c12-15，
+    // 这样 unpacklo 得到 px0-15，unpackhi 得到 px16-31
+    __m256i u16 = _mm256_sub_epi16(
+        _mm256_cvtepu8_epi16(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(u + x / 2))),
+        c128);
+    __m256i v16 = _mm256_sub_epi16(
+        _mm256_cvtepu8_epi16(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + x / 2))),
+        c128);
+    u16 = _mm256_permute4x64_epi64(u16, 0xD8);
+    v16 = _mm256_permute4x64_epi64(v16, 0xD8);
+    __m256i u_lo = _mm256_unpacklo_epi16(u16, u16);
+    __m256i u_hi = _mm256_unpackhi_epi16(u16, u16);
+    __m256i v_lo = _mm256_unpacklo_epi16(v16, v16);
+    __m256i v_hi = _mm256_unpackhi_epi16(v16, v16);
+
+    __m256i b_lo, g_lo, r_lo, b_hi, g_hi, r_hi;
+    ChannelsAVX2(y_lo, u_lo, v_lo, p, &b_lo, &g_lo, &r_lo);
+    ChannelsAVX2(y_hi, u_hi, v_hi, p, &b_hi, &g_hi, &r_hi);
+    // pack 之后 lane0: px0-7 px16-23，lane1: px8-15 px24-31
+    __m256i b = _mm256_packus_epi16(b_lo, b_hi);
+    __m256i g = _mm256_packus_epi16(g_lo, g_hi);
+    __m256i r = _mm256_packus_epi16(r_lo, r_hi);
+
+    // bg_lo lane0: px0-7，lane1: px8-15；bg_hi lane0: px16-23，lane1: px24-31
+    __m256i bg_lo = _mm256_unpacklo_epi8(b, g);
+    __m256i bg_hi = _mm256_unpackhi_epi8(b, g);
+    __m256i ra_lo = _mm256_unpacklo_epi8(r, alpha);
+    __m256i ra_hi = _mm256_unpackhi_epi8(r, alpha);
+
+    // p0 lane0: px0-3，lane1: px8-11；p1: px4-7 / px12-15；
+    // p2: px16-19 / px24-27；p3: px20-23 / px28-31
+    __m256i p0 = _mm256_unpacklo_epi16(bg_lo, ra_lo);
+    __m256i p1 = _mm256_unpackhi_epi16(bg_lo, ra_lo);
+    __m256i p2 = _mm256_unpacklo_epi16(bg_hi, ra_hi);
+    __m256i p3 = _mm256_unpackhi_epi16(bg_hi, ra_hi);
+
+    __m256i* out = reinterpret_cast<__m256i*>(dst + x * 4);
+    _mm256_storeu_si256(out + 0, _mm256_permute2x128_si256(p0, p1, 0x20));
+    _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(p0, p1, 0x31));
+    _mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(p2, p3, 0x20));
+    _mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(p2, p3, 0x31));
+  }
+
+  if (x < width) {
+    YuvToRgb32Row_SSE2(y + x, u + x / 2, v + x / 2, dst + x * 4, width - x,
+                       p);
+  }
+}
+
+QVP_TARGET("sse2")
+static void SplitUvRow_SSE2(const uint8_t* uv, uint8_t* u, uint8_t* v,
+                            int count) {
+  const __m128i mask = _mm_set1_epi16(0x00ff);
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + 2 * i));
+    __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + 2 * i + 16));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(u + i),
+                     _mm_packus_epi16(_mm_and_si128(a, mask),
+                                      _mm_and_si128(b, mask)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(v + i),
+                     _mm_packus_epi16(_mm_srli_epi16(a, 8),
+                                      _mm_srli_epi16(b, 8)));
+  }
+  SplitUvRow_C(uv + 2 * i, u + i, v + i, count - i);
+}
+
+QVP_TARGET("sse2")
+static void Shift10To8Row_SSE2(const uint16_t* src, uint8_t* dst, int count) {
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_packus_epi16(_mm_srli_epi16(a, 2),
+                                      _mm_srli_epi16(b, 2)));
+  }
+  Shift10To8Row_C(src + i, dst + i, count - i);
+}
+
+static bool CpuHasSse2() { return __builtin_cpu_supports("sse2"); }
+static bool CpuHasAvx2() { return __builtin_cpu_supports("avx2"); }
+
+#else
+
+static bool CpuHasSse2() { return false; }
+static bool CpuHasAvx2() { return false; }
+
+#endif  // QVP_HAS_X86_SIMD
+
+YuvKernel ResolveYuvKernel(YuvKernel kernel) {
+  if (kernel != YuvKernel::kAuto) {
+    return kernel;
+  }
+  if (CpuHasAvx2()) {
+    return YuvKernel::kAvx2;
+  }
+  if (CpuHasSse2()) {
+    return YuvKernel::kSse2;
+  }
+  return YuvKernel::kScalar;
+}
+
+YuvToRgb32RowFunc GetYuvToRgb32Row(YuvKernel kernel) {
+  switch (ResolveYuvKernel(kernel)) {
+    case YuvKernel::kScalar:
+      return YuvToRgb32Row_C;
+#if QVP_HAS_X86_SIMD
+    case YuvKernel::kSse2:
+      return CpuHasSse2() ? YuvToRgb32Row_SSE2 : nullptr;
+    case YuvKernel::kAvx2:
+      return CpuHasAvx2() ? YuvToRgb32Row_AVX2 : nullptr;
+#endif
+    default:
+      return nullptr;
+  }
+}
+
+const char* YuvKernelName(YuvKernel kernel) {
+  switch (kernel) {
+    case YuvKernel::kAuto:
+      return "auto";
+    case YuvKernel::kScalar:
+      return "scalar";
+    case YuvKernel::kSse2:
+      return "sse2";
+    case YuvKernel::kAvx2:
+      return "avx2";
+  }
+  return "unknown";
+}
+
+void SplitUvRow(const uint8_t* uv, uint8_t* u, uint8_t* v, int count) {
+#if QVP_HAS_X86_SIMD
+  if (CpuHasSse2()) {
+    SplitUvRow_SSE2(uv, u, v, count);
+    return;
+  }
+#endif
+  SplitUvRow_C(uv, u, v, count);
+}
+
+void Shift10To8Row(const uint16_t* src, uint8_t* dst, int count) {
+#if QVP_HAS_X86_SIMD
+  if (CpuHasSse2()) {
+    Shift10To8Row_SSE2(src, dst, count);
+    return;
+  }
+#endif
+  Shift10To8Row_C(src, dst, count);
+}
@@ -0,0 +1,51 @@
+//
+//  yuv_to_rgb.hpp
+//  QVideoPlayer
+//
+//  Created by jt on 2024/01/15.
+//
+
+#ifndef yuv_to_rgb_hpp
+#define yuv_to_rgb_hpp
+
+#include <cstdint>
+
+// 逐行的 YUV -> RGB32 转换核心。输出字节序为 B G R A（小端下即
+// QImage::Format_RGB32 / AV_PIX_FMT_RGB32），A 固定 0xff。
+// 所有实现使用同一套 6bit 定点系数，SIMD 与标量结果逐位一致。
+
+struct YuvToRgbParams {
+  int16_t y_offset;  // limited range 为 16，full range 为 0
+  int16_t y_coef;
+  int16_t v_to_r;
+  int16_t u_to_g;
+  int16_t v_to_g;
+  int16_t u_to_b;
+};
+
+// bt709 为 false 时使用 BT.601
+YuvToRgbParams MakeYuvToRgbParams(bool bt709, bool full_range);
+
+// 一行 planar 像素：u/v 为半宽色度（每个色度样本覆盖两个像素）
+using YuvToRgb32RowFunc = void (*)(const uint8_t* y, const uint8_t* u,
+                                   const uint8_t* v, uint8_t* dst, int width,
+                                   const YuvToRgbParams& params);
+
+enum class YuvKernel { kAuto, kScalar, kSse2, kAvx2 };
+
+void YuvToRgb32Row_C(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+                     uint8_t* dst, int width, const YuvToRgbParams& params);
+
+// 返回指定实现；kAuto 选择当前 CPU 支持的最快实现，不支持的实现返回 nullptr
+YuvToRgb32RowFunc GetYuvToRgb32Row(YuvKernel kernel);
+const char* YuvKernelName(YuvKernel kernel);
+// kAuto 实际解析到的实现
+YuvKernel ResolveYuvKernel(YuvKernel kernel);
+
+// NV12 的交织 UV 行拆成两个平面，count 为色度样本数
+void SplitUvRow(const uint8_t* uv, uint8_t* u, uint8_t* v, int count);
+
+// 10bit（小端 16bit 容器）样本截成 8bit
+void Shift10To8Row(const uint16_t* src, uint8_t* dst, int count);
+
+#endif /* yuv_to_rgb_hpp */